@@ -0,0 +1,95 @@
+/*
+ * clock.c
+ *
+ * Description:	Module responsible for the free running microsecond clock
+ */ 
+
+#include "clock.h"
+#include "statistics.h"
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+// timer 1 runs free at 1MHz from the 8MHz clock, the overflow 
+// interrupt counts the upper 16 bits of the microsecond time
+#define NORMAL_MODE								0x00
+#define CLOCK_DIVIDED_BY_8						0x02
+#define TIMER_OVERFLOW_INTERRUPT_ENABLE			0x01
+#define TIMER_OVERFLOW_FLAG						0x01
+
+#define LOWER_HALF_OF_COUNT						0x8000
+
+static volatile unsigned short clk_overflow_count;
+
+// name:	CLK_Init
+// Desc:	Module initialisation function starts timer 1 free running.
+void CLK_Init(void)
+{
+	clk_overflow_count = 0;
+	//
+	TCCR1A = NORMAL_MODE;
+	TCCR1B = NORMAL_MODE;
+	TCNT1 = 0;
+	TIFR1 = TIMER_OVERFLOW_FLAG;
+	TIMSK1 = TIMER_OVERFLOW_INTERRUPT_ENABLE;
+	//
+	// start the clock
+	TCCR1B = CLOCK_DIVIDED_BY_8;
+}
+
+// name:	CLK_Get_time_us
+// Desc:	returns the microseconds since the clock was started, wraps after about 71 minutes.
+unsigned long CLK_Get_time_us(void)
+{
+	unsigned short overflow_count;
+	unsigned short timer_count;
+	unsigned char saved_sreg;
+	
+	// read the counter and overflow count together
+	saved_sreg = SREG;
+	cli();
+	//
+	timer_count = TCNT1;
+	overflow_count = clk_overflow_count;
+	//
+	// if the counter has overflowed but the interrupt hasn't run yet 
+	// then count it here, a low count means it wrapped before the read
+	if((0 != (TIFR1 & TIMER_OVERFLOW_FLAG)) && (LOWER_HALF_OF_COUNT > timer_count))
+	{
+		overflow_count++;
+	}
+	//
+	SREG = saved_sreg;
+	
+	return (((unsigned long)overflow_count << 16) | timer_count);
+}
+
+// name:	CLK_Get_timestamp_us
+// Desc:	returns the lower 16 bits of the microsecond time, for timing 
+//			short intervals. Interrupts are held off so the two byte counter 
+//			read can't be split by an ISR which also reads the counter.
+unsigned short CLK_Get_timestamp_us(void)
+{
+	unsigned short timer_count;
+	unsigned char saved_sreg;
+	
+	saved_sreg = SREG;
+	cli();
+	//
+	timer_count = TCNT1;
+	//
+	SREG = saved_sreg;
+	
+	return timer_count;
+}
+
+// name:	ISR(TIMER1_OVF_vect)
+// Desc:	timer 1 overflow interrupt.
+ISR(TIMER1_OVF_vect)
+{
+	STS_TIMING_START();
+	
+	clk_overflow_count++;
+	//
+	STS_ISR_TIMING_END(STS_ISR_TIMER1_OVF);
+}
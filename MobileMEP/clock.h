@@ -0,0 +1,16 @@
+/*
+ * clock.h
+ *
+ * Description:	Module responsible for the free running microsecond clock
+ */ 
+
+
+#ifndef CLOCK_H_
+#define CLOCK_H_
+
+void CLK_Init(void);
+unsigned long CLK_Get_time_us(void);
+unsigned short CLK_Get_timestamp_us(void);
+
+
+#endif /* CLOCK_H_ */
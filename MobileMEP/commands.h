@@ -0,0 +1,41 @@
+/*
+ * commands.h
+ *
+ * Description:	build time list of the commands handled by the communications module
+ */
+
+
+#ifndef COMMANDS_H_
+#define COMMANDS_H_
+
+#include "statistics.h"
+
+// every command handled has an entry CMS_COMMAND(command, command handler),
+// the handlers are held in flash indexed by the command so a command can
+// only have one entry. Command numbers are in communications.h and the
+// handlers are CMS_COMMAND_HANDLER functions. A module can instead call 
+// CMS_Register_command for a few commands of its own, at the cost of 
+// a little ram and a search when they arrive.
+#define CMS_COMMAND_TABLE \
+	CMS_COMMAND(CMS_COMMAND_GET_STATUS,				CMS_Get_status_command) \
+	CMS_COMMAND(CMS_COMMAND_TIME_SYNC,				CMS_Time_sync_command) \
+	CMS_COMMAND(CMS_COMMAND_BATCH,					CMS_Batch_command) \
+	CMS_COMMAND(CMS_COMMAND_SET_BAUD_RATE,			CMS_Set_baud_rate_command) \
+	CMS_STATISTICS_COMMAND_TABLE \
+	CMS_EXTRA_COMMAND_TABLE
+
+// the statistics commands are only there when the statistics are kept
+#ifdef STATISTICS_ENABLED
+#define CMS_STATISTICS_COMMAND_TABLE \
+	CMS_COMMAND(CMS_COMMAND_GET_STATS,				STS_Get_statistics_command) \
+	CMS_COMMAND(CMS_COMMAND_GET_AND_RESET_STATS,	STS_Get_and_reset_statistics_command)
+#else
+#define CMS_STATISTICS_COMMAND_TABLE
+#endif
+
+// builds such as the host benchmark can add their own commands
+#ifndef CMS_EXTRA_COMMAND_TABLE
+#define CMS_EXTRA_COMMAND_TABLE
+#endif
+
+#endif /* COMMANDS_H_ */
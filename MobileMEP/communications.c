@@ -11,11 +11,34 @@
 #include "serial.h"
 #include "utilities.h"
 #include "crc.h"
+#include "statistics.h"
+#include "clock.h"
+#include "timer.h"
 
 #include <string.h>
+#include <avr/pgmspace.h>
 
 #define MAX_PACKET_BYTES					200
-#define MAX_RX_PACKETS						10
+
+// received packets are allocated from a byte pool at their exact size,
+// so the pool holds many short packets or a few long ones. Each port has 
+// its own pool, port 1 only sees forwarded and bus traffic so its pool is 
+// smaller but still holds the longest packet.
+#define PORT_0_RX_PACKET_POOL_BYTES			512
+#define PORT_1_RX_PACKET_POOL_BYTES			256
+#define MAX_RX_PACKETS						12
+
+#if ((PORT_0_RX_PACKET_POOL_BYTES < MAX_PACKET_BYTES) || (PORT_1_RX_PACKET_POOL_BYTES < MAX_PACKET_BYTES))
+#error "a received packet pool is too small for the longest packet"
+#endif
+
+// a byte count above this can only be noise, and a packet which isn't 
+// complete this long after its start byte is given up on. If no timer is 
+// free for a packet its start time is checked against the timeout instead 
+// whenever the engine runs, so it is only given up on once more bytes arrive.
+#define MAX_RECEIVED_DATA_BYTES				CMS_MAX_DATA_BYTES
+#define RECEIVED_PACKET_TIMEOUT				TIMER_COUNT_50_MS
+#define RECEIVED_PACKET_TIMEOUT_US			50000UL
 
 // packet byte position #defines
 #define START_OF_PACKET_BYTE				0
@@ -32,214 +55,1486 @@
 #define END_OF_PACKET						0xD9
 #define DEFAULT_PACKET_SIZE					7
 
+// packets on a shared bus have their own start byte followed by the address, 
+// the rest of the packet is the same. The address isn't kept in a received 
+// packet so the byte positions above still hold, a packet is sent as a 
+// prefix of the start byte and any address followed by the rest of it from 
+// the byte count on. The address has an input index past the end of any 
+// packet while it is being populated.
+#define ADDRESSED_START_OF_PACKET			0x74
+#define ADDRESS_PREFIX_START_BYTE			0
+#define ADDRESS_PREFIX_ADDRESS_BYTE			1
+#define ADDRESS_PREFIX_BYTES				2
+#define UNADDRESSED_PREFIX_BYTES			1
+#define ADDRESS_INPUT_INDEX					0xFF
+#define BYTES_AFTER_BYTE_COUNT				(DEFAULT_PACKET_SIZE - BYTE_COUNT_BYTE - 1)
+#define PACKET_BYTES_FROM_BYTE_COUNT(byte_count)	((DEFAULT_PACKET_SIZE - BYTE_COUNT_BYTE) + (byte_count))
+
+// the response is sent as the prefix, the rest of the header, the data and the crc trailer
+#define PACKET_HEADER_BYTES					4
+#define HEADER_BYTES_AFTER_PREFIX			(PACKET_HEADER_BYTES - BYTE_COUNT_BYTE)
+#define TRAILER_CRC_LSB_BYTE				0
+#define TRAILER_CRC_MSB_BYTE				1
+#define TRAILER_END_OF_PACKET_BYTE			2
+#define PACKET_TRAILER_BYTES				3
+#define RESPONSE_FRAGMENT_PREFIX			0
+#define RESPONSE_FRAGMENT_HEADER			1
+#define RESPONSE_FRAGMENT_DATA				2
+#define RESPONSE_FRAGMENT_TRAILER			3
+#define NUMBER_OF_RESPONSE_FRAGMENTS		4
+
+// a forwarded packet is sent as the prefix then the rest of it as it arrived 
+// apart from its crc, using the first two of the response fragments
+#define NUMBER_OF_FORWARD_FRAGMENTS			2
+
 // commands #defines 
 #define NO_ADDITIONAL_BYTES					0
 
-#define COMMAND_GET_STATUS					0x10
+// requests we send are built whole in their slot so they can be sent again 
+// if the response doesn't arrive in time
+#define REQUEST_SEQUENCE_NUMBER_BYTE		START_OF_ADDITIONAL_DATA
+#define REQUEST_SEQUENCE_NUMBER_BYTES		1
+#define MAX_REQUEST_PACKET_BYTES			(DEFAULT_PACKET_SIZE + REQUEST_SEQUENCE_NUMBER_BYTES + CMS_MAX_REQUEST_DATA_BYTES)
+#define REQUEST_FRAGMENT_PREFIX				0
+#define REQUEST_FRAGMENT_PACKET				1
+#define NUMBER_OF_REQUEST_FRAGMENTS			2
+#define REQUEST_TIMEOUT						TIMER_COUNT_500_MS
+#define REQUEST_RETRIES						2
+
+// the time sync response holds the request receive time and the response 
+// transmit time followed by an echo of the request data
+#define TIME_SYNC_TIME_BYTES				8
+#define TIME_SYNC_MAX_ECHO_BYTES			(CMS_MAX_DATA_BYTES - TIME_SYNC_TIME_BYTES)
+
+// batch requests and responses are a run of entries of the command, the 
+// data length and the data. A response entry without data has a status in 
+// place of the length, BATCH_NOT_HANDLED for a sub-command which isn't 
+// handled or isn't allowed in a batch, BATCH_MALFORMED for one whose data 
+// runs past the end of the request and BATCH_NO_ROOM for one whose response 
+// doesn't fit and every one after it. The host resends the sub-commands 
+// from the first BATCH_NO_ROOM, which runs that one again, so commands that 
+// change something when run twice aren't allowed in a batch. Each entry 
+// in a request has at least a header so there is always room for a status 
+// entry for every one of them.
+#define BATCH_ENTRY_COMMAND_BYTE			0
+#define BATCH_ENTRY_LENGTH_BYTE				1
+#define BATCH_ENTRY_HEADER_BYTES			2
+#define BATCH_NOT_HANDLED					CMS_NO_RESPONSE
+#define BATCH_MALFORMED						0xFE
+#define BATCH_NO_ROOM						0xFD
+
+#if (BATCH_NO_ROOM <= CMS_MAX_DATA_BYTES)
+#error "batch statuses must not be valid data lengths"
+#endif
+
+// the set baud rate request holds the SRL_BAUD_RATE wanted and the response 
+// the one which will be used, sent at the old rate. If no good packet 
+// arrives at the new rate in time the port goes back to the default.
+#define BAUD_RATE_BYTE						0
+#define BAUD_RATE_BYTES						1
+#define BAUD_RATE_CONFIRM_TIMEOUT			TIMER_COUNT_1_S
+
+// one protocol engine runs on each serial port
+typedef struct
+{
+	SRL_PORT port;
+	//
+	// packets from this port which aren't for us are sent on out of this 
+	// port, unless it is the engine's own port
+	SRL_PORT forwarding_port;
+	//
+	// the engine's address on a shared bus, or broadcast for a port which 
+	// sends and receives packets without addresses
+	unsigned char address;
+	//
+	// packets are allocated from the pool contiguously and freed in the order they
+	// arrived. The head is where the next packet goes and the tail is the start
+	// of the oldest packet, when the head reaches the end of the pool it wraps
+	// back to the start if the oldest packet has been freed from there.
+	unsigned char *received_packet_pool;
+	unsigned short received_packet_pool_bytes;
+	unsigned short received_packet_pool_head;
+	unsigned short received_packet_pool_tail;
+	unsigned short received_packet_pool_bytes_in_use;
+	unsigned char received_packets_in_pool;
+	//
+	// pool offset of each packet, including the one being populated
+	unsigned short received_packet_offsets[MAX_RX_PACKETS];
+	//
+	// the bytes of the packet being populated stay in the rx buffer until it has 
+	// been checked, so that if it turns out to be bad the search for the next 
+	// start byte can carry on from just after the bad one
+	unsigned char *received_packet_populate_ptr;
+	unsigned char recieved_packet_input_index;
+	unsigned char received_packet_rx_offset;
+	TIMER_HANDLE received_packet_timer;
+	unsigned char received_packet_populate_index;
+	unsigned char received_packet_parse_index;
+	unsigned char received_packets_to_parse;
+	//
+	// microsecond clock time each packet's start byte was received, held until
+	// the packet has space in the pool
+	unsigned long received_packet_start_time_us;
+	unsigned long received_packet_timestamps_us[MAX_RX_PACKETS];
+	//
+	// the address each packet was sent to, held in the same way
+	unsigned char received_packet_address;
+	unsigned char received_packet_addresses[MAX_RX_PACKETS];
+	//
+	// the crc is generated as each packet is populated so it only needs checking once the last byte is in
+	CRC_STATE received_packet_crc_state;
+	//
+	// a baud rate change waits for its response to be sent, then the timer runs 
+	// until a good packet arrives at the new rate
+	Boolean baud_rate_change_pending;
+	SRL_BAUD_RATE baud_rate_to_change_to;
+	TIMER_HANDLE baud_rate_timer;
+}CMS_ENGINE;
+
+// the tasks each engine signals
+typedef struct
+{
+	unsigned char populate_task;
+	unsigned char parse_task;
+	unsigned char transmitted_task;
+}CMS_ENGINE_TASKS;
+
+static const CMS_ENGINE_TASKS cms_engine_tasks[NUMBER_OF_SRL_PORTS] PROGMEM =
+{
+	{ TASK_CMS_POPULATE_RECEIVED_PACKET_0, TASK_CMS_PARSE_RECEIVED_PACKET_0, TASK_CMS_PACKET_TRANSMITTED_0 },
+	{ TASK_CMS_POPULATE_RECEIVED_PACKET_1, TASK_CMS_PARSE_RECEIVED_PACKET_1, TASK_CMS_PACKET_TRANSMITTED_1 }
+};
 
-static unsigned char cms_received_packets[MAX_RX_PACKETS][MAX_PACKET_BYTES];
-static unsigned char cms_recieved_packet_input_index;
-static unsigned char cms_received_packet_populate_index;
-static unsigned char cms_received_packet_parse_index;
+static CMS_ENGINE cms_engines[NUMBER_OF_SRL_PORTS];
+static unsigned char cms_port_0_received_packet_pool[PORT_0_RX_PACKET_POOL_BYTES];
+static unsigned char cms_port_1_received_packet_pool[PORT_1_RX_PACKET_POOL_BYTES];
 
-static unsigned char cms_received_packet_populate_task_index;
-static unsigned char cms_received_packet_parse_task_index;
+// the response or forwarded packet being sent, one at a time for every 
+// engine. It is sent straight from these buffers so they are busy until the 
+// serial port signals that it has finished with them.
+static unsigned char cms_packet_to_transmit_prefix[ADDRESS_PREFIX_BYTES];
 static unsigned char cms_packet_to_transmit[MAX_PACKET_BYTES];
+static unsigned char cms_packet_to_transmit_trailer[PACKET_TRAILER_BYTES];
+static SRL_TX_FRAGMENT cms_packet_to_transmit_fragments[NUMBER_OF_RESPONSE_FRAGMENTS];
+static Boolean cms_packet_to_transmit_busy;
+
+// the engine whose packet is being parsed, for the command handlers
+static CMS_ENGINE *cms_parsing_engine_ptr;
+
+// a request we have sent and are waiting for the response to. The slot is 
+// in use while the request is waiting or its packet is still being sent
+typedef struct
+{
+	CMS_RESPONSE_HANDLER response_handler;
+	TIMER_HANDLE timer_handle;
+	Boolean in_use;
+	Boolean waiting;
+	Boolean sending;
+	SRL_PORT port;
+	unsigned char command;
+	unsigned char sequence_number;
+	unsigned char retries_left;
+	SRL_TX_FRAGMENT packet_fragments[NUMBER_OF_REQUEST_FRAGMENTS];
+	unsigned char packet_prefix[ADDRESS_PREFIX_BYTES];
+	unsigned char packet[MAX_REQUEST_PACKET_BYTES];
+}CMS_REQUEST;
 
-static void populate_received_packet(void);
-static void parse_received_packet(void);
-static inline void process_received_command(unsigned char command);
-static inline void process_received_response(unsigned char command);
+static CMS_REQUEST cms_requests[CMS_MAX_OUTSTANDING_REQUESTS];
+static unsigned char cms_request_sequence_number;
+
+// the packet is sent straight from the slot so the slot stays in use until 
+// the serial port signals its task, after the request has finished if need be
+static const unsigned char cms_request_sent_tasks[CMS_MAX_OUTSTANDING_REQUESTS] PROGMEM =
+{
+	TASK_CMS_REQUEST_SENT_0, TASK_CMS_REQUEST_SENT_1, TASK_CMS_REQUEST_SENT_2, TASK_CMS_REQUEST_SENT_3
+};
+
+// a sub-command's handler expects room for a whole response so it writes 
+// here and the response is copied into the batch response if it fits
+static unsigned char cms_batch_sub_response[CMS_MAX_DATA_BYTES];
+
+static void populate_received_packets(CMS_ENGINE *engine_ptr);
+static void parse_received_packet(CMS_ENGINE *engine_ptr);
+static void packet_transmitted(CMS_ENGINE *engine_ptr);
+static inline Boolean has_received_packet_timed_out(const CMS_ENGINE *engine_ptr);
+static inline Boolean check_received_packet(CMS_ENGINE *engine_ptr, const unsigned char *packet_ptr);
+static void resynchronise_received_packets(CMS_ENGINE *engine_ptr);
+static unsigned char *allocate_received_packet(CMS_ENGINE *engine_ptr, unsigned short packet_bytes);
+static void release_newest_received_packet(CMS_ENGINE *engine_ptr);
+static void free_received_packet(CMS_ENGINE *engine_ptr);
+static void forward_received_packet(CMS_ENGINE *engine_ptr, const unsigned char *received_packet_ptr);
+static unsigned char set_packet_prefix(const CMS_ENGINE *engine_ptr, unsigned char address, unsigned char *prefix_ptr);
+static void finish_request(CMS_REQUEST *request_ptr, CMS_REQUEST_RESULT result, const unsigned char *response_data_ptr, unsigned char response_data_length);
+
+// jump table of command handlers, indexed by the command without the request bit and held in flash
+#define CMS_COMMAND(command, command_handler)	[command] = command_handler,
+static const CMS_COMMAND_HANDLER cms_command_handlers[CMS_MAX_COMMANDS] PROGMEM = { CMS_COMMAND_TABLE };
+#undef CMS_COMMAND
+
+// a command registered at run time, these are only searched for a command 
+// with no handler in the table above so there are few of them
+typedef struct
+{
+	CMS_COMMAND_HANDLER command_handler;
+	unsigned char command;
+}CMS_REGISTERED_COMMAND;
+
+static CMS_REGISTERED_COMMAND cms_registered_commands[CMS_MAX_REGISTERED_COMMANDS];
+static unsigned char cms_number_of_registered_commands;
+
+static inline void process_received_command(CMS_ENGINE *engine_ptr, unsigned char command, const unsigned char *received_packet_ptr);
+static inline Boolean process_received_response(CMS_ENGINE *engine_ptr, unsigned char command, const unsigned char *received_packet_ptr);
+static inline unsigned char *add_32_bit_value(unsigned char *data_ptr, unsigned long value);
+static inline CMS_COMMAND_HANDLER get_command_handler(unsigned char command);
+static inline unsigned char count_batch_entries(const unsigned char *request_data_ptr, unsigned char request_data_length);
+static inline Boolean is_allowed_in_batch(unsigned char command);
 
 // name:	CMS_Init
 // Desc:	Module initialisation function.
 void CMS_Init(void)
 {
-	memset((void*)&cms_received_packets[0][0], 0, (MAX_RX_PACKETS * MAX_PACKET_BYTES));
-	memset((void*)&cms_packet_to_transmit[0], 0, MAX_PACKET_BYTES);
+	CMS_ENGINE *engine_ptr;
+	unsigned char port;
+	
+	for(port = 0; port < NUMBER_OF_SRL_PORTS; port++)
+	{
+		engine_ptr = &cms_engines[port];
+		//
+		memset((void*)engine_ptr, 0, sizeof(CMS_ENGINE));
+		engine_ptr->port = (SRL_PORT)port;
+		engine_ptr->forwarding_port = (SRL_PORT)port;
+		engine_ptr->address = CMS_ADDRESS_BROADCAST;
+		//
+		// port 1 has the smaller pool
+		if(SRL_PORT_0 == port)
+		{
+			engine_ptr->received_packet_pool = &cms_port_0_received_packet_pool[0];
+			engine_ptr->received_packet_pool_bytes = PORT_0_RX_PACKET_POOL_BYTES;
+		}
+		else
+		{
+			engine_ptr->received_packet_pool = &cms_port_1_received_packet_pool[0];
+			engine_ptr->received_packet_pool_bytes = PORT_1_RX_PACKET_POOL_BYTES;
+		}
+		//
+		engine_ptr->received_packet_pool_head = 0;
+		engine_ptr->received_packet_pool_tail = 0;
+		engine_ptr->received_packet_pool_bytes_in_use = 0;
+		engine_ptr->received_packets_in_pool = 0;
+		//
+		engine_ptr->received_packet_populate_ptr = NULL;
+		engine_ptr->recieved_packet_input_index = 0;
+		engine_ptr->received_packet_rx_offset = 0;
+		engine_ptr->received_packet_timer = TIMER_HANDLE_NONE;
+		//
+		engine_ptr->received_packet_populate_index = 0;
+		engine_ptr->received_packet_parse_index = 0;
+		engine_ptr->received_packets_to_parse = 0;
+		//
+		engine_ptr->baud_rate_change_pending = False;
+		engine_ptr->baud_rate_timer = TIMER_HANDLE_NONE;
+		//
+		SRL_Set_task_to_signal_on_data_rx(engine_ptr->port, pgm_read_byte(&cms_engine_tasks[port].populate_task));
+		SRL_Set_byte_to_timestamp(engine_ptr->port, START_OF_PACKET);
+	}
 	//
-	cms_recieved_packet_input_index = 0;
+	cms_parsing_engine_ptr = &cms_engines[SRL_PORT_0];
+	cms_packet_to_transmit_busy = False;
 	//
-	// add the receive packet tasks to the schedular task list
-	cms_received_packet_populate_task_index = SCH_Add_task_to_list(populate_received_packet);
-	cms_received_packet_parse_task_index = SCH_Add_task_to_list(parse_received_packet);
+	memset((void*)&cms_requests[0], 0, sizeof(cms_requests));
+	cms_request_sequence_number = 0;
+	cms_number_of_registered_commands = 0;
+#if (SRL_RS485 == SRL_RS485_PORT_1)
 	//
-	cms_received_packet_populate_index = 0;
-	cms_received_packet_parse_index = 0;
+	// port 1 only takes packets for this unit from the bus and the unit 
+	// bridges it to the host, passing on what it doesn't handle itself
+	CMS_Set_address(SRL_PORT_1, CMS_BUS_ADDRESS);
+	CMS_Set_forwarding_port(SRL_PORT_0, SRL_PORT_1);
+	CMS_Set_forwarding_port(SRL_PORT_1, SRL_PORT_0);
+#endif
+}
+
+// name:	CMS_Get_request_receive_time_us
+// Desc:	returns the microsecond clock time the start byte of the request 
+//			being handled was received, for use by command handlers.
+unsigned long CMS_Get_request_receive_time_us(void)
+{
+	return cms_parsing_engine_ptr->received_packet_timestamps_us[cms_parsing_engine_ptr->received_packet_parse_index];
+}
+
+// name:	CMS_Get_request_port
+// Desc:	returns the port the request being handled arrived on, for use by 
+//			command handlers.
+SRL_PORT CMS_Get_request_port(void)
+{
+	return cms_parsing_engine_ptr->port;
+}
+
+// name:	CMS_Set_forwarding_port
+// Desc:	packets arriving on the port which aren't for us, requests for a 
+//			command with no handler and responses to requests we didn't send, 
+//			are sent on out of the forwarding port in its format. Setting a 
+//			port's own port as its forwarding port turns forwarding off.
+void CMS_Set_forwarding_port(SRL_PORT port, SRL_PORT forwarding_port)
+{
+	if((NUMBER_OF_SRL_PORTS > port) && (NUMBER_OF_SRL_PORTS > forwarding_port))
+	{
+		cms_engines[port].forwarding_port = forwarding_port;
+	}
+}
+
+// name:	CMS_Set_address
+// Desc:	puts the port on a shared bus at the address, it then only takes 
+//			packets sent to that address or the broadcast address and adds the 
+//			address to everything it sends. A broadcast request is carried out 
+//			without a response so the nodes don't all answer at once. Setting 
+//			the broadcast address puts the port back to packets without 
+//			addresses. Meant to be called before the port is in use.
+void CMS_Set_address(SRL_PORT port, unsigned char address)
+{
+	SRL_ADDRESS_FILTER address_filter;
+	
+	if(NUMBER_OF_SRL_PORTS > port)
+	{
+		cms_engines[port].address = address;
+		//
+		if(CMS_ADDRESS_BROADCAST == address)
+		{
+			SRL_Set_address_filter(port, NULL);
+			SRL_Set_byte_to_timestamp(port, START_OF_PACKET);
+		}
+		else
+		{
+			// the serial port drops packets for the other nodes as they arrive
+			address_filter.start_byte = ADDRESSED_START_OF_PACKET;
+			address_filter.address = address;
+			address_filter.broadcast_address = CMS_ADDRESS_BROADCAST;
+			address_filter.bytes_after_length = BYTES_AFTER_BYTE_COUNT;
+			//
+			SRL_Set_address_filter(port, &address_filter);
+			SRL_Set_byte_to_timestamp(port, ADDRESSED_START_OF_PACKET);
+		}
+	}
+}
+
+// name:	CMS_Register_command
+// Desc:	lets a module handle a command without adding it to the build 
+//			time table in commands.h. Returns False if the command is out of 
+//			range or already handled, or all the registered commands are in 
+//			use. Meant to be called after CMS_Init.
+Boolean CMS_Register_command(unsigned char command, CMS_COMMAND_HANDLER command_handler)
+{
+	Boolean registered = False;
+	
+	if((CMS_MAX_COMMANDS > command) && (NULL != command_handler) && (NULL == get_command_handler(command)) && 
+		(CMS_MAX_REGISTERED_COMMANDS > cms_number_of_registered_commands))
+	{
+		cms_registered_commands[cms_number_of_registered_commands].command = command;
+		cms_registered_commands[cms_number_of_registered_commands].command_handler = command_handler;
+		cms_number_of_registered_commands++;
+		//
+		registered = True;
+	}
+	
+	return registered;
+}
+
+// name:	CMS_Send_request
+// Desc:	sends a request to the host and calls the response handler when 
+//			the response comes back or the request has timed out on every 
+//			retry. Several requests can be outstanding at once, returns False 
+//			if they are all in use, the data is too long, no timer is free 
+//			or the serial port has no room to queue it.
+Boolean CMS_Send_request(SRL_PORT port, unsigned char command, const unsigned char *request_data_ptr, unsigned char request_data_length, CMS_RESPONSE_HANDLER response_handler)
+{
+	CMS_REQUEST *request_ptr = NULL;
+	CRC_STATE request_crc_state;
+	unsigned short request_crc;
+	unsigned char byte_count;
+	unsigned char prefix_bytes;
+	unsigned char request_index;
+	Boolean request_sent = False;
+	
+	if((NUMBER_OF_SRL_PORTS > port) && (CMS_MAX_COMMANDS > command) && (CMS_MAX_REQUEST_DATA_BYTES >= request_data_length) && 
+		(NULL != response_handler))
+	{
+		for(request_index = 0; (request_index < CMS_MAX_OUTSTANDING_REQUESTS) && (NULL == request_ptr); request_index++)
+		{
+			if(False == cms_requests[request_index].in_use)
+			{
+				request_ptr = &cms_requests[request_index];
+			}
+		}
+	}
 	//
-	SRL_Set_task_to_signal_on_data_rx(cms_received_packet_populate_task_index);
+	if(NULL != request_ptr)
+	{
+		byte_count = REQUEST_SEQUENCE_NUMBER_BYTES + request_data_length;
+		//
+		prefix_bytes = set_packet_prefix(&cms_engines[port], cms_engines[port].address, &request_ptr->packet_prefix[0]);
+		//
+		request_ptr->packet[BYTE_COUNT_BYTE] = byte_count;
+		request_ptr->packet[COMMAND_BYTE] = command | COMMAND_IS_REQUEST_NOT_RESPONSE;
+		request_ptr->packet[STATUS_BYTE] = 0x00;
+		request_ptr->packet[REQUEST_SEQUENCE_NUMBER_BYTE] = cms_request_sequence_number;
+		memcpy((void*)&request_ptr->packet[REQUEST_SEQUENCE_NUMBER_BYTE + REQUEST_SEQUENCE_NUMBER_BYTES], (const void*)request_data_ptr, request_data_length);
+		//
+		CRC_Init(&request_crc_state);
+		CRC_Update(&request_crc_state, &request_ptr->packet_prefix[0], prefix_bytes);
+		CRC_Update(&request_crc_state, &request_ptr->packet[BYTE_COUNT_BYTE], (DEFAULT_BYTES_INCLUDED_IN_CRC - BYTE_COUNT_BYTE) + byte_count);
+		request_crc = CRC_Final(&request_crc_state);
+		//
+		request_ptr->packet[CRC_LSB_BYTE(byte_count)] = GET_16_BIT_LSB(request_crc);
+		request_ptr->packet[CRC_MSB_BYTE(byte_count)] = GET_16_BIT_MSB(request_crc);
+		request_ptr->packet[END_OF_PACKET_BYTE(byte_count)] = END_OF_PACKET;
+		//
+		request_ptr->packet_fragments[REQUEST_FRAGMENT_PREFIX].data_ptr = &request_ptr->packet_prefix[0];
+		request_ptr->packet_fragments[REQUEST_FRAGMENT_PREFIX].data_length = prefix_bytes;
+		request_ptr->packet_fragments[REQUEST_FRAGMENT_PACKET].data_ptr = &request_ptr->packet[BYTE_COUNT_BYTE];
+		request_ptr->packet_fragments[REQUEST_FRAGMENT_PACKET].data_length = PACKET_BYTES_FROM_BYTE_COUNT(byte_count);
+		//
+		// without a timer nothing would ever end the request so it isn't sent
+		request_ptr->timer_handle = TMR_Set_timer_to_signal_task(TASK_CMS_REQUEST_TIMEOUT, REQUEST_TIMEOUT, TIMER_COUNT_NONE);
+		//
+		if(TIMER_HANDLE_NONE != request_ptr->timer_handle)
+		{
+			if(True == SRL_Queue_data_to_transmit(port, &request_ptr->packet_fragments[0], NUMBER_OF_REQUEST_FRAGMENTS, 
+													pgm_read_byte(&cms_request_sent_tasks[request_ptr - &cms_requests[0]])))
+			{
+				request_ptr->response_handler = response_handler;
+				request_ptr->port = port;
+				request_ptr->command = command;
+				request_ptr->sequence_number = cms_request_sequence_number++;
+				request_ptr->retries_left = REQUEST_RETRIES;
+				request_ptr->in_use = True;
+				request_ptr->waiting = True;
+				request_ptr->sending = True;
+				request_sent = True;
+			}
+			else
+			{
+				TMR_Cancel_timer(request_ptr->timer_handle);
+				request_ptr->timer_handle = TIMER_HANDLE_NONE;
+			}
+		}
+	}
+	
+	return request_sent;
 }
 
-// name:	populate_received_packet
-// Desc:	populates the receive packet with bytes from the serial port.
-static void populate_received_packet(void)
+// name:	CMS_Request_timeout_task
+// Desc:	signalled when a request's timer runs out. Every request whose 
+//			timer has stopped is sent again, or once it has no retries left 
+//			its response handler is told it timed out.
+void CMS_Request_timeout_task(void)
 {
-	unsigned char rx_byte;
+	CMS_REQUEST *request_ptr;
+	unsigned char request_index;
 	
-	// check if there are bytes in the serial rx buffer first 
-	if(0 != SRL_Get_number_of_bytes_in_rx_buffer())	
+	for(request_index = 0; request_index < CMS_MAX_OUTSTANDING_REQUESTS; request_index++)
 	{
-		// get the next rx byte 
-		rx_byte = SRL_Get_data_byte_from_receive_buffer();
+		request_ptr = &cms_requests[request_index];
 		//
-		// populate the byte into the correct position of the packet based on the cms_received_packet_input_index
-		switch(cms_recieved_packet_input_index)
+		if((True == request_ptr->waiting) && (False == TMR_Is_timer_active(request_ptr->timer_handle)))
 		{
-			case START_OF_PACKET_BYTE:
+			if(0 == request_ptr->retries_left)
+			{
+				STS_INCREMENT_COUNTER(STS_COUNTER_REQUEST_TIMEOUTS);
+				finish_request(request_ptr, CMS_REQUEST_TIMED_OUT, NULL, 0);
+			}
+			else
+			{
+				// the packet is unchanged so it can be queued again as it is, if 
+				// there's no room this attempt is lost and the timer still runs. 
+				// The last attempt still being queued counts as this one, as 
+				// there's no telling its sent signal from a new one's. If 
+				// there's no timer for it the request ends here.
+				request_ptr->timer_handle = TMR_Set_timer_to_signal_task(TASK_CMS_REQUEST_TIMEOUT, REQUEST_TIMEOUT, TIMER_COUNT_NONE);
 				//
-				// we are looking for a start of packet so only add the byte to the packet and 
-				// move on if this byte is a start of packet byte
-				if(rx_byte == START_OF_PACKET)
+				if(TIMER_HANDLE_NONE == request_ptr->timer_handle)
 				{
-					cms_received_packets[cms_received_packet_populate_index][START_OF_PACKET_BYTE] = rx_byte;
-					//
-					cms_recieved_packet_input_index = BYTE_COUNT_BYTE;
+					STS_INCREMENT_COUNTER(STS_COUNTER_REQUEST_TIMEOUTS);
+					finish_request(request_ptr, CMS_REQUEST_TIMED_OUT, NULL, 0);
 				}
-				//
-				break;
-			case BYTE_COUNT_BYTE:
-				//
-				cms_received_packets[cms_received_packet_populate_index][BYTE_COUNT_BYTE] = rx_byte;
-				//
-				cms_recieved_packet_input_index = COMMAND_BYTE;
-				//
-				break;
-			default:
-				//
-				// now that the byte count has been received we know how long the packet needs to be so all bytes can come in here
-				//
-				// add this byte to the packet
-				cms_received_packets[cms_received_packet_populate_index][cms_recieved_packet_input_index] = rx_byte;
-				//
-				// check if this is the last byte we need
-				if(cms_recieved_packet_input_index == END_OF_PACKET_BYTE(cms_received_packets[cms_received_packet_populate_index][BYTE_COUNT_BYTE]))
+				else
 				{
-					// full packet received so reset input index
-					cms_recieved_packet_input_index = 0;
+					STS_INCREMENT_COUNTER(STS_COUNTER_REQUEST_RETRIES);
+					request_ptr->retries_left--;
 					//
-					// trigger the task to parse the packet
-					SCH_Signal_task(cms_received_packet_parse_task_index, SELF_TRIGGERED);
-					//
-					// increment the index to populate the next packet 
-					if(MAX_RX_PACKETS == ++cms_received_packet_populate_index)
+					if(False == request_ptr->sending)
 					{
-						cms_received_packet_populate_index = 0;
+						request_ptr->sending = SRL_Queue_data_to_transmit(request_ptr->port, &request_ptr->packet_fragments[0], NUMBER_OF_REQUEST_FRAGMENTS, 
+																			pgm_read_byte(&cms_request_sent_tasks[request_index]));
 					}
 				}
-				else
-				{
-					// packet not yet full so increment input index
-					cms_recieved_packet_input_index++;
-				}
-				break;
+			}
+		}
+	}
+}
+
+// name:	CMS_Request_sent_task
+// Desc:	signalled by the serial port once a request's packet has been sent, 
+//			each request has its own task. The slot is freed if the request 
+//			has already finished.
+void CMS_Request_sent_task(void)
+{
+	CMS_REQUEST *request_ptr;
+	unsigned char request_index;
+	
+	for(request_index = 0; request_index < CMS_MAX_OUTSTANDING_REQUESTS; request_index++)
+	{
+		if(SCH_Get_running_task() == pgm_read_byte(&cms_request_sent_tasks[request_index]))
+		{
+			request_ptr = &cms_requests[request_index];
+			request_ptr->sending = False;
+			//
+			if(False == request_ptr->waiting)
+			{
+				request_ptr->in_use = False;
+			}
 		}
+	}
+}
+
+// name:	CMS_Populate_received_packet_0_task
+// Desc:	populates the packets received on port 0.
+void CMS_Populate_received_packet_0_task(void)
+{
+	populate_received_packets(&cms_engines[SRL_PORT_0]);
+}
+
+// name:	CMS_Populate_received_packet_1_task
+// Desc:	populates the packets received on port 1.
+void CMS_Populate_received_packet_1_task(void)
+{
+	populate_received_packets(&cms_engines[SRL_PORT_1]);
+}
+
+// name:	CMS_Parse_received_packet_0_task
+// Desc:	parses the packets received on port 0.
+void CMS_Parse_received_packet_0_task(void)
+{
+	parse_received_packet(&cms_engines[SRL_PORT_0]);
+}
+
+// name:	CMS_Parse_received_packet_1_task
+// Desc:	parses the packets received on port 1.
+void CMS_Parse_received_packet_1_task(void)
+{
+	parse_received_packet(&cms_engines[SRL_PORT_1]);
+}
+
+// name:	CMS_Packet_transmitted_0_task
+// Desc:	signalled by the serial port once port 0's packet has been sent.
+void CMS_Packet_transmitted_0_task(void)
+{
+	packet_transmitted(&cms_engines[SRL_PORT_0]);
+}
+
+// name:	CMS_Packet_transmitted_1_task
+// Desc:	signalled by the serial port once port 1's packet has been sent.
+void CMS_Packet_transmitted_1_task(void)
+{
+	packet_transmitted(&cms_engines[SRL_PORT_1]);
+}
+
+// name:	CMS_Baud_rate_timeout_task
+// Desc:	signalled if no good packet has arrived on a port since its baud 
+//			rate was changed, the host can't talk at the new rate so that port 
+//			goes back to the default one.
+void CMS_Baud_rate_timeout_task(void)
+{
+	CMS_ENGINE *engine_ptr;
+	unsigned char port;
+	
+	for(port = 0; port < NUMBER_OF_SRL_PORTS; port++)
+	{
+		engine_ptr = &cms_engines[port];
 		//
-		// re-signal the task if there are more bytes in the serial rx buffer
-		if(0 != SRL_Get_number_of_bytes_in_rx_buffer())
+		if((TIMER_HANDLE_NONE != engine_ptr->baud_rate_timer) && (False == TMR_Is_timer_active(engine_ptr->baud_rate_timer)))
 		{
-			SCH_Signal_task(cms_received_packet_populate_task_index, DATA_TRIGGERED);
+			engine_ptr->baud_rate_timer = TIMER_HANDLE_NONE;
+			SRL_Set_baud_rate(engine_ptr->port, SRL_DEFAULT_BAUD_RATE);
+		}
+	}
+}
+
+// name:	populate_received_packets
+// Desc:	populates the engine's receive packets with everything in its 
+//			port's rx buffer, once a packet's byte count is known the rest of 
+//			it is copied across in one go. Each packet is checked as soon as it 
+//			is complete, and a bad, over long or timed out packet only loses 
+//			its start byte as the search for the next one starts again after it.
+static void populate_received_packets(CMS_ENGINE *engine_ptr)
+{
+	const unsigned char *span_ptr;
+	const unsigned char *start_of_packet_ptr;
+	unsigned char *packet_ptr;
+	unsigned char span_length;
+	unsigned char byte_count;
+	unsigned short bytes_to_copy;
+	unsigned short bytes_to_checksum;
+	unsigned char start_of_packet;
+	Boolean populating = True;
+	
+	start_of_packet = (CMS_ADDRESS_BROADCAST == engine_ptr->address) ? START_OF_PACKET : ADDRESSED_START_OF_PACKET;
+	
+	// keep going until there is nothing left in the rx buffer past the packet 
+	// being populated, bytes which arrive after that signal the task again
+	while(True == populating)
+	{
+		span_length = SRL_Peek_receive_span(engine_ptr->port, engine_ptr->received_packet_rx_offset, &span_ptr);
+		packet_ptr = engine_ptr->received_packet_populate_ptr;
+		//
+		if(0 == span_length)
+		{
+			if(True == has_received_packet_timed_out(engine_ptr))
+			{
+				STS_INCREMENT_COUNTER(STS_COUNTER_RX_PACKET_TIMEOUTS);
+				resynchronise_received_packets(engine_ptr);
+			}
+			else
+			{
+				populating = False;
+			}
+		}
+		else
+		{
+			// populate the bytes into the correct position of the packet based on the cms_received_packet_input_index
+			switch(engine_ptr->recieved_packet_input_index)
+			{
+				case START_OF_PACKET_BYTE:
+					//
+					// hunting for a start of packet so release everything up to the next start of packet byte
+					start_of_packet_ptr = memchr(span_ptr, start_of_packet, span_length);
+					//
+					if(NULL == start_of_packet_ptr)
+					{
+						SRL_Commit_received_bytes(engine_ptr->port, span_length);
+					}
+					else
+					{
+						SRL_Commit_received_bytes(engine_ptr->port, start_of_packet_ptr - span_ptr);
+						//
+						CRC_Init(&engine_ptr->received_packet_crc_state);
+						CRC_Update_byte(&engine_ptr->received_packet_crc_state, start_of_packet);
+						//
+						// use the time the byte arrived, or failing that the time now
+						if(False == SRL_Get_receive_timestamp(engine_ptr->port, 0, &engine_ptr->received_packet_start_time_us))
+						{
+							engine_ptr->received_packet_start_time_us = CLK_Get_time_us();
+						}
+						//
+						engine_ptr->received_packet_timer = TMR_Set_timer_to_signal_task(pgm_read_byte(&cms_engine_tasks[engine_ptr->port].populate_task), RECEIVED_PACKET_TIMEOUT, TIMER_COUNT_NONE);
+						//
+						if(TIMER_HANDLE_NONE == engine_ptr->received_packet_timer)
+						{
+							STS_INCREMENT_COUNTER(STS_COUNTER_RX_PACKET_NO_TIMER);
+						}
+						//
+						engine_ptr->received_packet_rx_offset = 1;
+						engine_ptr->received_packet_address = engine_ptr->address;
+						engine_ptr->recieved_packet_input_index = (START_OF_PACKET == start_of_packet) ? BYTE_COUNT_BYTE : ADDRESS_INPUT_INDEX;
+					}
+					//
+					break;
+				case ADDRESS_INPUT_INDEX:
+					//
+					// the serial port has already dropped packets for other nodes
+					engine_ptr->received_packet_address = span_ptr[0];
+					engine_ptr->received_packet_rx_offset++;
+					//
+					CRC_Update_byte(&engine_ptr->received_packet_crc_state, engine_ptr->received_packet_address);
+					engine_ptr->recieved_packet_input_index = BYTE_COUNT_BYTE;
+					break;
+				case BYTE_COUNT_BYTE:
+					//
+					byte_count = span_ptr[0];
+					engine_ptr->received_packet_rx_offset++;
+					//
+					// a byte count which is too big is taken as noise rather than waiting 
+					// for a packet that long, otherwise take exactly that much of the pool
+					if(byte_count > MAX_RECEIVED_DATA_BYTES)
+					{
+						STS_INCREMENT_COUNTER(STS_COUNTER_LENGTH_ERRORS);
+						resynchronise_received_packets(engine_ptr);
+					}
+					else
+					{
+						packet_ptr = allocate_received_packet(engine_ptr, DEFAULT_PACKET_SIZE + byte_count);
+						//
+						if(NULL == packet_ptr)
+						{
+							STS_INCREMENT_COUNTER(STS_COUNTER_RX_PACKET_POOL_EXHAUSTED);
+							resynchronise_received_packets(engine_ptr);
+						}
+						else
+						{
+							packet_ptr[START_OF_PACKET_BYTE] = START_OF_PACKET;
+							packet_ptr[BYTE_COUNT_BYTE] = byte_count;
+							//
+							CRC_Update_byte(&engine_ptr->received_packet_crc_state, byte_count);
+							//
+							engine_ptr->received_packet_timestamps_us[engine_ptr->received_packet_populate_index] = engine_ptr->received_packet_start_time_us;
+							engine_ptr->received_packet_addresses[engine_ptr->received_packet_populate_index] = engine_ptr->received_packet_address;
+							engine_ptr->received_packet_populate_ptr = packet_ptr;
+							engine_ptr->recieved_packet_input_index = COMMAND_BYTE;
+						}
+					}
+					//
+					break;
+				default:
+					//
+					// now that the byte count has been received we know how long the packet needs 
+					// to be so copy as much of the rest of it as is in this span
+					bytes_to_copy = (END_OF_PACKET_BYTE(packet_ptr[BYTE_COUNT_BYTE]) + 1) - engine_ptr->recieved_packet_input_index;
+					//
+					if(bytes_to_copy > span_length)
+					{
+						bytes_to_copy = span_length;
+					}
+					//
+					memcpy((void*)&packet_ptr[engine_ptr->recieved_packet_input_index], (const void*)span_ptr, bytes_to_copy);
+					//
+					// add the copied bytes which come before the crc to the crc
+					if(engine_ptr->recieved_packet_input_index < CRC_LSB_BYTE(packet_ptr[BYTE_COUNT_BYTE]))
+					{
+						bytes_to_checksum = CRC_LSB_BYTE(packet_ptr[BYTE_COUNT_BYTE]) - engine_ptr->recieved_packet_input_index;
+						//
+						if(bytes_to_checksum > bytes_to_copy)
+						{
+							bytes_to_checksum = bytes_to_copy;
+						}
+						//
+						CRC_Update(&engine_ptr->received_packet_crc_state, &packet_ptr[engine_ptr->recieved_packet_input_index], bytes_to_checksum);
+					}
+					//
+					engine_ptr->received_packet_rx_offset += bytes_to_copy;
+					engine_ptr->recieved_packet_input_index += bytes_to_copy;
+					//
+					// check if that was the last byte we need
+					if(engine_ptr->recieved_packet_input_index > END_OF_PACKET_BYTE(packet_ptr[BYTE_COUNT_BYTE]))
+					{
+						if(True == check_received_packet(engine_ptr, packet_ptr))
+						{
+							// the packet is good so its bytes can leave the rx buffer and 
+							// the next start byte to arrive can be timestamped
+							SRL_Commit_received_bytes(engine_ptr->port, engine_ptr->received_packet_rx_offset);
+							SRL_Arm_receive_timestamp(engine_ptr->port);
+							TMR_Cancel_timer(engine_ptr->received_packet_timer);
+							//
+							engine_ptr->received_packet_timer = TIMER_HANDLE_NONE;
+							engine_ptr->received_packet_rx_offset = 0;
+							engine_ptr->recieved_packet_input_index = 0;
+							engine_ptr->received_packet_populate_ptr = NULL;
+							//
+							// a good packet at a new baud rate confirms the host has changed too
+							if(TIMER_HANDLE_NONE != engine_ptr->baud_rate_timer)
+							{
+								TMR_Cancel_timer(engine_ptr->baud_rate_timer);
+								engine_ptr->baud_rate_timer = TIMER_HANDLE_NONE;
+							}
+							//
+							// trigger the task to parse the packet, signals coalesce so the 
+							// parse task uses the count to know how many packets are waiting
+							engine_ptr->received_packets_to_parse++;
+							STS_UPDATE_HIGH_WATER(STS_HIGH_WATER_RX_PACKETS, engine_ptr->received_packets_to_parse);
+							SCH_Signal_task(pgm_read_byte(&cms_engine_tasks[engine_ptr->port].parse_task), SELF_TRIGGERED);
+							//
+							// increment the index to populate the next packet 
+							if(MAX_RX_PACKETS == ++engine_ptr->received_packet_populate_index)
+							{
+								engine_ptr->received_packet_populate_index = 0;
+							}
+						}
+						else
+						{
+							resynchronise_received_packets(engine_ptr);
+						}
+					}
+					break;
+			}
 		}
 	}
 }
 
 // name:	parse_received_packet
-// Desc:	parses a received packet.
-static void parse_received_packet(void)
+// Desc:	parses a received packet, it was checked as it was populated.
+//			While the last response or forwarded packet of any engine is still 
+//			being sent the packet is left for the transmitted task to signal 
+//			this task again.
+static void parse_received_packet(CMS_ENGINE *engine_ptr)
+{
+	CMS_ENGINE *forwarding_engine_ptr = &cms_engines[engine_ptr->forwarding_port];
+	unsigned char *packet_ptr;
+	
+	if(False == cms_packet_to_transmit_busy)
+	{
+		packet_ptr = &engine_ptr->received_packet_pool[engine_ptr->received_packet_offsets[engine_ptr->received_packet_parse_index]];
+		cms_parsing_engine_ptr = engine_ptr;
+		//
+		// check if this is a request or a response to one of our requests, when 
+		// forwarding is on a request we have no handler for and a response we 
+		// aren't waiting for are passed on out of the forwarding port
+		if((packet_ptr[COMMAND_BYTE] & COMMAND_IS_REQUEST_NOT_RESPONSE) == COMMAND_IS_REQUEST_NOT_RESPONSE)
+		{
+			if((engine_ptr != forwarding_engine_ptr) && (NULL == get_command_handler(packet_ptr[COMMAND_BYTE] & ~COMMAND_IS_REQUEST_NOT_RESPONSE)))
+			{
+				forward_received_packet(engine_ptr, packet_ptr);
+			}
+			else
+			{
+				process_received_command(engine_ptr, packet_ptr[COMMAND_BYTE], packet_ptr);
+			}
+		}
+		else if(False == process_received_response(engine_ptr, packet_ptr[COMMAND_BYTE], packet_ptr))
+		{
+			if(engine_ptr != forwarding_engine_ptr)
+			{
+				forward_received_packet(engine_ptr, packet_ptr);
+			}
+			else
+			{
+				STS_INCREMENT_COUNTER(STS_COUNTER_UNMATCHED_RESPONSES);
+			}
+		}
+		//
+		// the packet has been dealt with so give its space back to the pool
+		free_received_packet(engine_ptr);
+		//
+		// increment index to parse the next packet when this task is signalled again
+		if(MAX_RX_PACKETS == ++engine_ptr->received_packet_parse_index)
+		{
+			engine_ptr->received_packet_parse_index = 0;
+		}
+		//
+		// re-signal the task if there are more packets waiting to be parsed
+		if(0 != --engine_ptr->received_packets_to_parse)
+		{
+			SCH_Signal_task(pgm_read_byte(&cms_engine_tasks[engine_ptr->port].parse_task), SELF_TRIGGERED);
+		}
+	}
+}
+
+// name:	change_baud_rate
+// Desc:	makes the engine's pending baud rate change, the serial port waits 
+//			for its last byte to go. The port goes back to the default rate 
+//			unless a good packet arrives at the new one before the timeout.
+static void change_baud_rate(CMS_ENGINE *engine_ptr)
+{
+	engine_ptr->baud_rate_change_pending = False;
+	SRL_Set_baud_rate(engine_ptr->port, engine_ptr->baud_rate_to_change_to);
+	//
+	TMR_Cancel_timer(engine_ptr->baud_rate_timer);
+	engine_ptr->baud_rate_timer = TMR_Set_timer_to_signal_task(TASK_CMS_BAUD_RATE_TIMEOUT, BAUD_RATE_CONFIRM_TIMEOUT, TIMER_COUNT_NONE);
+}
+
+// name:	packet_transmitted
+// Desc:	called once the engine's packet has been sent, the shared buffer 
+//			is free again so parsing can carry on on any port waiting for it.
+static void packet_transmitted(CMS_ENGINE *engine_ptr)
+{
+	unsigned char port;
+	
+	cms_packet_to_transmit_busy = False;
+	//
+	// the set baud rate response has been sent at the old rate so change now
+	if(True == engine_ptr->baud_rate_change_pending)
+	{
+		change_baud_rate(engine_ptr);
+	}
+	//
+	// any port may have been waiting for the buffer
+	for(port = 0; port < NUMBER_OF_SRL_PORTS; port++)
+	{
+		if(0 != cms_engines[port].received_packets_to_parse)
+		{
+			SCH_Signal_task(pgm_read_byte(&cms_engine_tasks[port].parse_task), SELF_TRIGGERED);
+		}
+	}
+}
+
+// name:	has_received_packet_timed_out
+// Desc:	returns True if the packet being populated has run out of time. 
+//			Its timer only stops running without being cancelled if it timed 
+//			out, without a timer the time since its start byte is used.
+static inline Boolean has_received_packet_timed_out(const CMS_ENGINE *engine_ptr)
+{
+	Boolean timed_out = False;
+	
+	if(START_OF_PACKET_BYTE != engine_ptr->recieved_packet_input_index)
+	{
+		if(TIMER_HANDLE_NONE != engine_ptr->received_packet_timer)
+		{
+			timed_out = (False == TMR_Is_timer_active(engine_ptr->received_packet_timer)) ? True : False;
+		}
+		else
+		{
+			timed_out = ((CLK_Get_time_us() - engine_ptr->received_packet_start_time_us) > RECEIVED_PACKET_TIMEOUT_US) ? True : False;
+		}
+	}
+	
+	return timed_out;
+}
+
+// name:	check_received_packet
+// Desc:	checks the end of packet byte and crc of a fully populated packet.
+static inline Boolean check_received_packet(CMS_ENGINE *engine_ptr, const unsigned char *packet_ptr)
 {
+	Boolean packet_good = False;
 	unsigned char byte_count;
 	unsigned short packet_crc;
-	unsigned short calculated_crc;
 	
 	// get the byte count from the received packet so we know where the end of packet and crc bytes will be.
-	byte_count = cms_received_packets[cms_received_packet_parse_index][BYTE_COUNT_BYTE];
+	byte_count = packet_ptr[BYTE_COUNT_BYTE];
 	//
 	// check for end of packet 
-	if(cms_received_packets[cms_received_packet_parse_index][END_OF_PACKET_BYTE(byte_count)] == END_OF_PACKET)
+	if(packet_ptr[END_OF_PACKET_BYTE(byte_count)] == END_OF_PACKET)
 	{
-		// pull crc from the packet
-		packet_crc = MAKE_16_BITS(cms_received_packets[cms_received_packet_parse_index][CRC_MSB_BYTE(byte_count)],
-									cms_received_packets[cms_received_packet_parse_index][CRC_LSB_BYTE(byte_count)]);
-		//
-		// calculate the crc on the packet
-		calculated_crc = CRC_Calculate_crc(&cms_received_packets[cms_received_packet_parse_index][START_OF_PACKET_BYTE], (DEFAULT_BYTES_INCLUDED_IN_CRC + byte_count));
+		// pull crc from the packet and confirm crc's match 
+		packet_crc = MAKE_16_BITS(packet_ptr[CRC_MSB_BYTE(byte_count)], packet_ptr[CRC_LSB_BYTE(byte_count)]);
 		//
-		// confirm crc's match 
-		if(packet_crc == calculated_crc)
+		if(packet_crc == CRC_Final(&engine_ptr->received_packet_crc_state))
+		{
+			packet_good = True;
+		}
+		else
+		{
+			STS_INCREMENT_COUNTER(STS_COUNTER_CRC_FAILURES);
+		}
+	}
+	else
+	{
+		STS_INCREMENT_COUNTER(STS_COUNTER_FRAMING_ERRORS);
+	}
+	
+	return packet_good;
+}
+
+// name:	resynchronise_received_packets
+// Desc:	gives up on the packet being populated. Only its start byte is 
+//			released from the rx buffer so the hunt for the next start byte 
+//			begins with the bytes that followed it.
+static void resynchronise_received_packets(CMS_ENGINE *engine_ptr)
+{
+	if(NULL != engine_ptr->received_packet_populate_ptr)
+	{
+		release_newest_received_packet(engine_ptr);
+		engine_ptr->received_packet_populate_ptr = NULL;
+	}
+	//
+	// the timer may have already expired, in which case the handle is stale and ignored
+	TMR_Cancel_timer(engine_ptr->received_packet_timer);
+	engine_ptr->received_packet_timer = TIMER_HANDLE_NONE;
+	//
+	SRL_Commit_received_bytes(engine_ptr->port, 1);
+	SRL_Arm_receive_timestamp(engine_ptr->port);
+	//
+	engine_ptr->received_packet_rx_offset = 0;
+	engine_ptr->recieved_packet_input_index = START_OF_PACKET_BYTE;
+}
+
+// name:	allocate_received_packet
+// Desc:	takes space for the next packet from the pool, returns NULL if 
+//			there isn't a contiguous block that big or no packet slot free.
+static unsigned char *allocate_received_packet(CMS_ENGINE *engine_ptr, unsigned short packet_bytes)
+{
+	unsigned char *packet_ptr = NULL;
+	unsigned short packet_offset = engine_ptr->received_packet_pool_bytes;
+	
+	if((MAX_RX_PACKETS > engine_ptr->received_packets_in_pool) && (MAX_PACKET_BYTES >= packet_bytes))
+	{
+		if(0 == engine_ptr->received_packets_in_pool)
 		{
-			// check if this is a request or a response to one of our requests
-			if((cms_received_packets[cms_received_packet_parse_index][COMMAND_BYTE] & COMMAND_IS_REQUEST_NOT_RESPONSE) == COMMAND_IS_REQUEST_NOT_RESPONSE)
+			// the pool is empty so start again from the beginning
+			engine_ptr->received_packet_pool_head = 0;
+			engine_ptr->received_packet_pool_tail = 0;
+			packet_offset = 0;
+		}
+		else if(engine_ptr->received_packet_pool_head > engine_ptr->received_packet_pool_tail)
+		{
+			// packets sit between the tail and head, use the end of the pool 
+			// or wrap round to the space in front of the oldest packet
+			if((engine_ptr->received_packet_pool_bytes - engine_ptr->received_packet_pool_head) >= packet_bytes)
 			{
-				process_received_command(cms_received_packets[cms_received_packet_parse_index][COMMAND_BYTE]);
+				packet_offset = engine_ptr->received_packet_pool_head;
 			}
-			else
+			else if(engine_ptr->received_packet_pool_tail >= packet_bytes)
+			{
+				packet_offset = 0;
+			}
+		}
+		else
+		{
+			// already wrapped so only the gap up to the oldest packet is free
+			if((engine_ptr->received_packet_pool_tail - engine_ptr->received_packet_pool_head) >= packet_bytes)
 			{
-				process_received_response(cms_received_packets[cms_received_packet_parse_index][COMMAND_BYTE]);				
+				packet_offset = engine_ptr->received_packet_pool_head;
 			}
 		}
+		//
+		if(engine_ptr->received_packet_pool_bytes != packet_offset)
+		{
+			engine_ptr->received_packet_offsets[engine_ptr->received_packet_populate_index] = packet_offset;
+			engine_ptr->received_packet_pool_head = packet_offset + packet_bytes;
+			engine_ptr->received_packet_pool_bytes_in_use += packet_bytes;
+			engine_ptr->received_packets_in_pool++;
+			//
+			STS_UPDATE_HIGH_WATER(STS_HIGH_WATER_RX_PACKET_POOL_BYTES, engine_ptr->received_packet_pool_bytes_in_use);
+			//
+			packet_ptr = &engine_ptr->received_packet_pool[packet_offset];
+		}
+	}
+	
+	return packet_ptr;
+}
+
+// name:	release_newest_received_packet
+// Desc:	gives back the space of the packet being populated, which is always 
+//			the newest in the pool.
+static void release_newest_received_packet(CMS_ENGINE *engine_ptr)
+{
+	engine_ptr->received_packet_pool_bytes_in_use -= DEFAULT_PACKET_SIZE + engine_ptr->received_packet_pool[engine_ptr->received_packet_offsets[engine_ptr->received_packet_populate_index] + BYTE_COUNT_BYTE];
+	//
+	if(0 == --engine_ptr->received_packets_in_pool)
+	{
+		engine_ptr->received_packet_pool_head = 0;
+		engine_ptr->received_packet_pool_tail = 0;
+	}
+	else
+	{
+		engine_ptr->received_packet_pool_head = engine_ptr->received_packet_offsets[engine_ptr->received_packet_populate_index];
 	}
+}
+
+// name:	free_received_packet
+// Desc:	gives the oldest packet's space back to the pool, packets are 
+//			always freed in the order they were allocated.
+static void free_received_packet(CMS_ENGINE *engine_ptr)
+{
+	unsigned char next_packet_index;
+	
+	engine_ptr->received_packet_pool_bytes_in_use -= DEFAULT_PACKET_SIZE + engine_ptr->received_packet_pool[engine_ptr->received_packet_offsets[engine_ptr->received_packet_parse_index] + BYTE_COUNT_BYTE];
 	//
-	// increment index to parse the next packet when this task is signalled again
-	if(MAX_RX_PACKETS == ++cms_received_packet_parse_index)
+	if(0 == --engine_ptr->received_packets_in_pool)
+	{
+		engine_ptr->received_packet_pool_head = 0;
+		engine_ptr->received_packet_pool_tail = 0;
+	}
+	else
 	{
-		cms_received_packet_parse_index = 0;
+		// the tail moves on to the next oldest packet, which may have wrapped to the start
+		next_packet_index = engine_ptr->received_packet_parse_index + 1;
+		//
+		if(MAX_RX_PACKETS == next_packet_index)
+		{
+			next_packet_index = 0;
+		}
+		//
+		engine_ptr->received_packet_pool_tail = engine_ptr->received_packet_offsets[next_packet_index];
 	}
 }
 
 // name:	process_received_command
-// Desc:	performs the specified action for the passed command.
-static inline void process_received_command(unsigned char command)
+// Desc:	calls the command's handler and sends the response it fills in.
+static inline void process_received_command(CMS_ENGINE *engine_ptr, unsigned char command, const unsigned char *received_packet_ptr)
 {	
+	CMS_COMMAND_HANDLER command_handler;
+	CRC_STATE response_crc_state;
 	unsigned short response_crc;
-	Boolean valid_command;
+	unsigned char response_data_bytes = CMS_NO_RESPONSE;
+	unsigned char prefix_bytes;
+	Boolean broadcast;
 	
-	// assume a valid command
-	valid_command = True;
-	//
 	// remove request/response bit as this will be a response
 	command &= ~COMMAND_IS_REQUEST_NOT_RESPONSE;
 	//
-	// perform action associated with the received command
-	switch(command)
+	// the handler writes its data straight into the response buffer
+	command_handler = get_command_handler(command);
+	//
+	if(NULL != command_handler)
 	{
-		case COMMAND_GET_STATUS:
-			//
-			// populate the response
-			cms_packet_to_transmit[BYTE_COUNT_BYTE] = NO_ADDITIONAL_BYTES;
-			break;
-		default:
-			//
-			// command is not recognised so set valid_command to false
-			valid_command = False;
-			break;
+		response_data_bytes = command_handler(&received_packet_ptr[START_OF_ADDITIONAL_DATA], received_packet_ptr[BYTE_COUNT_BYTE], 
+												&cms_packet_to_transmit[START_OF_ADDITIONAL_DATA]);
+	}
+	//
+	// every node on a shared bus carries out a broadcast request so none of them answer it
+	broadcast = ((CMS_ADDRESS_BROADCAST != engine_ptr->address) && 
+					(CMS_ADDRESS_BROADCAST == engine_ptr->received_packet_addresses[engine_ptr->received_packet_parse_index]));
+	//
+	if(True == broadcast)
+	{
+		response_data_bytes = CMS_NO_RESPONSE;
 	}
 	//
-	// only send repsonse if command is valid
-	if(valid_command == True)
+	// only send a response if the command is recognised and wants one
+	if(CMS_NO_RESPONSE != response_data_bytes)
 	{
 		// populate beginning bytes
-		cms_packet_to_transmit[START_OF_PACKET_BYTE] = START_OF_PACKET;
+		prefix_bytes = set_packet_prefix(engine_ptr, engine_ptr->address, &cms_packet_to_transmit_prefix[0]);
+		cms_packet_to_transmit[BYTE_COUNT_BYTE] = response_data_bytes;
 		cms_packet_to_transmit[COMMAND_BYTE] = command;
 		cms_packet_to_transmit[STATUS_BYTE] = 0x01;
 		//
-		response_crc = CRC_Calculate_crc(&cms_packet_to_transmit[START_OF_PACKET_BYTE], (DEFAULT_BYTES_INCLUDED_IN_CRC + cms_packet_to_transmit[BYTE_COUNT_BYTE]));
+		// checksum the beginning bytes then the data the command added
+		CRC_Init(&response_crc_state);
+		CRC_Update(&response_crc_state, &cms_packet_to_transmit_prefix[0], prefix_bytes);
+		CRC_Update(&response_crc_state, &cms_packet_to_transmit[BYTE_COUNT_BYTE], HEADER_BYTES_AFTER_PREFIX);
+		CRC_Update(&response_crc_state, &cms_packet_to_transmit[START_OF_ADDITIONAL_DATA], response_data_bytes);
+		response_crc = CRC_Final(&response_crc_state);
 		//
-		cms_packet_to_transmit[CRC_LSB_BYTE(cms_packet_to_transmit[BYTE_COUNT_BYTE])] = GET_16_BIT_LSB(response_crc);
-		cms_packet_to_transmit[CRC_MSB_BYTE(cms_packet_to_transmit[BYTE_COUNT_BYTE])] = GET_16_BIT_MSB(response_crc);
+		cms_packet_to_transmit_trailer[TRAILER_CRC_LSB_BYTE] = GET_16_BIT_LSB(response_crc);
+		cms_packet_to_transmit_trailer[TRAILER_CRC_MSB_BYTE] = GET_16_BIT_MSB(response_crc);
+		cms_packet_to_transmit_trailer[TRAILER_END_OF_PACKET_BYTE] = END_OF_PACKET;
 		//
-		cms_packet_to_transmit[END_OF_PACKET_BYTE(cms_packet_to_transmit[BYTE_COUNT_BYTE])] = END_OF_PACKET;
+		cms_packet_to_transmit_fragments[RESPONSE_FRAGMENT_PREFIX].data_ptr = &cms_packet_to_transmit_prefix[0];
+		cms_packet_to_transmit_fragments[RESPONSE_FRAGMENT_PREFIX].data_length = prefix_bytes;
+		cms_packet_to_transmit_fragments[RESPONSE_FRAGMENT_HEADER].data_ptr = &cms_packet_to_transmit[BYTE_COUNT_BYTE];
+		cms_packet_to_transmit_fragments[RESPONSE_FRAGMENT_HEADER].data_length = HEADER_BYTES_AFTER_PREFIX;
+		cms_packet_to_transmit_fragments[RESPONSE_FRAGMENT_DATA].data_ptr = &cms_packet_to_transmit[START_OF_ADDITIONAL_DATA];
+		cms_packet_to_transmit_fragments[RESPONSE_FRAGMENT_DATA].data_length = response_data_bytes;
+		cms_packet_to_transmit_fragments[RESPONSE_FRAGMENT_TRAILER].data_ptr = &cms_packet_to_transmit_trailer[TRAILER_CRC_LSB_BYTE];
+		cms_packet_to_transmit_fragments[RESPONSE_FRAGMENT_TRAILER].data_length = PACKET_TRAILER_BYTES;
 		//
-		// send the response to the serial port. 
-		SRL_Add_data_to_transmit_buffer(&cms_packet_to_transmit[START_OF_PACKET_BYTE], (DEFAULT_PACKET_SIZE + cms_packet_to_transmit[BYTE_COUNT_BYTE]));
+		// send the response to the serial port straight from the buffers, they 
+		// can't be touched again until the transmitted task runs
+		cms_packet_to_transmit_busy = SRL_Queue_data_to_transmit(engine_ptr->port, &cms_packet_to_transmit_fragments[0], NUMBER_OF_RESPONSE_FRAGMENTS, 
+																	pgm_read_byte(&cms_engine_tasks[engine_ptr->port].transmitted_task));
 	}
 	else
 	{
 		// do nothing this command will be retried 
 	}
+	//
+	// a baud rate change waits for its response to go at the old rate. With 
+	// nothing going out a broadcast change is made now, as every node on the 
+	// bus changes together, otherwise it is dropped so the host's retry is 
+	// still heard at the old rate
+	if((True == engine_ptr->baud_rate_change_pending) && (False == cms_packet_to_transmit_busy))
+	{
+		if(True == broadcast)
+		{
+			change_baud_rate(engine_ptr);
+		}
+		else
+		{
+			engine_ptr->baud_rate_change_pending = False;
+		}
+	}
 }
 
 // name:	process_received_response
-// Desc:	Fill in when we fill in the function.
-static inline void process_received_response(unsigned char command)
+// Desc:	matches the response to the outstanding request with the same 
+//			command and sequence number and passes it to the request's 
+//			handler. Returns False for a response nothing on this port is 
+//			waiting for, such as a late one to a request that has timed out.
+static inline Boolean process_received_response(CMS_ENGINE *engine_ptr, unsigned char command, const unsigned char *received_packet_ptr)
+{
+	CMS_REQUEST *request_ptr = NULL;
+	unsigned char request_index;
+	Boolean answered = False;
+	
+	if(REQUEST_SEQUENCE_NUMBER_BYTES <= received_packet_ptr[BYTE_COUNT_BYTE])
+	{
+		for(request_index = 0; (request_index < CMS_MAX_OUTSTANDING_REQUESTS) && (NULL == request_ptr); request_index++)
+		{
+			if((True == cms_requests[request_index].waiting) && (engine_ptr->port == cms_requests[request_index].port) &&
+				(command == cms_requests[request_index].command) && (received_packet_ptr[REQUEST_SEQUENCE_NUMBER_BYTE] == cms_requests[request_index].sequence_number))
+			{
+				request_ptr = &cms_requests[request_index];
+			}
+		}
+	}
+	//
+	if(NULL != request_ptr)
+	{
+		TMR_Cancel_timer(request_ptr->timer_handle);
+		finish_request(request_ptr, CMS_REQUEST_ANSWERED, &received_packet_ptr[REQUEST_SEQUENCE_NUMBER_BYTE + REQUEST_SEQUENCE_NUMBER_BYTES],
+						received_packet_ptr[BYTE_COUNT_BYTE] - REQUEST_SEQUENCE_NUMBER_BYTES);
+		answered = True;
+	}
+	
+	return answered;
+}
+
+// name:	forward_received_packet
+// Desc:	copies a packet received by the engine into the transmit buffer 
+//			and sends it out of the forwarding engine's port in that port's 
+//			format. It keeps the address it arrived with, one from a port 
+//			without addresses goes onto a bus at the broadcast address. The 
+//			crc covers the prefix so it is worked out again. The buffer is 
+//			busy until the forwarding engine's transmitted task runs.
+static void forward_received_packet(CMS_ENGINE *engine_ptr, const unsigned char *received_packet_ptr)
+{
+	CMS_ENGINE *forwarding_engine_ptr = &cms_engines[engine_ptr->forwarding_port];
+	unsigned char byte_count = received_packet_ptr[BYTE_COUNT_BYTE];
+	CRC_STATE forward_crc_state;
+	unsigned short forward_crc;
+	unsigned char prefix_bytes;
+	
+	prefix_bytes = set_packet_prefix(forwarding_engine_ptr, engine_ptr->received_packet_addresses[engine_ptr->received_packet_parse_index], 
+										&cms_packet_to_transmit_prefix[0]);
+	memcpy((void*)&cms_packet_to_transmit[BYTE_COUNT_BYTE], (const void*)&received_packet_ptr[BYTE_COUNT_BYTE], PACKET_BYTES_FROM_BYTE_COUNT(byte_count));
+	//
+	CRC_Init(&forward_crc_state);
+	CRC_Update(&forward_crc_state, &cms_packet_to_transmit_prefix[0], prefix_bytes);
+	CRC_Update(&forward_crc_state, &cms_packet_to_transmit[BYTE_COUNT_BYTE], HEADER_BYTES_AFTER_PREFIX + byte_count);
+	forward_crc = CRC_Final(&forward_crc_state);
+	//
+	cms_packet_to_transmit[CRC_LSB_BYTE(byte_count)] = GET_16_BIT_LSB(forward_crc);
+	cms_packet_to_transmit[CRC_MSB_BYTE(byte_count)] = GET_16_BIT_MSB(forward_crc);
+	//
+	cms_packet_to_transmit_fragments[RESPONSE_FRAGMENT_PREFIX].data_ptr = &cms_packet_to_transmit_prefix[0];
+	cms_packet_to_transmit_fragments[RESPONSE_FRAGMENT_PREFIX].data_length = prefix_bytes;
+	cms_packet_to_transmit_fragments[RESPONSE_FRAGMENT_HEADER].data_ptr = &cms_packet_to_transmit[BYTE_COUNT_BYTE];
+	cms_packet_to_transmit_fragments[RESPONSE_FRAGMENT_HEADER].data_length = PACKET_BYTES_FROM_BYTE_COUNT(byte_count);
+	//
+	cms_packet_to_transmit_busy = SRL_Queue_data_to_transmit(forwarding_engine_ptr->port, &cms_packet_to_transmit_fragments[0], 
+																				NUMBER_OF_FORWARD_FRAGMENTS, pgm_read_byte(&cms_engine_tasks[forwarding_engine_ptr->port].transmitted_task));
+}
+
+// name:	set_packet_prefix
+// Desc:	fills in the bytes a packet sent in the engine's format starts 
+//			with, the start byte followed on a shared bus by the passed 
+//			address. Returns how many there are, the rest of the packet 
+//			follows from its byte count on.
+static unsigned char set_packet_prefix(const CMS_ENGINE *engine_ptr, unsigned char address, unsigned char *prefix_ptr)
+{
+	unsigned char prefix_bytes;
+	
+	if(CMS_ADDRESS_BROADCAST == engine_ptr->address)
+	{
+		prefix_ptr[ADDRESS_PREFIX_START_BYTE] = START_OF_PACKET;
+		prefix_bytes = UNADDRESSED_PREFIX_BYTES;
+	}
+	else
+	{
+		prefix_ptr[ADDRESS_PREFIX_START_BYTE] = ADDRESSED_START_OF_PACKET;
+		prefix_ptr[ADDRESS_PREFIX_ADDRESS_BYTE] = address;
+		prefix_bytes = ADDRESS_PREFIX_BYTES;
+	}
+	
+	return prefix_bytes;
+}
+
+// name:	finish_request
+// Desc:	ends the request and then calls its response handler, so the 
+//			handler can send another request straight away. The slot is freed 
+//			now unless its packet is still queued, then its sent task frees it.
+static void finish_request(CMS_REQUEST *request_ptr, CMS_REQUEST_RESULT result, const unsigned char *response_data_ptr, unsigned char response_data_length)
+{
+	CMS_RESPONSE_HANDLER response_handler;
+	
+	response_handler = request_ptr->response_handler;
+	request_ptr->waiting = False;
+	request_ptr->in_use = request_ptr->sending;
+	request_ptr->timer_handle = TIMER_HANDLE_NONE;
+	//
+	response_handler(result, response_data_ptr, response_data_length);
+}
+
+// name:	add_32_bit_value
+// Desc:	adds the value to the data least significant byte first and 
+//			returns a pointer to the next byte.
+static inline unsigned char *add_32_bit_value(unsigned char *data_ptr, unsigned long value)
+{
+	*data_ptr++ = (unsigned char)value;
+	*data_ptr++ = (unsigned char)(value >> 8);
+	*data_ptr++ = (unsigned char)(value >> 16);
+	*data_ptr++ = (unsigned char)(value >> 24);
+	
+	return data_ptr;
+}
+
+// name:	get_command_handler
+// Desc:	returns the handler of the command from the flash table or those 
+//			registered at run time, or NULL if it isn't handled.
+static inline CMS_COMMAND_HANDLER get_command_handler(unsigned char command)
+{
+	CMS_COMMAND_HANDLER command_handler;
+	unsigned char i;
+	
+	command_handler = (CMS_COMMAND_HANDLER)pgm_read_word(&cms_command_handlers[command]);
+	//
+	for(i = 0; (NULL == command_handler) && (i < cms_number_of_registered_commands); i++)
+	{
+		if(command == cms_registered_commands[i].command)
+		{
+			command_handler = cms_registered_commands[i].command_handler;
+		}
+	}
+	
+	return command_handler;
+}
+
+// name:	CMS_Get_status_command
+// Desc:	GET_STATUS handler, the response has no data.
+unsigned char CMS_Get_status_command(const unsigned char *request_data_ptr, unsigned char request_data_length, unsigned char *response_data_ptr)
+{
+	return NO_ADDITIONAL_BYTES;
+}
+
+// name:	CMS_Time_sync_command
+// Desc:	TIME_SYNC handler. The host sends its own time in the request and 
+//			notes when the response arrives, with our receive and transmit 
+//			times it can work out the offset and round trip like ntp. Times 
+//			are the 32 bit microsecond clock and the request data is echoed 
+//			after them.
+//			The receive time is when the start byte arrived. The transmit 
+//			time is taken here rather than when the udre interrupt loads the 
+//			start byte, as the crc covers it and is worked out before the 
+//			response is queued. It is early by the time to crc and queue 
+//			the response, which grows with the echo so the host should keep 
+//			it short, plus the time to send anything already queued on the 
+//			port ahead of it, which can only be requests of ours as the 
+//			response buffer is shared. The host should discard exchanges 
+//			whose round trip is well above the shortest seen, as with ntp.
+unsigned char CMS_Time_sync_command(const unsigned char *request_data_ptr, unsigned char request_data_length, unsigned char *response_data_ptr)
 {
-	// TBD fill out when i reach the point of sending requests
-}
\ No newline at end of file
+	unsigned char echo_bytes;
+	unsigned char *data_ptr;
+	
+	echo_bytes = request_data_length;
+	//
+	if(echo_bytes > TIME_SYNC_MAX_ECHO_BYTES)
+	{
+		echo_bytes = TIME_SYNC_MAX_ECHO_BYTES;
+	}
+	//
+	memcpy((void*)&response_data_ptr[TIME_SYNC_TIME_BYTES], (const void*)request_data_ptr, echo_bytes);
+	//
+	// take the transmit time as late as possible
+	data_ptr = add_32_bit_value(response_data_ptr, CMS_Get_request_receive_time_us());
+	add_32_bit_value(data_ptr, CLK_Get_time_us());
+	
+	return TIME_SYNC_TIME_BYTES + echo_bytes;
+}
+
+// name:	CMS_Batch_command
+// Desc:	BATCH handler, runs each sub-command in the request through its 
+//			handler in turn and gathers the sub-responses into one response 
+//			so a host polling many values pays for one packet. Every 
+//			sub-command gets a response entry, room is kept for a status 
+//			entry for each one still to come. Stops at a sub-command which 
+//			runs past the end of the request. Once a response doesn't fit 
+//			that sub-command, which has been carried out, and the rest, 
+//			which haven't, are answered with BATCH_NO_ROOM.
+unsigned char CMS_Batch_command(const unsigned char *request_data_ptr, unsigned char request_data_length, unsigned char *response_data_ptr)
+{
+	CMS_COMMAND_HANDLER command_handler;
+	unsigned char request_index = 0;
+	unsigned char response_bytes = 0;
+	unsigned char entries_left;
+	unsigned char sub_command;
+	unsigned char sub_request_length;
+	unsigned char sub_response_length;
+	Boolean batching = True;
+	Boolean room = True;
+	
+	entries_left = count_batch_entries(request_data_ptr, request_data_length);
+	//
+	while((True == batching) && ((request_index + BATCH_ENTRY_HEADER_BYTES) <= request_data_length))
+	{
+		sub_command = request_data_ptr[request_index + BATCH_ENTRY_COMMAND_BYTE] & ~COMMAND_IS_REQUEST_NOT_RESPONSE;
+		sub_request_length = request_data_ptr[request_index + BATCH_ENTRY_LENGTH_BYTE];
+		request_index += BATCH_ENTRY_HEADER_BYTES;
+		entries_left--;
+		//
+		if(sub_request_length > (request_data_length - request_index))
+		{
+			sub_response_length = BATCH_MALFORMED;
+			batching = False;
+		}
+		else if(False == room)
+		{
+			sub_response_length = BATCH_NO_ROOM;
+			request_index += sub_request_length;
+		}
+		else
+		{
+			command_handler = NULL;
+			sub_response_length = BATCH_NOT_HANDLED;
+			//
+			if(True == is_allowed_in_batch(sub_command))
+			{
+				command_handler = get_command_handler(sub_command);
+			}
+			//
+			if(NULL != command_handler)
+			{
+				sub_response_length = command_handler(&request_data_ptr[request_index], sub_request_length, &cms_batch_sub_response[0]);
+			}
+			//
+			// the entries still to come keep the room for their status
+			if((BATCH_NOT_HANDLED != sub_response_length) && 
+				(sub_response_length > (CMS_MAX_DATA_BYTES - response_bytes - (BATCH_ENTRY_HEADER_BYTES * (entries_left + 1)))))
+			{
+				sub_response_length = BATCH_NO_ROOM;
+				room = False;
+			}
+			//
+			request_index += sub_request_length;
+		}
+		//
+		response_data_ptr[response_bytes + BATCH_ENTRY_COMMAND_BYTE] = sub_command;
+		response_data_ptr[response_bytes + BATCH_ENTRY_LENGTH_BYTE] = sub_response_length;
+		response_bytes += BATCH_ENTRY_HEADER_BYTES;
+		//
+		// a status entry has no data
+		if(CMS_MAX_DATA_BYTES >= sub_response_length)
+		{
+			memcpy((void*)&response_data_ptr[response_bytes], (const void*)&cms_batch_sub_response[0], sub_response_length);
+			response_bytes += sub_response_length;
+		}
+	}
+	
+	return response_bytes;
+}
+
+// name:	count_batch_entries
+// Desc:	returns the number of entries in a batch request, counting one 
+//			whose data runs past the end.
+static inline unsigned char count_batch_entries(const unsigned char *request_data_ptr, unsigned char request_data_length)
+{
+	unsigned short request_index = 0;
+	unsigned char entries = 0;
+	
+	while((request_index + BATCH_ENTRY_HEADER_BYTES) <= request_data_length)
+	{
+		request_index += BATCH_ENTRY_HEADER_BYTES + request_data_ptr[request_index + BATCH_ENTRY_LENGTH_BYTE];
+		entries++;
+	}
+	
+	return entries;
+}
+
+// name:	is_allowed_in_batch
+// Desc:	batches aren't nested, and commands which would change something 
+//			again when the host resends them after BATCH_NO_ROOM aren't 
+//			allowed. A command registered at run time is, so its handler 
+//			should be safe to run twice.
+static inline Boolean is_allowed_in_batch(unsigned char command)
+{
+	return ((CMS_MAX_COMMANDS > command) && (CMS_COMMAND_BATCH != command) && 
+			(CMS_COMMAND_SET_BAUD_RATE != command) && (CMS_COMMAND_GET_AND_RESET_STATS != command));
+}
+
+// name:	CMS_Set_baud_rate_command
+// Desc:	SET_BAUD_RATE handler, answers with the baud rate which will be 
+//			used and changes the request's port to it once the response has gone. A rate the 
+//			port can't do is answered with the current one and nothing changes.
+unsigned char CMS_Set_baud_rate_command(const unsigned char *request_data_ptr, unsigned char request_data_length, unsigned char *response_data_ptr)
+{
+	CMS_ENGINE *engine_ptr = cms_parsing_engine_ptr;
+	
+	response_data_ptr[BAUD_RATE_BYTE] = SRL_Get_baud_rate(engine_ptr->port);
+	//
+	if((BAUD_RATE_BYTES == request_data_length) && (NUMBER_OF_SRL_BAUD_RATES > request_data_ptr[BAUD_RATE_BYTE]))
+	{
+		engine_ptr->baud_rate_to_change_to = (SRL_BAUD_RATE)request_data_ptr[BAUD_RATE_BYTE];
+		engine_ptr->baud_rate_change_pending = True;
+		response_data_ptr[BAUD_RATE_BYTE] = engine_ptr->baud_rate_to_change_to;
+	}
+	
+	return BAUD_RATE_BYTES;
+}
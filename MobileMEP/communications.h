@@ -9,7 +9,80 @@
 #ifndef COMMUNICATIONS_H_
 #define COMMUNICATIONS_H_
 
+#include "utilities.h"
+#include "serial.h"
+#include "commands.h"
+
+// the most additional data bytes a packet can carry
+#define CMS_MAX_DATA_BYTES				193
+
+// commands are 0x00 to 0x7F, the top bit of the command byte marks a request
+#define CMS_MAX_COMMANDS				128
+
+// commands a module registers at run time rather than adding to the table
+#define CMS_MAX_REGISTERED_COMMANDS		8
+
+// command numbers, each handled command has an entry in the command table
+#define CMS_COMMAND_GET_STATUS			0x10
+#define CMS_COMMAND_GET_STATS			0x11
+#define CMS_COMMAND_GET_AND_RESET_STATS	0x12
+#define CMS_COMMAND_TIME_SYNC			0x13
+#define CMS_COMMAND_BATCH				0x14
+#define CMS_COMMAND_SET_BAUD_RATE		0x15
+
+// on a shared bus each unit has its own address, packets sent to the 
+// broadcast address are for every unit
+#define CMS_ADDRESS_BROADCAST			0xFF
+
+// with port 1 on an rs-485 bus CMS_Init puts it on the bus at this address, 
+// each unit is built with its own using -DCMS_BUS_ADDRESS=n
+#if (SRL_RS485 == SRL_RS485_PORT_1)
+#ifndef CMS_BUS_ADDRESS
+#define CMS_BUS_ADDRESS					0x01
+#endif
+#if (CMS_BUS_ADDRESS >= CMS_ADDRESS_BROADCAST)
+#error "CMS_BUS_ADDRESS must be below the broadcast address"
+#endif
+#endif
+
+// returned by a command handler which doesn't want a response sent
+#define CMS_NO_RESPONSE					0xFF
+
+// a command handler is passed the request's additional data and writes any 
+// response data straight into the response buffer, which has room for 
+// CMS_MAX_DATA_BYTES. It returns the number of bytes written or CMS_NO_RESPONSE.
+typedef unsigned char (*CMS_COMMAND_HANDLER)(const unsigned char *request_data_ptr, unsigned char request_data_length, unsigned char *response_data_ptr);
+
+// command handler prototypes
+#define CMS_COMMAND(command, command_handler)	unsigned char command_handler(const unsigned char *request_data_ptr, unsigned char request_data_length, unsigned char *response_data_ptr);
+CMS_COMMAND_TABLE
+#undef CMS_COMMAND
+
+// requests we send carry a sequence number as their first data byte which 
+// the response must echo back as its first data byte, this is how a 
+// response is matched to its request when several are outstanding
+#define CMS_MAX_OUTSTANDING_REQUESTS	4
+#define CMS_MAX_REQUEST_DATA_BYTES		32
+
+// how a request we sent finished
+typedef enum
+{
+	CMS_REQUEST_ANSWERED = 0,
+	CMS_REQUEST_TIMED_OUT
+}CMS_REQUEST_RESULT;
+
+// a response handler is called from a task once the request has been 
+// answered, with the response data after the sequence number, or once it 
+// has timed out on every retry, with no data.
+typedef void (*CMS_RESPONSE_HANDLER)(CMS_REQUEST_RESULT result, const unsigned char *response_data_ptr, unsigned char response_data_length);
+
 void CMS_Init(void);
+unsigned long CMS_Get_request_receive_time_us(void);
+SRL_PORT CMS_Get_request_port(void);
+void CMS_Set_forwarding_port(SRL_PORT port, SRL_PORT forwarding_port);
+void CMS_Set_address(SRL_PORT port, unsigned char address);
+Boolean CMS_Register_command(unsigned char command, CMS_COMMAND_HANDLER command_handler);
+Boolean CMS_Send_request(SRL_PORT port, unsigned char command, const unsigned char *request_data_ptr, unsigned char request_data_length, CMS_RESPONSE_HANDLER response_handler);
 
 
 #endif /* COMMUNICATIONS_H_ */
\ No newline at end of file
@@ -0,0 +1,356 @@
+/*
+ * hires_timer.c
+ *
+ * Description:	Module responsible for microsecond one shot and periodic 
+ *				callbacks from the timer 1 compare match
+ */ 
+
+#include "hires_timer.h"
+#include "clock.h"
+#include "statistics.h"
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#define MAX_HRT_TIMERS							6
+
+// terminates the queued timer list
+#define NO_HRT_TIMER							0xFF
+
+#define OUTPUT_COMPARE_A_INTERRUPT_ENABLE		0x02
+#define OUTPUT_COMPARE_A_FLAG					0x02
+
+// the compare value must be written before the counter gets to it so 
+// anything due sooner than this is run this far in the future instead
+#define MINIMUM_LEAD_US							16
+
+// compares wrapping microsecond times
+#define IS_TIME_REACHED(time_us, now_us)		(0 <= (long)((now_us) - (time_us)))
+
+typedef struct
+{
+	Boolean timer_active;
+	Boolean timer_queued;
+	unsigned char generation;		// changes each time the timer is freed so old handles can be spotted
+	unsigned long due_time_us;
+	unsigned long period_us;
+	HRT_CALLBACK callback;
+	unsigned char next_timer;
+}HRT_TIMER_STRUCT;
+
+static inline Boolean is_period_valid(unsigned long period_us);
+static inline Boolean get_timer_index(HRT_HANDLE timer_handle, unsigned char *timer_index_ptr);
+static inline void queue_timer(unsigned char timer_index);
+static inline void dequeue_timer(unsigned char timer_index);
+static inline void free_timer(unsigned char timer_index);
+static inline void program_compare_match(void);
+
+static HRT_TIMER_STRUCT hrt_timers[MAX_HRT_TIMERS];
+
+// queued timers sorted by due time
+static unsigned char hrt_queued_timers_head;
+
+// name:	HRT_Init
+// Desc:	Module initialisation function, the clock must already be running.
+void HRT_Init(void)
+{
+	unsigned char i;
+	
+	for(i = 0; i < MAX_HRT_TIMERS; i++)
+	{
+		hrt_timers[i].timer_active = False;
+		hrt_timers[i].timer_queued = False;
+		hrt_timers[i].generation = 0;
+		hrt_timers[i].callback = 0;
+		hrt_timers[i].next_timer = NO_HRT_TIMER;
+	}
+	//
+	hrt_queued_timers_head = NO_HRT_TIMER;
+	//
+	// the clock owns the rest of timer 1, only the compare match A interrupt is used here
+	TIMSK1 &= ~OUTPUT_COMPARE_A_INTERRUPT_ENABLE;
+}
+
+// name:	HRT_Start_timer
+// Desc:	Calls the callback after the delay, then every period if it isn't 
+//			HRT_PERIOD_NONE. Periodic timers are due a whole period after 
+//			the previous due time so they don't drift. Returns a handle 
+//			for the timer or HRT_HANDLE_NONE if all the timers are in use 
+//			or the period is shorter than HRT_PERIOD_MINIMUM.
+HRT_HANDLE HRT_Start_timer(HRT_CALLBACK callback, unsigned long delay_us, unsigned long period_us)
+{
+	HRT_HANDLE timer_handle = HRT_HANDLE_NONE;
+	unsigned char timer_index = MAX_HRT_TIMERS;
+	unsigned char saved_sreg;
+	
+	saved_sreg = SREG;
+	cli();
+	//
+	// a period which is too short is refused, otherwise find an unused timer
+	if(True == is_period_valid(period_us))
+	{
+		for(timer_index = 0; ((timer_index < MAX_HRT_TIMERS) && (True == hrt_timers[timer_index].timer_active)); timer_index++)
+		{
+		}
+	}
+	//
+	if(MAX_HRT_TIMERS > timer_index)
+	{
+		hrt_timers[timer_index].timer_active = True;
+		hrt_timers[timer_index].callback = callback;
+		hrt_timers[timer_index].due_time_us = CLK_Get_time_us() + delay_us;
+		hrt_timers[timer_index].period_us = period_us;
+		//
+		queue_timer(timer_index);
+		program_compare_match();
+		//
+		timer_handle = MAKE_16_BITS(hrt_timers[timer_index].generation, timer_index);
+	}
+	//
+	SREG = saved_sreg;
+	
+	return timer_handle;
+}
+
+// name:	HRT_Cancel_timer
+// Desc:	Stops the timer without calling its callback. Returns False if 
+//			the handle no longer refers to an active timer.
+Boolean HRT_Cancel_timer(HRT_HANDLE timer_handle)
+{
+	Boolean timer_cancelled = False;
+	unsigned char timer_index;
+	unsigned char saved_sreg;
+	
+	saved_sreg = SREG;
+	cli();
+	//
+	if(True == get_timer_index(timer_handle, &timer_index))
+	{
+		dequeue_timer(timer_index);
+		free_timer(timer_index);
+		program_compare_match();
+		//
+		timer_cancelled = True;
+	}
+	//
+	SREG = saved_sreg;
+	
+	return timer_cancelled;
+}
+
+// name:	HRT_Reschedule_timer
+// Desc:	Restarts an active timer with a new delay and period from now, 
+//			keeping its handle and callback. Returns False if the handle no
+//			longer refers to an active timer or the period is shorter than 
+//			HRT_PERIOD_MINIMUM, either way the timer is left as it was.
+Boolean HRT_Reschedule_timer(HRT_HANDLE timer_handle, unsigned long delay_us, unsigned long period_us)
+{
+	Boolean timer_rescheduled = False;
+	unsigned char timer_index;
+	unsigned char saved_sreg;
+	
+	saved_sreg = SREG;
+	cli();
+	//
+	if((True == is_period_valid(period_us)) && (True == get_timer_index(timer_handle, &timer_index)))
+	{
+		dequeue_timer(timer_index);
+		//
+		hrt_timers[timer_index].due_time_us = CLK_Get_time_us() + delay_us;
+		hrt_timers[timer_index].period_us = period_us;
+		//
+		queue_timer(timer_index);
+		program_compare_match();
+		//
+		timer_rescheduled = True;
+	}
+	//
+	SREG = saved_sreg;
+	
+	return timer_rescheduled;
+}
+
+// name:	HRT_Is_timer_active
+// Desc:	Returns True if the handle refers to a timer which is still running.
+Boolean HRT_Is_timer_active(HRT_HANDLE timer_handle)
+{
+	unsigned char timer_index;
+	Boolean timer_active;
+	unsigned char saved_sreg;
+	
+	saved_sreg = SREG;
+	cli();
+	//
+	timer_active = get_timer_index(timer_handle, &timer_index);
+	//
+	SREG = saved_sreg;
+	
+	return timer_active;
+}
+
+// name:	is_period_valid
+// Desc:	returns True for a one shot or a period no shorter than the minimum.
+static inline Boolean is_period_valid(unsigned long period_us)
+{
+	return ((HRT_PERIOD_NONE == period_us) || (HRT_PERIOD_MINIMUM <= period_us));
+}
+
+// name:	get_timer_index
+// Desc:	gets the timer index from the handle, returns False if the handle 
+//			is stale or doesn't refer to an active timer.
+static inline Boolean get_timer_index(HRT_HANDLE timer_handle, unsigned char *timer_index_ptr)
+{
+	Boolean handle_valid = False;
+	unsigned char timer_index;
+	
+	timer_index = GET_16_BIT_LSB(timer_handle);
+	//
+	if((MAX_HRT_TIMERS > timer_index) &&
+		(True == hrt_timers[timer_index].timer_active) &&
+		(hrt_timers[timer_index].generation == GET_16_BIT_MSB(timer_handle)))
+	{
+		*timer_index_ptr = timer_index;
+		handle_valid = True;
+	}
+	
+	return handle_valid;
+}
+
+// name:	queue_timer
+// Desc:	adds the timer to the queue after any timers due at the same time or earlier.
+static inline void queue_timer(unsigned char timer_index)
+{
+	unsigned char previous_timer = NO_HRT_TIMER;
+	unsigned char next_timer = hrt_queued_timers_head;
+	
+	while((NO_HRT_TIMER != next_timer) && 
+			(IS_TIME_REACHED(hrt_timers[next_timer].due_time_us, hrt_timers[timer_index].due_time_us)))
+	{
+		previous_timer = next_timer;
+		next_timer = hrt_timers[next_timer].next_timer;
+	}
+	//
+	hrt_timers[timer_index].next_timer = next_timer;
+	hrt_timers[timer_index].timer_queued = True;
+	//
+	if(NO_HRT_TIMER == previous_timer)
+	{
+		hrt_queued_timers_head = timer_index;
+	}
+	else
+	{
+		hrt_timers[previous_timer].next_timer = timer_index;
+	}
+}
+
+// name:	dequeue_timer
+// Desc:	takes the timer out of the queue if it is in it.
+static inline void dequeue_timer(unsigned char timer_index)
+{
+	unsigned char previous_timer = NO_HRT_TIMER;
+	unsigned char next_timer = hrt_queued_timers_head;
+	
+	if(True == hrt_timers[timer_index].timer_queued)
+	{
+		while(next_timer != timer_index)
+		{
+			previous_timer = next_timer;
+			next_timer = hrt_timers[next_timer].next_timer;
+		}
+		//
+		if(NO_HRT_TIMER == previous_timer)
+		{
+			hrt_queued_timers_head = hrt_timers[timer_index].next_timer;
+		}
+		else
+		{
+			hrt_timers[previous_timer].next_timer = hrt_timers[timer_index].next_timer;
+		}
+		//
+		hrt_timers[timer_index].timer_queued = False;
+	}
+}
+
+// name:	free_timer
+// Desc:	marks the timer unused, invalidating its handle.
+static inline void free_timer(unsigned char timer_index)
+{
+	hrt_timers[timer_index].timer_active = False;
+	hrt_timers[timer_index].generation++;
+	hrt_timers[timer_index].callback = 0;
+}
+
+// name:	program_compare_match
+// Desc:	sets the compare match for the first timer due or turns the 
+//			interrupt off if none are queued. Must be called with interrupts 
+//			disabled. A timer more than one counter wrap away just gets a 
+//			compare match on each wrap until it is due.
+static inline void program_compare_match(void)
+{
+	unsigned long now_us;
+	unsigned long compare_time_us;
+	
+	if(NO_HRT_TIMER == hrt_queued_timers_head)
+	{
+		TIMSK1 &= ~OUTPUT_COMPARE_A_INTERRUPT_ENABLE;
+	}
+	else
+	{
+		now_us = CLK_Get_time_us();
+		compare_time_us = hrt_timers[hrt_queued_timers_head].due_time_us;
+		//
+		if(True == IS_TIME_REACHED(compare_time_us, (now_us + MINIMUM_LEAD_US)))
+		{
+			compare_time_us = now_us + MINIMUM_LEAD_US;
+		}
+		//
+		// clear any old match before the new value is written so a match 
+		// on the new value can't be lost
+		TIFR1 = OUTPUT_COMPARE_A_FLAG;
+		OCR1A = (unsigned short)compare_time_us;
+		TIMSK1 |= OUTPUT_COMPARE_A_INTERRUPT_ENABLE;
+	}
+}
+
+// name:	ISR(TIMER1_COMPA_vect)
+// Desc:	timer 1 compare match A interrupt.
+ISR(TIMER1_COMPA_vect)
+{
+	unsigned char timer_index;
+	unsigned long now_us;
+	STS_TIMING_START();
+	
+	now_us = CLK_Get_time_us();
+	//
+	// run the callbacks for all of the timers which are due
+	while((NO_HRT_TIMER != hrt_queued_timers_head) && 
+			(True == IS_TIME_REACHED(hrt_timers[hrt_queued_timers_head].due_time_us, now_us)))
+	{
+		timer_index = hrt_queued_timers_head;
+		//
+		hrt_queued_timers_head = hrt_timers[timer_index].next_timer;
+		hrt_timers[timer_index].timer_queued = False;
+		//
+		hrt_timers[timer_index].callback();
+		//
+		// the callback may have cancelled or rescheduled the timer itself
+		if((True == hrt_timers[timer_index].timer_active) && (False == hrt_timers[timer_index].timer_queued))
+		{
+			if(HRT_PERIOD_NONE == hrt_timers[timer_index].period_us)
+			{
+				free_timer(timer_index);
+			}
+			else
+			{
+				hrt_timers[timer_index].due_time_us += hrt_timers[timer_index].period_us;
+				queue_timer(timer_index);
+			}
+		}
+		//
+		now_us = CLK_Get_time_us();
+	}
+	//
+	program_compare_match();
+	//
+	STS_ISR_TIMING_END(STS_ISR_TIMER1_COMPA);
+}
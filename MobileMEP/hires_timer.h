@@ -0,0 +1,37 @@
+/*
+ * hires_timer.h
+ *
+ * Description:	Module responsible for microsecond one shot and periodic 
+ *				callbacks from the timer 1 compare match
+ */ 
+
+
+#ifndef HIRES_TIMER_H_
+#define HIRES_TIMER_H_
+
+#include "utilities.h"
+
+// callbacks run inside the compare match interrupt so must be short, they 
+// may start, cancel or reschedule timers including their own
+typedef void (*HRT_CALLBACK)(void);
+
+// a handle identifies a timer until it is cancelled or, for one shot timers,
+// until its callback has run
+typedef unsigned short HRT_HANDLE;
+
+#define HRT_HANDLE_NONE		0xFFFF
+
+#define HRT_PERIOD_NONE		0
+
+// the shortest period in microsecond clock ticks, a periodic timer due again 
+// before its interrupt has finished would keep the interrupt running for ever
+#define HRT_PERIOD_MINIMUM	100
+
+void HRT_Init(void);
+HRT_HANDLE HRT_Start_timer(HRT_CALLBACK callback, unsigned long delay_us, unsigned long period_us);
+Boolean HRT_Cancel_timer(HRT_HANDLE timer_handle);
+Boolean HRT_Reschedule_timer(HRT_HANDLE timer_handle, unsigned long delay_us, unsigned long period_us);
+Boolean HRT_Is_timer_active(HRT_HANDLE timer_handle);
+
+
+#endif /* HIRES_TIMER_H_ */
@@ -10,17 +10,25 @@
 #include "schedular.h"
 #include "communications.h"
 #include "timer.h"
+#include "clock.h"
+#include "power.h"
+#include "hires_timer.h"
+#include "statistics.h"
 
 #include <util/delay.h>
 #include <avr/interrupt.h>
 
 // name:	main
 // Desc:	main program entry point, initialises other modules and 
-//			calls background processor in main super loop.
+//			calls background processor in main super loop, sleeping
+//			whenever there are no tasks waiting to run.
 int main(void)
 {	
 	// call module initialisation functions
 	SCH_Init();
+	CLK_Init();
+	STS_Init();
+	HRT_Init();
 	TMR_Init();
 	//
 	HDW_Init();
@@ -29,6 +37,8 @@ int main(void)
 	//
 	CMS_Init();
 	//
+	PWR_Init();
+	//
 	// enable interrupts now the modules are set up
 	sei();
 	//
@@ -37,6 +47,9 @@ int main(void)
 	{
 		// if there is a background task then run it
 		SCH_Run_background_tasks();
+		//
+		// sleep until an interrupt if there is nothing left to run
+		PWR_Sleep_if_idle();
 	}
 }
 
@@ -0,0 +1,82 @@
+/*
+ * power.c
+ *
+ * Description:	Module responsible for sleeping when there is nothing to do
+ */ 
+
+#include "power.h"
+#include "schedular.h"
+#include "clock.h"
+#include "utilities.h"
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+
+#define MICROSECONDS_PER_PERCENT_DIVISOR	100
+
+// time spent asleep since the start of the measurement window
+static unsigned long pwr_idle_time_us;
+static unsigned long pwr_window_start_us;
+
+// name:	PWR_Init
+// Desc:	Module initialisation function. Idle sleep is used as timer 0, 
+//			timer 1 and the usart all need the io clock to keep running.
+void PWR_Init(void)
+{
+	set_sleep_mode(SLEEP_MODE_IDLE);
+	//
+	pwr_idle_time_us = 0;
+	pwr_window_start_us = CLK_Get_time_us();
+}
+
+// name:	PWR_Sleep_if_idle
+// Desc:	sleeps until the next interrupt if there are no tasks to run.
+void PWR_Sleep_if_idle(void)
+{
+	unsigned long sleep_start_us;
+	
+	// interrupts are off while checking so a task signalled by an interrupt
+	// can't be missed between the check and going to sleep
+	cli();
+	//
+	if(False == SCH_Are_tasks_pending())
+	{
+		sleep_start_us = CLK_Get_time_us();
+		//
+		// the instruction after sei always runs before any interrupt 
+		// so the processor is asleep before the interrupt can happen
+		sleep_enable();
+		sei();
+		sleep_cpu();
+		sleep_disable();
+		//
+		// the interrupt that woke us has run so add the time spent asleep
+		pwr_idle_time_us += CLK_Get_time_us() - sleep_start_us;
+	}
+	//
+	sei();
+}
+
+// name:	PWR_Get_idle_percentage
+// Desc:	returns the percentage of time spent asleep since the last call.
+unsigned char PWR_Get_idle_percentage(void)
+{
+	unsigned long now_us;
+	unsigned long window_us;
+	unsigned char idle_percentage = 0;
+	
+	now_us = CLK_Get_time_us();
+	window_us = (now_us - pwr_window_start_us) / MICROSECONDS_PER_PERCENT_DIVISOR;
+	//
+	if(0 != window_us)
+	{
+		idle_percentage = (unsigned char)(pwr_idle_time_us / window_us);
+	}
+	//
+	// start a new measurement window
+	pwr_idle_time_us = 0;
+	pwr_window_start_us = now_us;
+	
+	return idle_percentage;
+}
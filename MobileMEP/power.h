@@ -0,0 +1,16 @@
+/*
+ * power.h
+ *
+ * Description:	Module responsible for sleeping when there is nothing to do
+ */ 
+
+
+#ifndef POWER_H_
+#define POWER_H_
+
+void PWR_Init(void);
+void PWR_Sleep_if_idle(void);
+unsigned char PWR_Get_idle_percentage(void);
+
+
+#endif /* POWER_H_ */
@@ -7,115 +7,316 @@
  */ 
 
 #include "schedular.h"
+#include "statistics.h"
 
 #include <string.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
 
-#define MAXIMUM_TASKS		50
+// pending tasks are held as a bitmap of up to 8 task groups, each group 
+// has a bit in the summary byte which is set while any of its tasks are pending
+#define TASKS_PER_GROUP			8
+#define TASK_GROUP_SHIFT		3
+#define TASK_BIT_MASK			0x07
+#define NUMBER_OF_TASK_GROUPS	((NUMBER_OF_TASKS + TASKS_PER_GROUP - 1) / TASKS_PER_GROUP)
 
-// info related to tasks which are to be run
-typedef struct  
-{
-	void (*task_function_ptr)(void);
-	TASK_TRIGGER_SOURCE triggered_source;		
-}RUN_TASK_INFO;
+#if (NUMBER_OF_TASK_GROUPS > 8)
+#error "the task table has more tasks than the pending group summary byte can hold"
+#endif
+
+#define GET_TASK_GROUP(task_index)	((task_index) >> TASK_GROUP_SHIFT)
+#define GET_TASK_BIT(task_index)	((task_index) & TASK_BIT_MASK)
+
+// number of higher priority tasks which can run while a low priority 
+// task is pending before the low priority task is run anyway
+#define LOW_PRIORITY_STARVATION_LIMIT	16
+
+typedef void (*TASK_FUNCTION)(void);
+
+// jump table of task functions and their priorities, both indexed by task id and held in flash
+#define SCH_TASK(task_id, task_function, priority)	task_function,
+static const TASK_FUNCTION task_functions[NUMBER_OF_TASKS] PROGMEM = { SCH_TASK_TABLE };
+#undef SCH_TASK
+
+#define SCH_TASK(task_id, task_function, priority)	priority,
+static const unsigned char task_priorities[NUMBER_OF_TASKS] PROGMEM = { SCH_TASK_TABLE };
+#undef SCH_TASK
+
+// pending task bitmap for each priority, a summary bit for each priority
+// with pending tasks and the trigger sources accumulated for each pending task
+static volatile unsigned char tasks_pending_priorities;
+static volatile unsigned char tasks_pending_groups[NUMBER_OF_TASK_PRIORITIES];
+static volatile unsigned char tasks_pending[NUMBER_OF_TASK_PRIORITIES][NUMBER_OF_TASK_GROUPS];
+static volatile unsigned char tasks_trigger_sources[NUMBER_OF_TASKS];
+
+// the task currently being run and where the search for the next task starts in each priority
+static unsigned char running_task_index;
+static TASK_TRIGGER_SOURCE running_task_trigger_source;
+static unsigned char next_task_search_index[NUMBER_OF_TASK_PRIORITIES];
+
+// where each resumable task carries on from when it is next run, 0 is the start of the task
+static SCH_RESUME_POINT task_resume_points[NUMBER_OF_TASKS];
+
+// handed out when no task is running, it is reset each time so a task 
+// function called directly always starts from the beginning
+static SCH_RESUME_POINT no_task_resume_point;
+
+#ifdef STATISTICS_ENABLED
+// number of tasks waiting to run
+static unsigned char tasks_pending_count;
+#endif
 
-// list of all tasks and index to add next task 
-static void (*task_lists[MAXIMUM_TASKS])(void);
-static unsigned char task_list_input_index; 
+// higher priority tasks run since the low priority tasks became pending
+static unsigned char low_priority_starved_count;
 
-// tasks to run array and associated tracking variables
-static RUN_TASK_INFO tasks_to_run[MAXIMUM_TASKS];
-static unsigned char tasks_to_run_input_index;
-static unsigned char tasks_to_run_output_index;
-static unsigned char tasks_to_run_count;
+// single bit masks and the index of the lowest set bit of each nibble value, held in flash
+static const unsigned char bit_masks[TASKS_PER_GROUP] PROGMEM = {0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80};
+static const unsigned char lowest_set_bit_in_nibble[16] PROGMEM = {0, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0};
+
+static inline unsigned char find_lowest_set_bit(unsigned char bits);
+static inline unsigned char find_next_pending_task(unsigned char priority);
 
 // name:	SCH_Init
 // Desc:	Module initialisation function sets up the background task schedular.
 void SCH_Init(void)
 {
 	// reset variables
-	task_list_input_index = 0;
+	tasks_pending_priorities = 0;
 	//
-	memset((void*)&task_lists[0], 0, (sizeof(task_lists[0]) * MAXIMUM_TASKS));
+	memset((void*)&tasks_pending_groups[0], 0, NUMBER_OF_TASK_PRIORITIES);
+	memset((void*)&tasks_pending[0][0], 0, (NUMBER_OF_TASK_PRIORITIES * NUMBER_OF_TASK_GROUPS));
+	memset((void*)&tasks_trigger_sources[0], NOT_TRIGGERED, NUMBER_OF_TASKS);
 	//
-	tasks_to_run_input_index = 0;
-	tasks_to_run_output_index = 0;
-	tasks_to_run_count = 0;
+	running_task_index = NO_TASK;
+	running_task_trigger_source = NOT_TRIGGERED;
 	//
-	memset((void*)&tasks_to_run[0], 0, (sizeof(tasks_to_run[0]) * MAXIMUM_TASKS));
-}
-
-// name:	SCH_Add_task_to_list
-// Desc:	adds a task to the list and returns a reference to that task.
-unsigned char SCH_Add_task_to_list(void(*task_function_ptr)(void))
-{
-	unsigned char task_added_index = NO_TASK; // default to NO_TASK incase array is full
-	
-	// only add the task if the input index is less than maximum
-	if(MAXIMUM_TASKS > task_list_input_index)
-	{
-		// set the task index to return and then increment index to the next position
-		task_added_index = task_list_input_index++;
-		//
-		// add the task function to the list
-		task_lists[task_added_index] = task_function_ptr;
-	}
-	else
-	{
-		// TBD add error 
-	}
-	
-	return task_added_index;
+	memset((void*)&next_task_search_index[0], 0, NUMBER_OF_TASK_PRIORITIES);
+	memset((void*)&task_resume_points[0], 0, sizeof(task_resume_points));
+	//
+	low_priority_starved_count = 0;
+	//
+#ifdef STATISTICS_ENABLED
+	tasks_pending_count = 0;
+#endif
 }
 
 // name:	SCH_Signal_task
-// Desc:	adds the task at the index to the run task list with the source.
+// Desc:	marks the task at the index as pending and adds the source to its 
+//			trigger sources. Signalling a task which is already pending only 
+//			adds the source so the task still runs once. Safe to call from ISRs.
 void SCH_Signal_task(unsigned char task_index, TASK_TRIGGER_SOURCE source)
 {
-	// add the task to the run array if the index is not NO_TASK
-	if(NO_TASK != task_index)
+	unsigned char saved_sreg;
+	unsigned char task_group;
+	unsigned char priority;
+	
+	// only signal tasks which are in the task table, this also rejects NO_TASK
+	if(NUMBER_OF_TASKS > task_index)
 	{
-		tasks_to_run[tasks_to_run_input_index].task_function_ptr = task_lists[task_index];
-		tasks_to_run[tasks_to_run_input_index].triggered_source = source;
+		task_group = GET_TASK_GROUP(task_index);
+		priority = pgm_read_byte(&task_priorities[task_index]);
+		//
+		// interrupts are held off so the read modify writes can't be split by an ISR
+		saved_sreg = SREG;
+		cli();
 		//
-		if(MAXIMUM_TASKS == ++tasks_to_run_input_index)
+#ifdef STATISTICS_ENABLED
+		// count the task if it wasn't already pending
+		if(0 == (tasks_pending[priority][task_group] & pgm_read_byte(&bit_masks[GET_TASK_BIT(task_index)])))
 		{
-			tasks_to_run_input_index = 0;
+			STS_UPDATE_HIGH_WATER(STS_HIGH_WATER_PENDING_TASKS, ++tasks_pending_count);
 		}
+#endif
+		//
+		tasks_pending[priority][task_group] |= pgm_read_byte(&bit_masks[GET_TASK_BIT(task_index)]);
+		tasks_pending_groups[priority] |= pgm_read_byte(&bit_masks[task_group]);
+		tasks_pending_priorities |= pgm_read_byte(&bit_masks[priority]);
+		tasks_trigger_sources[task_index] |= source;
 		//
-		tasks_to_run_count++;	
+		SREG = saved_sreg;
 	}
 }
 
 // name:	SCH_Run_background_tasks
-// Desc:	runs one background task if there are any to run.
+// Desc:	runs one background task if there are any to run. The highest 
+//			priority pending task is run, tasks of the same priority are run 
+//			round robin starting after the last task of that priority that ran.
 void SCH_Run_background_tasks(void)
 {
+	TASK_FUNCTION task_function;
+	unsigned char saved_sreg;
+	unsigned char task_index;
+	unsigned char task_group;
+	unsigned char priority;
+	
 	// if there are tasks to run
-	if(0 != tasks_to_run_count)
+	if(0 != tasks_pending_priorities)
 	{
-		// run the next task 
-		tasks_to_run[tasks_to_run_output_index].task_function_ptr();
+		saved_sreg = SREG;
+		cli();
 		//
-		// reset the element in the run array 
-		tasks_to_run[tasks_to_run_output_index].task_function_ptr = NULL;
-		tasks_to_run[tasks_to_run_output_index].triggered_source = NOT_TRIGGERED;
+		// highest priority is the lowest set bit 
+		priority = find_lowest_set_bit(tasks_pending_priorities);
 		//
-		// move on to the next task index
-		if(MAXIMUM_TASKS == ++tasks_to_run_output_index)
+		// don't let higher priority tasks starve pending low priority tasks forever
+		if(TASK_PRIORITY_LOW != priority)
 		{
-			tasks_to_run_output_index = 0;
+			if(0 != (tasks_pending_priorities & pgm_read_byte(&bit_masks[TASK_PRIORITY_LOW])))
+			{
+				if(LOW_PRIORITY_STARVATION_LIMIT <= ++low_priority_starved_count)
+				{
+					priority = TASK_PRIORITY_LOW;
+				}
+			}
 		}
 		//
-		// this task has run so decrement the tasks to run count
-		tasks_to_run_count--;
+		if(TASK_PRIORITY_LOW == priority)
+		{
+			low_priority_starved_count = 0;
+		}
+		//
+		// find the task and clear its pending bit, clearing the group and 
+		// priority summary bits if this was the last pending task in them
+		task_index = find_next_pending_task(priority);
+		task_group = GET_TASK_GROUP(task_index);
+		//
+		tasks_pending[priority][task_group] &= ~pgm_read_byte(&bit_masks[GET_TASK_BIT(task_index)]);
+		//
+#ifdef STATISTICS_ENABLED
+		tasks_pending_count--;
+#endif
+		//
+		if(0 == tasks_pending[priority][task_group])
+		{
+			tasks_pending_groups[priority] &= ~pgm_read_byte(&bit_masks[task_group]);
+			//
+			if(0 == tasks_pending_groups[priority])
+			{
+				tasks_pending_priorities &= ~pgm_read_byte(&bit_masks[priority]);
+			}
+		}
+		//
+		// take the accumulated trigger sources so new signals start afresh
+		running_task_trigger_source = (TASK_TRIGGER_SOURCE)tasks_trigger_sources[task_index];
+		tasks_trigger_sources[task_index] = NOT_TRIGGERED;
+		//
+		SREG = saved_sreg;
+		//
+		// the next search starts after this task so every pending task gets a turn
+		next_task_search_index[priority] = task_index + 1;
+		//
+		if(NUMBER_OF_TASKS == next_task_search_index[priority])
+		{
+			next_task_search_index[priority] = 0;
+		}
+		//
+		// run the task through the jump table
+		running_task_index = task_index;
+		task_function = (TASK_FUNCTION)pgm_read_word(&task_functions[task_index]);
+		//
+		STS_TIMING_START();
+		task_function();
+		STS_TASK_TIMING_END(task_index);
+		//
+		running_task_index = NO_TASK;
+		running_task_trigger_source = NOT_TRIGGERED;
 	}
 }
 
+// name:	SCH_Are_tasks_pending
+// Desc:	returns True if any task is waiting to run.
+Boolean SCH_Are_tasks_pending(void)
+{
+	return (0 != tasks_pending_priorities) ? True : False;
+}
+
 // name:	SCH_Get_task_trigger_source
-// Desc:	returns the trigger source of the running task.
+// Desc:	returns the trigger sources of the running task, if the task was
+//			signalled more than once before it ran these are OR'd together.
 TASK_TRIGGER_SOURCE SCH_Get_task_trigger_source(void)
 {
 	// return the source that signalled the task to run
-	return tasks_to_run[tasks_to_run_output_index].triggered_source;
+	return running_task_trigger_source;
+}
+
+// name:	SCH_Get_running_task
+// Desc:	returns the index of the running task or NO_TASK.
+unsigned char SCH_Get_running_task(void)
+{
+	return running_task_index;
+}
+
+// name:	SCH_Get_task_resume_point
+// Desc:	returns the resume point of the running task, used by SCH_TASK_BEGIN. 
+//			Outside a task there is nothing to resume so a point at the start 
+//			is returned.
+SCH_RESUME_POINT *SCH_Get_task_resume_point(void)
+{
+	SCH_RESUME_POINT *resume_point_ptr;
+	
+	if(NUMBER_OF_TASKS > running_task_index)
+	{
+		resume_point_ptr = &task_resume_points[running_task_index];
+	}
+	else
+	{
+		no_task_resume_point = 0;
+		resume_point_ptr = &no_task_resume_point;
+	}
+	
+	return resume_point_ptr;
+}
+
+// name:	find_lowest_set_bit
+// Desc:	returns the position of the lowest set bit, bits must not be zero.
+static inline unsigned char find_lowest_set_bit(unsigned char bits)
+{
+	unsigned char lowest_bit;
+	
+	if(0 != (bits & 0x0F))
+	{
+		lowest_bit = pgm_read_byte(&lowest_set_bit_in_nibble[bits & 0x0F]);
+	}
+	else
+	{
+		lowest_bit = 4 + pgm_read_byte(&lowest_set_bit_in_nibble[bits >> 4]);
+	}
+	
+	return lowest_bit;
+}
+
+// name:	find_next_pending_task
+// Desc:	returns the first pending task of the priority at or after the  
+//			search index, wrapping round to the start. At least one task of 
+//			the priority must be pending.
+static inline unsigned char find_next_pending_task(unsigned char priority)
+{
+	unsigned char search_index;
+	unsigned char task_group;
+	unsigned char pending_bits;
+	unsigned char pending_groups;
+	
+	search_index = next_task_search_index[priority];
+	task_group = GET_TASK_GROUP(search_index);
+	//
+	// pending tasks in the same group at or after the search index
+	pending_bits = tasks_pending[priority][task_group] & (unsigned char)(0xFF << GET_TASK_BIT(search_index));
+	//
+	if(0 == pending_bits)
+	{
+		// try the groups after this one, and if there are none wrap round 
+		// to the first pending group which may be the search group itself
+		pending_groups = tasks_pending_groups[priority] & (unsigned char)(0xFE << task_group);
+		//
+		if(0 == pending_groups)
+		{
+			pending_groups = tasks_pending_groups[priority];
+		}
+		//
+		task_group = find_lowest_set_bit(pending_groups);
+		pending_bits = tasks_pending[priority][task_group];
+	}
+	
+	return (unsigned char)((task_group << TASK_GROUP_SHIFT) + find_lowest_set_bit(pending_bits));
 }
\ No newline at end of file
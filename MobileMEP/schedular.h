@@ -10,22 +10,68 @@
 #ifndef SCHEDULAR_H_
 #define SCHEDULAR_H_
 
+#include "tasks.h"
+#include "utilities.h"
+
 #define NO_TASK 0xFF
 
-// sources which can trigger a task to run
+// sources which can trigger a task to run, these are bit flags so the 
+// sources of a task signalled more than once before it runs can be combined
 typedef enum
 {
-	NOT_TRIGGERED = 0,
-	TIMER_TRIGGERED,
-	SELF_TRIGGERED,
-	DATA_TRIGGERED
+	NOT_TRIGGERED	= 0x00,
+	TIMER_TRIGGERED	= 0x01,
+	SELF_TRIGGERED	= 0x02,
+	DATA_TRIGGERED	= 0x04
 }TASK_TRIGGER_SOURCE;
 
+// task priorities, pending tasks of a higher priority always run first 
+// apart from when the low priority starvation guard lets a low task through
+typedef enum
+{
+	TASK_PRIORITY_HIGH = 0,
+	TASK_PRIORITY_NORMAL,
+	TASK_PRIORITY_LOW,
+	NUMBER_OF_TASK_PRIORITIES
+}TASK_PRIORITY;
+
+// task ids, one for each entry in the task table
+#define SCH_TASK(task_id, task_function, priority)	task_id,
+typedef enum
+{
+	SCH_TASK_TABLE
+	NUMBER_OF_TASKS
+}TASK_ID;
+#undef SCH_TASK
+
+// task function prototypes
+#define SCH_TASK(task_id, task_function, priority)	void task_function(void);
+SCH_TASK_TABLE
+#undef SCH_TASK
+
+// resumable tasks, a task wraps its body in SCH_TASK_BEGIN() and SCH_TASK_END()
+// and can then call SCH_TASK_YIELD() to let other tasks run. The task is 
+// re-signalled and carries on from the yield the next time it is run.
+// Local variables are not kept across a yield so task state must be static 
+// and the yield can't be used inside a switch statement of the task itself.
+typedef unsigned short SCH_RESUME_POINT;
+
+#define SCH_TASK_BEGIN()	{ SCH_RESUME_POINT *sch_resume_point_ptr = SCH_Get_task_resume_point(); \
+								switch(*sch_resume_point_ptr) { case 0:
+
+#define SCH_TASK_YIELD()	do { *sch_resume_point_ptr = __LINE__; \
+								SCH_Signal_task(SCH_Get_running_task(), SELF_TRIGGERED); \
+								return; case __LINE__:; } while(0)
+
+#define SCH_TASK_END()		} *sch_resume_point_ptr = 0; }
+
 void SCH_Init(void);
-unsigned char SCH_Add_task_to_list(void(*task_function_ptr)(void));
 void SCH_Signal_task(unsigned char task_index, TASK_TRIGGER_SOURCE source);
 void SCH_Run_background_tasks(void);
+Boolean SCH_Are_tasks_pending(void);
 TASK_TRIGGER_SOURCE SCH_Get_task_trigger_source(void);
+unsigned char SCH_Get_running_task(void);
+SCH_RESUME_POINT *SCH_Get_task_resume_point(void);
 
 
 #endif /* SCHEDULAR_H_ */
\ No newline at end of file
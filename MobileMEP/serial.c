@@ -3,19 +3,41 @@
  *
  * Created:		10/05/2018 19:51:00
  * Author:		Graham
- * Description:	Module responsible for receiving data from the serial port
+ * Description:	Module responsible for receiving data from the serial ports
  */ 
 
 #include "serial.h"
 #include "utilities.h"
 #include "schedular.h"
+#include "statistics.h"
+#include "clock.h"
 
 #include <string.h>
 #include <avr/io.h>
 #include <avr/interrupt.h>
+#include <avr/pgmspace.h>
 
-#define MAXIMUM_TX_BUFFER_SIZE						256
+// the buffers are single producer single consumer rings, the producer only 
+// moves the head and the consumer only moves the tail so neither side has to
+// disable interrupts. The sizes must be a power of two no bigger than 256 so 
+// the single byte indexes can be wrapped with a mask, one byte is always left 
+// empty to tell a full buffer from an empty one. Large blocks are sent from 
+// the caller's own buffer so the tx buffer only holds small copied ones.
+#define MAXIMUM_TX_BUFFER_SIZE						64
 #define MAXIMUM_RX_BUFFER_SIZE						256
+#define TX_BUFFER_MASK								(MAXIMUM_TX_BUFFER_SIZE - 1)
+#define RX_BUFFER_MASK								(MAXIMUM_RX_BUFFER_SIZE - 1)
+
+// everything sent is queued as a descriptor, pointing either at the 
+// caller's buffer or at bytes copied into the tx buffer
+#define MAX_TX_DESCRIPTORS							16
+#define TX_DESCRIPTORS_MASK							(MAX_TX_DESCRIPTORS - 1)
+
+#if ((MAXIMUM_TX_BUFFER_SIZE > 256) || (0 != (MAXIMUM_TX_BUFFER_SIZE & TX_BUFFER_MASK)) || \
+	(MAXIMUM_RX_BUFFER_SIZE > 256) || (0 != (MAXIMUM_RX_BUFFER_SIZE & RX_BUFFER_MASK)) || \
+	(MAX_TX_DESCRIPTORS > 256) || (0 != (MAX_TX_DESCRIPTORS & TX_DESCRIPTORS_MASK)))
+#error "serial buffer sizes must be a power of two no bigger than 256"
+#endif
 
 #define FRAMING_ERROR								0x10
 #define DATA_OVERRUN_ERROR							0x08
@@ -24,191 +46,1014 @@
 #define NO_SERIAL_ERRORS							0x00
 
 #define UART_RX_INTERRUPT_ENABLE					0x80
+#define UART_TX_COMPLETE_INTERRUPT_ENABLE			0x40
 #define UART_DATA_REGISTER_EMPTY_INTERRUPT_ENABLE	0x20
 #define RECEIVER_ENABLE								0x10
 #define TRANSMITTER_ENABLE							0x08
+#define TRANSMIT_COMPLETE							0x40
+#define DATA_REGISTER_EMPTY							0x20
 #define DOUBLE_UART_TRANSMISSION_SPEED				0x02
 
 #define EIGHT_DATA_BITS								0x06
 
-#define BAUD_RATE_115200							8
+// UBRR for each baud rate with the double speed bit set, 
+// UBRR = (8MHz / (8 * baud rate)) - 1
+#define UBRR_115200									8
+#define UBRR_250000									3
+#define UBRR_500000									1
+#define UBRR_1000000								0
 
-// receive variables 
-static unsigned char srl_receive_data_buffer[MAXIMUM_RX_BUFFER_SIZE];
-static unsigned short srl_receive_input_index;
-static unsigned short srl_receive_output_index;
-static unsigned short srl_receive_bytes_in_buffer;
+// flow control lines on spare port d pins, both active low. RTS is raised 
+// with room for a few more bytes the host may send before it stops, and 
+// lowered again once the buffer is mostly empty. The receiving task can keep 
+// a whole packet in the rx buffer while it checks it so RTS isn't raised 
+// before a full packet has been received. Port 1's rx and tx pins are on
+// port d as well, so only port 0 has flow control.
+#if (SRL_FLOW_CONTROL == SRL_FLOW_CONTROL_RTS_CTS)
+#define FLOW_CONTROL_SERIAL_PORT					SRL_PORT_0
+#define FLOW_CONTROL_PORT							PORTD
+#define FLOW_CONTROL_PORT_DDR						DDRD
+#define FLOW_CONTROL_PORT_PIN						PIND
+#define FLOW_CONTROL_RTS_PIN						(1<<4)
+#define FLOW_CONTROL_CTS_PIN						(1<<5)
+#define FLOW_CONTROL_CTS_PIN_CHANGE_MASK			PCMSK3
+#define PIN_CHANGE_INTERRUPT_3_ENABLE				0x08
+#define RX_FLOW_STOP_LEVEL							(MAXIMUM_RX_BUFFER_SIZE - 32)
+#define RX_FLOW_START_LEVEL							(MAXIMUM_RX_BUFFER_SIZE / 4)
+#elif (SRL_FLOW_CONTROL != SRL_FLOW_CONTROL_NONE)
+#error "unknown SRL_FLOW_CONTROL"
+#endif
 
-// transmit variables
-static unsigned char srl_transmit_data_buffer[MAXIMUM_TX_BUFFER_SIZE];
-static unsigned short srl_transmit_input_index;
-static unsigned short srl_transmit_output_index;
-static unsigned short srl_transmit_bytes_in_buffer;
+// the rs-485 driver enable output, on a spare port d pin next to port 1's 
+// rx and tx pins, high while driving the bus
+#if (SRL_RS485 == SRL_RS485_PORT_1)
+#define RS485_SERIAL_PORT							SRL_PORT_1
+#define RS485_PORT									PORTD
+#define RS485_PORT_DDR								DDRD
+#define RS485_DRIVER_ENABLE_PIN						(1<<6)
+#elif (SRL_RS485 != SRL_RS485_NONE)
+#error "unknown SRL_RS485"
+#endif
 
-static unsigned char srl_index_of_task_to_signal_on_rx = NO_TASK;
+// the address filter's place in the packet on the bus. Bytes are only kept 
+// once the address is known so the start byte is held back until then. A 
+// gap longer than any within a packet means the last one was cut short and 
+// the filter starts hunting again, the gap is timed with the 16 bit 
+// timestamp so only gaps under 65ms are seen.
+#define ADDRESS_FILTER_HUNTING						0
+#define ADDRESS_FILTER_ADDRESS						1
+#define ADDRESS_FILTER_LENGTH						2
+#define ADDRESS_FILTER_BODY							3
+#define ADDRESS_FILTER_IDLE_RESET_US				10000
 
-// name:	SRL_Init
-// Desc:	Module initialisation function sets up serial port.
-void SRL_Init(void)
+// one receive time is kept, for the first byte matching the byte to timestamp 
+// once armed. The receiver arms it again once it has finished with the last 
+// packet so bytes inside a packet which match never use it.
+#define RX_TIMESTAMP_IDLE							0
+#define RX_TIMESTAMP_ARMED							1
+#define RX_TIMESTAMP_TAKEN							2
+
+typedef struct
+{
+	unsigned long time_us;
+	unsigned char buffer_index;
+}SRL_RX_TIMESTAMP;
+
+typedef struct
+{
+	const unsigned char *data_ptr;
+	unsigned short data_length;
+	unsigned char task_to_signal_when_sent;
+	Boolean in_transmit_buffer;
+}SRL_TX_DESCRIPTOR;
+
+// the registers of each usart
+typedef struct
 {
-	// clear the buffers
-	memset((void*)&srl_receive_data_buffer, 0, MAXIMUM_RX_BUFFER_SIZE);
-	memset((void*)&srl_transmit_data_buffer, 0, MAXIMUM_TX_BUFFER_SIZE);
+	volatile unsigned char *ucsra_ptr;
+	volatile unsigned char *ucsrb_ptr;
+	volatile unsigned char *ucsrc_ptr;
+	volatile unsigned char *ubrrh_ptr;
+	volatile unsigned char *ubrrl_ptr;
+	volatile unsigned char *udr_ptr;
+}SRL_PORT_REGISTERS;
+
+// the buffers and state of each port
+typedef struct
+{
+	// receive variables, the head is owned by the rx interrupt and the tail by the task
+	unsigned char receive_data_buffer[MAXIMUM_RX_BUFFER_SIZE];
+	volatile unsigned char receive_head;
+	volatile unsigned char receive_tail;
 	//
-	srl_receive_input_index = 0;
-	srl_receive_output_index = 0;
-	srl_receive_bytes_in_buffer = 0;
+	// transmit variables, the heads are owned by the task and the tails by the udre interrupt
+	unsigned char transmit_data_buffer[MAXIMUM_TX_BUFFER_SIZE];
+	volatile unsigned char transmit_head;
+	volatile unsigned char transmit_tail;
+	SRL_TX_DESCRIPTOR transmit_descriptors[MAX_TX_DESCRIPTORS];
+	volatile unsigned char transmit_descriptors_head;
+	volatile unsigned char transmit_descriptors_tail;
 	//
-	srl_transmit_input_index = 0;
-	srl_transmit_output_index = 0;
-	srl_transmit_bytes_in_buffer = 0;
+	// the part of the oldest descriptor still to send, only used by the udre interrupt
+	const unsigned char *transmit_fragment_ptr;
+	unsigned short transmit_fragment_bytes_left;
 	//
-	// set up the serial port for 115200-8-n-1
-	UCSR0A = DOUBLE_UART_TRANSMISSION_SPEED;
+	unsigned char index_of_task_to_signal_on_rx;
+	volatile Boolean receive_task_signalled;
+	volatile unsigned char index_of_task_to_signal_on_tx_space;
+	unsigned char tx_space_wanted;
 	//
-	UCSR0B = UART_RX_INTERRUPT_ENABLE | 
-				RECEIVER_ENABLE | TRANSMITTER_ENABLE;
+	// receive timestamp variables
+	SRL_RX_TIMESTAMP rx_timestamp;
+	volatile unsigned char rx_timestamp_state;
+	unsigned char byte_to_timestamp;
 	//
-	UCSR0C = EIGHT_DATA_BITS;
+	// a new baud rate is held here until the transmit complete interrupt finds
+	// everything queued at the old rate has gone
+	volatile SRL_BAUD_RATE baud_rate;
 	//
-	UBRR0H = GET_16_BIT_MSB(BAUD_RATE_115200);
-	UBRR0L = GET_16_BIT_LSB(BAUD_RATE_115200);
-}
+	// set by the transmit complete interrupt once the last byte has gone, as 
+	// the interrupt clears the flag it was called for
+	volatile Boolean transmitter_idle;
+	//
+	// address filter variables, only the rx interrupt uses them once set
+	Boolean address_filter_enabled;
+	SRL_ADDRESS_FILTER address_filter;
+	unsigned char address_filter_state;
+	Boolean address_filter_keeping;
+	unsigned short address_filter_bytes_left;
+	unsigned short address_filter_last_byte_time_us;
+	unsigned long address_filter_start_time_us;
+}SRL_PORT_STATE;
+
+#define SRL_PORT_0_REGISTERS						{ &UCSR0A, &UCSR0B, &UCSR0C, &UBRR0H, &UBRR0L, &UDR0 }
+#define SRL_PORT_1_REGISTERS						{ &UCSR1A, &UCSR1B, &UCSR1C, &UBRR1H, &UBRR1L, &UDR1 }
+
+// the tasks read the port's registers from flash, the interrupts are inlined 
+// with the port known so they pick theirs out at compile time instead
+static const SRL_PORT_REGISTERS srl_port_registers[NUMBER_OF_SRL_PORTS] PROGMEM =
+{
+	SRL_PORT_0_REGISTERS,
+	SRL_PORT_1_REGISTERS
+};
+
+#define GET_PORT_REGISTER(port, register_ptr)		((volatile unsigned char *)pgm_read_word(&srl_port_registers[(port)].register_ptr))
+#define GET_ISR_PORT_REGISTERS(port)				((SRL_PORT_0 == (port)) ? (SRL_PORT_REGISTERS)SRL_PORT_0_REGISTERS : (SRL_PORT_REGISTERS)SRL_PORT_1_REGISTERS)
+
+static SRL_PORT_STATE srl_ports[NUMBER_OF_SRL_PORTS];
 
-// name:	SRL_Add_data_to_transmit_buffer
-// Desc:	adds data bytes to the transmit buffer.
-void SRL_Add_data_to_transmit_buffer(const unsigned char *data_to_add_ptr, unsigned short data_length)
+static const unsigned char srl_baud_rate_ubrr[NUMBER_OF_SRL_BAUD_RATES] PROGMEM = 
 {
-	int i;
+	UBRR_115200,
+	UBRR_250000,
+	UBRR_500000,
+	UBRR_1000000
+};
+
+static inline unsigned char get_transmit_buffer_space(const SRL_PORT_STATE *port_ptr);
+static inline unsigned char get_transmit_descriptors_free(const SRL_PORT_STATE *port_ptr);
+static inline unsigned char get_transmit_write_space(const SRL_PORT_STATE *port_ptr);
+static unsigned char copy_data_to_transmit_buffer(SRL_PORT_STATE *port_ptr, const unsigned char *data_to_add_ptr, unsigned short data_length);
+static inline void check_transmit_space_wanted(SRL_PORT_STATE *port_ptr);
+// the interrupt bodies are shared by the ports and always inlined, so with the
+// port known each interrupt uses its own registers directly rather than 
+// looking them up. They still call the statistics, clock and schedular.
+static inline void receive_interrupt(SRL_PORT port) __attribute__((always_inline));
+static inline void filter_received_byte(SRL_PORT port, unsigned char received_byte) __attribute__((always_inline));
+static inline void buffer_received_byte(SRL_PORT port, unsigned char received_byte, const unsigned long *receive_time_us_ptr) __attribute__((always_inline));
+static inline void data_register_empty_interrupt(SRL_PORT port) __attribute__((always_inline));
+static inline void transmit_complete_interrupt(SRL_PORT port) __attribute__((always_inline));
+
+// name:	SRL_Init
+// Desc:	Module initialisation function sets up the serial ports.
+void SRL_Init(void)
+{
+	SRL_PORT_REGISTERS registers;
+	const SRL_PORT_REGISTERS *registers_ptr = &registers;
+	SRL_PORT_STATE *port_ptr;
+	unsigned char port;
 	
-	// disable interrupts while we add data to the tx buffer
-	cli();
+	for(port = 0; port < NUMBER_OF_SRL_PORTS; port++)
+	{
+		memcpy_P((void*)&registers, (const void*)&srl_port_registers[port], sizeof(SRL_PORT_REGISTERS));
+		port_ptr = &srl_ports[port];
+		//
+		// clear the buffers
+		memset((void*)port_ptr, 0, sizeof(SRL_PORT_STATE));
+		//
+		port_ptr->index_of_task_to_signal_on_rx = NO_TASK;
+		port_ptr->receive_task_signalled = False;
+		port_ptr->index_of_task_to_signal_on_tx_space = NO_TASK;
+		port_ptr->rx_timestamp_state = RX_TIMESTAMP_IDLE;
+		//
+		// set up the serial port for 115200-8-n-1
+		port_ptr->baud_rate = SRL_DEFAULT_BAUD_RATE;
+		port_ptr->transmitter_idle = True;
+		*registers_ptr->ucsra_ptr = DOUBLE_UART_TRANSMISSION_SPEED;
+		//
+		*registers_ptr->ucsrb_ptr = UART_RX_INTERRUPT_ENABLE |
+										RECEIVER_ENABLE | TRANSMITTER_ENABLE;
+		//
+		*registers_ptr->ucsrc_ptr = EIGHT_DATA_BITS;
+		//
+		*registers_ptr->ubrrh_ptr = 0;
+		*registers_ptr->ubrrl_ptr = pgm_read_byte(&srl_baud_rate_ubrr[SRL_DEFAULT_BAUD_RATE]);
+	}
+#if (SRL_RS485 == SRL_RS485_PORT_1)
+	//
+	// the driver starts off so the bus is left to the other nodes
+	RS485_PORT &= ~RS485_DRIVER_ENABLE_PIN;
+	RS485_PORT_DDR |= RS485_DRIVER_ENABLE_PIN;
+#endif
+#if (SRL_FLOW_CONTROL == SRL_FLOW_CONTROL_RTS_CTS)
+	//
+	// RTS starts low so the host can send, CTS is pulled up so nothing is sent 
+	// unless a host is there to allow it, and any change of CTS interrupts
+	FLOW_CONTROL_PORT &= ~FLOW_CONTROL_RTS_PIN;
+	FLOW_CONTROL_PORT_DDR |= FLOW_CONTROL_RTS_PIN;
+	FLOW_CONTROL_PORT_DDR &= ~FLOW_CONTROL_CTS_PIN;
+	FLOW_CONTROL_PORT |= FLOW_CONTROL_CTS_PIN;
+	//
+	FLOW_CONTROL_CTS_PIN_CHANGE_MASK |= FLOW_CONTROL_CTS_PIN;
+	PCICR |= PIN_CHANGE_INTERRUPT_3_ENABLE;
+#endif
+}
+
+// name:	SRL_Set_baud_rate
+// Desc:	changes the baud rate straight away if the transmitter is idle, 
+//			otherwise once everything queued has been sent. The transmit 
+//			complete interrupt makes a deferred change so the last byte at the 
+//			old rate isn't cut short.
+void SRL_Set_baud_rate(SRL_PORT port, SRL_BAUD_RATE baud_rate)
+{
+	SRL_PORT_REGISTERS registers;
+	const SRL_PORT_REGISTERS *registers_ptr = &registers;
+	SRL_PORT_STATE *port_ptr = &srl_ports[port];
+	unsigned char saved_sreg;
 	
-	// add the data to the transmit buffer
-	for(i = 0; i < data_length; i++)
+	if(NUMBER_OF_SRL_BAUD_RATES > baud_rate)
 	{
-		srl_transmit_data_buffer[srl_transmit_input_index++] = *(data_to_add_ptr + i);
+		memcpy_P((void*)&registers, (const void*)&srl_port_registers[port], sizeof(SRL_PORT_REGISTERS));
+		//
+		saved_sreg = SREG;
+		cli();
 		//
-		if(MAXIMUM_TX_BUFFER_SIZE == srl_transmit_input_index)
+		port_ptr->baud_rate = baud_rate;
+		//
+		// idle is nothing queued, nothing in the data register and the last byte 
+		// out of the shift register, either flagged by the uart or, if the 
+		// transmit complete interrupt has already taken the flag, by the interrupt
+		if((0 == port_ptr->transmit_fragment_bytes_left) && (port_ptr->transmit_descriptors_head == port_ptr->transmit_descriptors_tail) &&
+			(0 != (*registers_ptr->ucsra_ptr & DATA_REGISTER_EMPTY)) &&
+			((True == port_ptr->transmitter_idle) || (0 != (*registers_ptr->ucsra_ptr & TRANSMIT_COMPLETE))))
 		{
-			srl_transmit_input_index = 0;	
+			*registers_ptr->ubrrl_ptr = pgm_read_byte(&srl_baud_rate_ubrr[baud_rate]);
 		}
+		else
+		{
+			*registers_ptr->ucsrb_ptr |= UART_TX_COMPLETE_INTERRUPT_ENABLE;
+		}
+		//
+		SREG = saved_sreg;
+	}
+}
+
+// name:	SRL_Get_baud_rate
+// Desc:	returns the baud rate the port is running at, or will be once 
+//			a change has been made.
+SRL_BAUD_RATE SRL_Get_baud_rate(SRL_PORT port)
+{
+	return srl_ports[port].baud_rate;
+}
+
+// name:	SRL_Write_data_to_transmit_buffer
+// Desc:	copies as many of the data bytes as there is room for into the tx 
+//			buffer without waiting and returns how many were taken.
+unsigned short SRL_Write_data_to_transmit_buffer(SRL_PORT port, const unsigned char *data_to_add_ptr, unsigned short data_length)
+{
+	SRL_PORT_STATE *port_ptr = &srl_ports[port];
+	unsigned short bytes_written = 0;
+	unsigned char bytes_copied;
+	
+	// the free space can be split by the end of the buffer so copy up to twice
+	do
+	{
+		bytes_copied = copy_data_to_transmit_buffer(port_ptr, &data_to_add_ptr[bytes_written], (data_length - bytes_written));
+		bytes_written += bytes_copied;
 	}
+	while((0 != bytes_copied) && (bytes_written < data_length));
 	//
-	// if this is the first data then start sending it
-	if(0 == srl_transmit_bytes_in_buffer)
+	if(0 != bytes_written)
 	{
-		// add data to the tx buffer
-		UDR0 = srl_transmit_data_buffer[srl_transmit_output_index];
+		*GET_PORT_REGISTER(port, ucsrb_ptr) |= UART_DATA_REGISTER_EMPTY_INTERRUPT_ENABLE;
 		//
-		// and enable the data register empty interrupt
-		UCSR0B |= UART_DATA_REGISTER_EMPTY_INTERRUPT_ENABLE;
+		STS_UPDATE_HIGH_WATER(STS_HIGH_WATER_TX_BUFFER, ((port_ptr->transmit_head - port_ptr->transmit_tail) & TX_BUFFER_MASK));
 	}
-	//
-	// add these bytes to the bytes in transmit buffer
-	srl_transmit_bytes_in_buffer += data_length;
-	//
-	// re enable interrupts
-	sei();
+	
+	return bytes_written;
 }
 
-// name:	SRL_Get_data_byte_from_receive_buffer
-// Desc:	returns a single byte from the recieve buffer.
-unsigned char SRL_Get_data_byte_from_receive_buffer(void)
+// name:	SRL_Get_transmit_buffer_space
+// Desc:	returns how many bytes can be written to the tx buffer right now.
+unsigned char SRL_Get_transmit_buffer_space(SRL_PORT port)
 {
-	unsigned char next_byte;
+	return get_transmit_write_space(&srl_ports[port]);
+}
+
+// name:	SRL_Set_task_to_signal_on_tx_space
+// Desc:	signals the task once, as soon as the passed number of bytes can 
+//			be written to the tx buffer. A producer which finds the buffer 
+//			full uses this to carry on later instead of waiting. Passing 
+//			NO_TASK cancels it.
+void SRL_Set_task_to_signal_on_tx_space(SRL_PORT port, unsigned char index_of_task_to_signal, unsigned char bytes_wanted)
+{
+	SRL_PORT_STATE *port_ptr = &srl_ports[port];
+	unsigned char saved_sreg;
 	
-	// disable interrupts while we remove data from the buffer
+	// never ask for more than the buffer can hold or the task would never run
+	if(bytes_wanted > (MAXIMUM_TX_BUFFER_SIZE - 1))
+	{
+		bytes_wanted = MAXIMUM_TX_BUFFER_SIZE - 1;
+	}
+	//
+	// the udre interrupt signals the task so hold it off while both are changed
+	saved_sreg = SREG;
 	cli();
 	//
-	next_byte = srl_receive_data_buffer[srl_receive_output_index];
+	if((NO_TASK != index_of_task_to_signal) && (get_transmit_write_space(port_ptr) >= bytes_wanted))
+	{
+		SCH_Signal_task(index_of_task_to_signal, DATA_TRIGGERED);
+		port_ptr->index_of_task_to_signal_on_tx_space = NO_TASK;
+	}
+	else
+	{
+		port_ptr->index_of_task_to_signal_on_tx_space = index_of_task_to_signal;
+		port_ptr->tx_space_wanted = bytes_wanted;
+	}
 	//
-	// if if there is more data in the buffer then adjust the index's
-	if(srl_receive_bytes_in_buffer != 0)
+	SREG = saved_sreg;
+}
+
+// name:	SRL_Queue_data_to_transmit
+// Desc:	queues the fragments to be sent in order straight from the caller's 
+//			buffers, without copying them. The task is signalled once the last 
+//			byte has gone to the uart, after which the buffers can be reused. 
+//			Either all of the fragments are queued or, if there aren't enough 
+//			descriptors free, none of them are and False is returned.
+Boolean SRL_Queue_data_to_transmit(SRL_PORT port, const SRL_TX_FRAGMENT *fragment_ptr, unsigned char number_of_fragments, unsigned char task_to_signal_when_sent)
+{
+	SRL_PORT_STATE *port_ptr = &srl_ports[port];
+	SRL_TX_DESCRIPTOR *descriptor_ptr = NULL;
+	Boolean fragments_queued = False;
+	unsigned char head;
+	unsigned char i;
+	
+	if(number_of_fragments <= get_transmit_descriptors_free(port_ptr))
 	{
-		srl_receive_bytes_in_buffer--;
+		head = port_ptr->transmit_descriptors_head;
 		//
-		srl_receive_output_index++;
+		// empty fragments are skipped as the interrupt has nothing to send for them
+		for(i = 0; i < number_of_fragments; i++)
+		{
+			if(0 != fragment_ptr[i].data_length)
+			{
+				descriptor_ptr = &port_ptr->transmit_descriptors[head];
+				descriptor_ptr->data_ptr = fragment_ptr[i].data_ptr;
+				descriptor_ptr->data_length = fragment_ptr[i].data_length;
+				descriptor_ptr->task_to_signal_when_sent = NO_TASK;
+				descriptor_ptr->in_transmit_buffer = False;
+				//
+				head = (head + 1) & TX_DESCRIPTORS_MASK;
+			}
+		}
 		//
-		if(MAXIMUM_RX_BUFFER_SIZE == srl_receive_output_index)
+		// the task goes on the last descriptor, or if there is nothing to send it can be signalled now
+		if(NULL == descriptor_ptr)
 		{
-			srl_receive_output_index = 0;
+			SCH_Signal_task(task_to_signal_when_sent, DATA_TRIGGERED);
 		}
+		else
+		{
+			descriptor_ptr->task_to_signal_when_sent = task_to_signal_when_sent;
+		}
+		//
+		// hand the whole set to the interrupt at once and start sending
+		port_ptr->transmit_descriptors_head = head;
+		*GET_PORT_REGISTER(port, ucsrb_ptr) |= UART_DATA_REGISTER_EMPTY_INTERRUPT_ENABLE;
+		//
+		fragments_queued = True;
 	}
+	
+	return fragments_queued;
+}
+
+// name:	SRL_Get_data_byte_from_receive_buffer
+// Desc:	returns a single byte from the recieve buffer.
+unsigned char SRL_Get_data_byte_from_receive_buffer(SRL_PORT port)
+{
+	SRL_PORT_STATE *port_ptr = &srl_ports[port];
+	unsigned char next_byte;
+	
+	next_byte = port_ptr->receive_data_buffer[port_ptr->receive_tail];
 	//
-	// re-enable interrupts 
-	sei();
+	// if there is more data in the buffer then move the tail
+	if(port_ptr->receive_head != port_ptr->receive_tail)
+	{
+		SRL_Commit_received_bytes(port, 1);
+	}
 	//
 	return next_byte;
 }
 
+// name:	SRL_Peek_receive_span
+// Desc:	points to the bytes in the rx buffer starting the passed number of 
+//			bytes in and returns how many can be read from there without 
+//			wrapping, 0 if there are none. The bytes stay in the buffer until 
+//			they are committed, and any which arrive meanwhile are picked up 
+//			by the next peek.
+unsigned char SRL_Peek_receive_span(SRL_PORT port, unsigned char byte_offset, const unsigned char **span_ptr_ptr)
+{
+	SRL_PORT_STATE *port_ptr = &srl_ports[port];
+	unsigned char head;
+	unsigned char start;
+	unsigned char span_length;
+	
+	start = (port_ptr->receive_tail + byte_offset) & RX_BUFFER_MASK;
+	head = port_ptr->receive_head;
+	//
+	// once the task has caught up the next byte received signals it again, the 
+	// head is read again in case a byte arrived before the rx interrupt could see that
+	if(head == start)
+	{
+		port_ptr->receive_task_signalled = False;
+		head = port_ptr->receive_head;
+	}
+	//
+	// read up to the head, or to the end of the buffer if the head has wrapped
+	if(head >= start)
+	{
+		span_length = head - start;
+	}
+	else
+	{
+		span_length = MAXIMUM_RX_BUFFER_SIZE - start;
+	}
+	//
+	*span_ptr_ptr = &port_ptr->receive_data_buffer[start];
+	
+	return span_length;
+}
+
+// name:	SRL_Commit_received_bytes
+// Desc:	releases bytes from the start of the rx buffer once they have been 
+//			read, the number must not be more than the last span peeked.
+void SRL_Commit_received_bytes(SRL_PORT port, unsigned char number_of_bytes)
+{
+	SRL_PORT_STATE *port_ptr = &srl_ports[port];
+	unsigned char tail;
+	
+	tail = port_ptr->receive_tail;
+	//
+	// drop the timestamp if its byte is released, the interrupt leaves a 
+	// taken timestamp alone until it is armed again
+	if((RX_TIMESTAMP_TAKEN == port_ptr->rx_timestamp_state) &&
+		(((port_ptr->rx_timestamp.buffer_index - tail) & RX_BUFFER_MASK) < number_of_bytes))
+	{
+		port_ptr->rx_timestamp_state = RX_TIMESTAMP_IDLE;
+	}
+	//
+	// only release the bytes once they have been read
+	port_ptr->receive_tail = (tail + number_of_bytes) & RX_BUFFER_MASK;
+#if (SRL_FLOW_CONTROL == SRL_FLOW_CONTROL_RTS_CTS)
+	//
+	// let the host carry on once there is plenty of room again
+	if((FLOW_CONTROL_SERIAL_PORT == port) &&
+		(((port_ptr->receive_head - port_ptr->receive_tail) & RX_BUFFER_MASK) <= RX_FLOW_START_LEVEL))
+	{
+		FLOW_CONTROL_PORT &= ~FLOW_CONTROL_RTS_PIN;
+	}
+#endif
+}
+
+// name:	SRL_Get_receive_timestamp
+// Desc:	gets the microsecond clock time at which the byte the passed number 
+//			of bytes into the rx buffer was received. Returns False if it 
+//			wasn't timestamped, either because it doesn't match the byte to 
+//			timestamp or because it arrived before the timestamp was armed.
+Boolean SRL_Get_receive_timestamp(SRL_PORT port, unsigned char byte_offset, unsigned long *timestamp_us_ptr)
+{
+	SRL_PORT_STATE *port_ptr = &srl_ports[port];
+	Boolean byte_timestamped = False;
+	
+	// once taken the interrupt doesn't touch the timestamp until it is armed again
+	if((RX_TIMESTAMP_TAKEN == port_ptr->rx_timestamp_state) &&
+		(((port_ptr->rx_timestamp.buffer_index - port_ptr->receive_tail) & RX_BUFFER_MASK) == byte_offset))
+	{
+		*timestamp_us_ptr = port_ptr->rx_timestamp.time_us;
+		byte_timestamped = True;
+	}
+	
+	return byte_timestamped;
+}
+
+// name:	SRL_Arm_receive_timestamp
+// Desc:	drops any timestamp taken so the next byte to timestamp received 
+//			is timestamped. Called once the bytes up to the next start of 
+//			packet are no longer of interest.
+void SRL_Arm_receive_timestamp(SRL_PORT port)
+{
+	srl_ports[port].rx_timestamp_state = RX_TIMESTAMP_ARMED;
+}
+
 // name:	SRL_Get_number_of_bytes_in_rx_buffer
 // Desc:	returns the number of bytes in the rx buffer.
-unsigned short SRL_Get_number_of_bytes_in_rx_buffer(void)
+unsigned short SRL_Get_number_of_bytes_in_rx_buffer(SRL_PORT port)
 {
-	return srl_receive_bytes_in_buffer;
+	return ((srl_ports[port].receive_head - srl_ports[port].receive_tail) & RX_BUFFER_MASK);
 }
 
 // name:	SRL_Set_task_to_signal_on_data_rx
 // Desc:	sets the task to signal when data is received.
-void SRL_Set_task_to_signal_on_data_rx(unsigned char index_of_task_to_signal)
+void SRL_Set_task_to_signal_on_data_rx(SRL_PORT port, unsigned char index_of_task_to_signal)
 {
-	srl_index_of_task_to_signal_on_rx = index_of_task_to_signal;
+	srl_ports[port].index_of_task_to_signal_on_rx = index_of_task_to_signal;
 }
 
-// name:	ISR(USART0_RX_vect)
-// Desc:	UART receive interrupt.
-ISR(USART0_RX_vect)
+// name:	SRL_Set_byte_to_timestamp
+// Desc:	the receive time is taken for the first byte matching the passed 
+//			byte, such as a start of packet byte, after each time the 
+//			timestamp is armed. This arms it for the first.
+void SRL_Set_byte_to_timestamp(SRL_PORT port, unsigned char byte_to_timestamp)
 {
+	srl_ports[port].byte_to_timestamp = byte_to_timestamp;
+	srl_ports[port].rx_timestamp_state = RX_TIMESTAMP_ARMED;
+}
+
+// name:	SRL_Set_address_filter
+// Desc:	sets the address filter for the port, or with NULL turns it off 
+//			so every byte received is kept.
+void SRL_Set_address_filter(SRL_PORT port, const SRL_ADDRESS_FILTER *address_filter_ptr)
+{
+	SRL_PORT_STATE *port_ptr = &srl_ports[port];
+	unsigned char saved_sreg;
+	
+	saved_sreg = SREG;
+	cli();
+	//
+	if(NULL == address_filter_ptr)
+	{
+		port_ptr->address_filter_enabled = False;
+	}
+	else
+	{
+		port_ptr->address_filter = *address_filter_ptr;
+		port_ptr->address_filter_state = ADDRESS_FILTER_HUNTING;
+		port_ptr->address_filter_enabled = True;
+	}
+	//
+	SREG = saved_sreg;
+}
+
+// name:	get_transmit_buffer_space
+// Desc:	returns the number of bytes free in the tx buffer.
+static inline unsigned char get_transmit_buffer_space(const SRL_PORT_STATE *port_ptr)
+{
+	return (MAXIMUM_TX_BUFFER_SIZE - 1) - ((port_ptr->transmit_head - port_ptr->transmit_tail) & TX_BUFFER_MASK);
+}
+
+// name:	get_transmit_descriptors_free
+// Desc:	returns the number of descriptors which can be queued.
+static inline unsigned char get_transmit_descriptors_free(const SRL_PORT_STATE *port_ptr)
+{
+	return (MAX_TX_DESCRIPTORS - 1) - ((port_ptr->transmit_descriptors_head - port_ptr->transmit_descriptors_tail) & TX_DESCRIPTORS_MASK);
+}
+
+// name:	get_transmit_write_space
+// Desc:	returns the number of bytes which can be copied into the tx buffer, 
+//			space which wraps round the end of the buffer needs a second 
+//			descriptor for the part at the start.
+static inline unsigned char get_transmit_write_space(const SRL_PORT_STATE *port_ptr)
+{
+	unsigned char write_space;
+	unsigned char descriptors_free;
+	
+	write_space = get_transmit_buffer_space(port_ptr);
+	descriptors_free = get_transmit_descriptors_free(port_ptr);
+	//
+	if(0 == descriptors_free)
+	{
+		write_space = 0;
+	}
+	else if((1 == descriptors_free) && (write_space > (MAXIMUM_TX_BUFFER_SIZE - port_ptr->transmit_head)))
+	{
+		write_space = MAXIMUM_TX_BUFFER_SIZE - port_ptr->transmit_head;
+	}
+	
+	return write_space;
+}
+
+// name:	copy_data_to_transmit_buffer
+// Desc:	copies as much of the data as fits before the end of the tx buffer 
+//			and queues a descriptor for it, returns the number of bytes copied.
+static unsigned char copy_data_to_transmit_buffer(SRL_PORT_STATE *port_ptr, const unsigned char *data_to_add_ptr, unsigned short data_length)
+{
+	SRL_TX_DESCRIPTOR *descriptor_ptr;
+	unsigned char head;
+	unsigned char bytes_to_copy = 0;
+	
+	if(0 != get_transmit_descriptors_free(port_ptr))
+	{
+		head = port_ptr->transmit_head;
+		bytes_to_copy = get_transmit_buffer_space(port_ptr);
+		//
+		if(bytes_to_copy > (MAXIMUM_TX_BUFFER_SIZE - head))
+		{
+			bytes_to_copy = MAXIMUM_TX_BUFFER_SIZE - head;
+		}
+		//
+		if(data_length < bytes_to_copy)
+		{
+			bytes_to_copy = (unsigned char)data_length;
+		}
+		//
+		if(0 != bytes_to_copy)
+		{
+			memcpy((void*)&port_ptr->transmit_data_buffer[head], (const void*)data_to_add_ptr, bytes_to_copy);
+			port_ptr->transmit_head = (head + bytes_to_copy) & TX_BUFFER_MASK;
+			//
+			descriptor_ptr = &port_ptr->transmit_descriptors[port_ptr->transmit_descriptors_head];
+			descriptor_ptr->data_ptr = &port_ptr->transmit_data_buffer[head];
+			descriptor_ptr->data_length = bytes_to_copy;
+			descriptor_ptr->task_to_signal_when_sent = NO_TASK;
+			descriptor_ptr->in_transmit_buffer = True;
+			//
+			// only move the head once the descriptor is filled in
+			port_ptr->transmit_descriptors_head = (port_ptr->transmit_descriptors_head + 1) & TX_DESCRIPTORS_MASK;
+		}
+	}
+	
+	return bytes_to_copy;
+}
+
+// name:	check_transmit_space_wanted
+// Desc:	called from the udre interrupt as space is freed, signals the task 
+//			waiting for tx space once there is enough.
+static inline void check_transmit_space_wanted(SRL_PORT_STATE *port_ptr)
+{
+	if((NO_TASK != port_ptr->index_of_task_to_signal_on_tx_space) && (get_transmit_write_space(port_ptr) >= port_ptr->tx_space_wanted))
+	{
+		SCH_Signal_task(port_ptr->index_of_task_to_signal_on_tx_space, DATA_TRIGGERED);
+		port_ptr->index_of_task_to_signal_on_tx_space = NO_TASK;
+	}
+}
+
+// name:	receive_interrupt
+// Desc:	UART receive interrupt for the port.
+static inline void receive_interrupt(SRL_PORT port)
+{
+	const SRL_PORT_REGISTERS registers = GET_ISR_PORT_REGISTERS(port);
+	const SRL_PORT_REGISTERS *registers_ptr = &registers;
+	SRL_PORT_STATE *port_ptr = &srl_ports[port];
 	unsigned char received_byte;
 	unsigned char receiver_status;
 	
 	// get status and received byte 
-	receiver_status = UCSR0A;
-	received_byte = UDR0;
+	receiver_status = *registers_ptr->ucsra_ptr;
+	received_byte = *registers_ptr->udr_ptr;
+	//
+	// only add the byte to software buffer if there are no errors, a bad 
+	// byte also loses the address filter its place in the packet
+	if(NO_SERIAL_ERRORS != (receiver_status & ANY_SERIAL_ERRORS))
+	{
+		STS_INCREMENT_COUNTER(STS_COUNTER_RX_BYTES_WITH_ERRORS);
+		port_ptr->address_filter_state = ADDRESS_FILTER_HUNTING;
+	}
+	else if(True == port_ptr->address_filter_enabled)
+	{
+		filter_received_byte(port, received_byte);
+	}
+	else
+	{
+		buffer_received_byte(port, received_byte, NULL);
+	}
+}
+
+// name:	filter_received_byte
+// Desc:	follows the packets on the bus a byte at a time, keeping those for 
+//			this node or everyone and dropping the rest.
+static inline void filter_received_byte(SRL_PORT port, unsigned char received_byte)
+{
+	SRL_PORT_STATE *port_ptr = &srl_ports[port];
+	unsigned short time_now_us;
+	
+	time_now_us = CLK_Get_timestamp_us();
 	//
-	// only add the byte to software buffer if there are no errors
-	if(NO_SERIAL_ERRORS == (receiver_status & ANY_SERIAL_ERRORS))
+	if((unsigned short)(time_now_us - port_ptr->address_filter_last_byte_time_us) > ADDRESS_FILTER_IDLE_RESET_US)
 	{
-		srl_receive_data_buffer[srl_receive_input_index++] = received_byte;
-		srl_receive_bytes_in_buffer++;
+		port_ptr->address_filter_state = ADDRESS_FILTER_HUNTING;
+	}
+	//
+	port_ptr->address_filter_last_byte_time_us = time_now_us;
+	//
+	switch(port_ptr->address_filter_state)
+	{
+		case ADDRESS_FILTER_HUNTING:
+			//
+			// the start byte isn't kept until the address is known so note when it arrived now
+			if(port_ptr->address_filter.start_byte == received_byte)
+			{
+				if((RX_TIMESTAMP_ARMED == port_ptr->rx_timestamp_state) && (port_ptr->byte_to_timestamp == received_byte))
+				{
+					port_ptr->address_filter_start_time_us = CLK_Get_time_us();
+				}
+				//
+				port_ptr->address_filter_state = ADDRESS_FILTER_ADDRESS;
+			}
+			//
+			break;
+		case ADDRESS_FILTER_ADDRESS:
+			//
+			port_ptr->address_filter_keeping = ((port_ptr->address_filter.address == received_byte) ||
+												(port_ptr->address_filter.broadcast_address == received_byte));
+			//
+			if(True == port_ptr->address_filter_keeping)
+			{
+				buffer_received_byte(port, port_ptr->address_filter.start_byte, &port_ptr->address_filter_start_time_us);
+				buffer_received_byte(port, received_byte, NULL);
+			}
+			//
+			port_ptr->address_filter_state = ADDRESS_FILTER_LENGTH;
+			break;
+		case ADDRESS_FILTER_LENGTH:
+			//
+			if(True == port_ptr->address_filter_keeping)
+			{
+				buffer_received_byte(port, received_byte, NULL);
+			}
+			//
+			port_ptr->address_filter_bytes_left = received_byte + port_ptr->address_filter.bytes_after_length;
+			port_ptr->address_filter_state = ADDRESS_FILTER_BODY;
+			break;
+		default:
+			//
+			if(True == port_ptr->address_filter_keeping)
+			{
+				buffer_received_byte(port, received_byte, NULL);
+			}
+			//
+			if(0 == --port_ptr->address_filter_bytes_left)
+			{
+				port_ptr->address_filter_state = ADDRESS_FILTER_HUNTING;
+			}
+			break;
+	}
+}
+
+// name:	buffer_received_byte
+// Desc:	adds a received byte to the rx buffer if there is space for it. A 
+//			byte to timestamp is given the passed receive time, or with NULL 
+//			the time now.
+static inline void buffer_received_byte(SRL_PORT port, unsigned char received_byte, const unsigned long *receive_time_us_ptr)
+{
+	SRL_PORT_STATE *port_ptr = &srl_ports[port];
+	unsigned char head;
+	unsigned char next_head;
+	
+	head = port_ptr->receive_head;
+	next_head = (head + 1) & RX_BUFFER_MASK;
+	//
+	if(next_head == port_ptr->receive_tail)
+	{
+		STS_INCREMENT_COUNTER(STS_COUNTER_RX_BUFFER_OVERFLOWS);
+	}
+	else
+	{
+		// note when this byte arrived if it is the one to timestamp
+		if((RX_TIMESTAMP_ARMED == port_ptr->rx_timestamp_state) && (port_ptr->byte_to_timestamp == received_byte))
+		{
+			port_ptr->rx_timestamp.time_us = (NULL == receive_time_us_ptr) ? CLK_Get_time_us() : *receive_time_us_ptr;
+			port_ptr->rx_timestamp.buffer_index = head;
+			port_ptr->rx_timestamp_state = RX_TIMESTAMP_TAKEN;
+		}
 		//
-		// if there is a task to trigger and this is the 1st byte then trigger the task
-		if((NO_TASK != srl_index_of_task_to_signal_on_rx)&&
-			(1 == srl_receive_bytes_in_buffer))
+		port_ptr->receive_data_buffer[head] = received_byte;
+		port_ptr->receive_head = next_head;
+		//
+		STS_UPDATE_HIGH_WATER(STS_HIGH_WATER_RX_BUFFER, ((next_head - port_ptr->receive_tail) & RX_BUFFER_MASK));
+#if (SRL_FLOW_CONTROL == SRL_FLOW_CONTROL_RTS_CTS)
+		//
+		// ask the host to stop before the buffer fills
+		if((FLOW_CONTROL_SERIAL_PORT == port) &&
+			(((next_head - port_ptr->receive_tail) & RX_BUFFER_MASK) >= RX_FLOW_STOP_LEVEL))
 		{
-			SCH_Signal_task(srl_index_of_task_to_signal_on_rx, DATA_TRIGGERED);		
+			FLOW_CONTROL_PORT |= FLOW_CONTROL_RTS_PIN;
 		}
+#endif
 		//
-		if(MAXIMUM_RX_BUFFER_SIZE == srl_receive_input_index)
+		// if there is a task to trigger and it hasn't been already then trigger the 
+		// task, it keeps going until a peek finds it has caught up with the bytes 
+		// received. The task may leave bytes in the buffer while it waits for more.
+		if((NO_TASK != port_ptr->index_of_task_to_signal_on_rx) && (False == port_ptr->receive_task_signalled))
 		{
-			srl_receive_input_index = 0;
+			port_ptr->receive_task_signalled = True;
+			SCH_Signal_task(port_ptr->index_of_task_to_signal_on_rx, DATA_TRIGGERED);
 		}
 	}
 }
 
-// name:	ISR(USART0_UDRE_vect)
-// Desc:	UART Data register empty interrupt.
-ISR(USART0_UDRE_vect)
+// name:	data_register_empty_interrupt
+// Desc:	UART Data register empty interrupt for the port, sends the queued
+//			descriptors one byte at a time.
+static inline void data_register_empty_interrupt(SRL_PORT port)
 {
-	// this byte has been transmitted so subtract bytes in buffer by 1 and move the output index
-	srl_transmit_bytes_in_buffer--;
-	srl_transmit_output_index++;
+	const SRL_PORT_REGISTERS registers = GET_ISR_PORT_REGISTERS(port);
+	const SRL_PORT_REGISTERS *registers_ptr = &registers;
+	SRL_PORT_STATE *port_ptr = &srl_ports[port];
+	unsigned char tail;
+	unsigned char task_to_signal;
+	Boolean clear_to_send = True;
+	
+#if (SRL_FLOW_CONTROL == SRL_FLOW_CONTROL_RTS_CTS)
+	// while the host holds CTS high the interrupt is turned off, the CTS pin 
+	// change interrupt turns it back on
+	if((FLOW_CONTROL_SERIAL_PORT == port) && (0 != (FLOW_CONTROL_PORT_PIN & FLOW_CONTROL_CTS_PIN)))
+	{
+		clear_to_send = False;
+	}
 	//
-	if(MAXIMUM_TX_BUFFER_SIZE == srl_transmit_output_index)
+#endif
+	tail = port_ptr->transmit_descriptors_tail;
+	//
+	// start on the next descriptor once the last one has been sent
+	if((0 == port_ptr->transmit_fragment_bytes_left) && (port_ptr->transmit_descriptors_head != tail))
 	{
-		srl_transmit_output_index = 0;
+		port_ptr->transmit_fragment_ptr = port_ptr->transmit_descriptors[tail].data_ptr;
+		port_ptr->transmit_fragment_bytes_left = port_ptr->transmit_descriptors[tail].data_length;
 	}
 	//
-	// if there are more bytes in the tx buffer then send them out
-	if(0 != srl_transmit_bytes_in_buffer)
+	// if there are more bytes to send then send the next one out
+	if((True == clear_to_send) && (0 != port_ptr->transmit_fragment_bytes_left))
 	{
-		// send the next byte out
-		UDR0 = srl_transmit_data_buffer[srl_transmit_output_index];
+#if (SRL_RS485 == SRL_RS485_PORT_1)
+		// take the bus for the first byte, the receiver is turned off so our 
+		// own bytes aren't heard and transmit complete hands the bus back
+		if((RS485_SERIAL_PORT == port) && (0 == (RS485_PORT & RS485_DRIVER_ENABLE_PIN)))
+		{
+			*registers_ptr->ucsrb_ptr = (*registers_ptr->ucsrb_ptr & ~(UART_RX_INTERRUPT_ENABLE | RECEIVER_ENABLE)) | UART_TX_COMPLETE_INTERRUPT_ENABLE;
+			RS485_PORT |= RS485_DRIVER_ENABLE_PIN;
+		}
+		//
+#endif
+		*registers_ptr->udr_ptr = *port_ptr->transmit_fragment_ptr++;
+		//
+		// clear transmit complete so it is only set once this byte has gone
+		*registers_ptr->ucsra_ptr = DOUBLE_UART_TRANSMISSION_SPEED | TRANSMIT_COMPLETE;
+		port_ptr->transmitter_idle = False;
+		//
+		// bytes copied into the tx buffer can be reused as soon as they are sent
+		if(True == port_ptr->transmit_descriptors[tail].in_transmit_buffer)
+		{
+			port_ptr->transmit_tail = (port_ptr->transmit_tail + 1) & TX_BUFFER_MASK;
+		}
+		//
+		// once the whole descriptor has gone let its owner know it can reuse the data
+		if(0 == --port_ptr->transmit_fragment_bytes_left)
+		{
+			task_to_signal = port_ptr->transmit_descriptors[tail].task_to_signal_when_sent;
+			port_ptr->transmit_descriptors_tail = (tail + 1) & TX_DESCRIPTORS_MASK;
+			//
+			if(NO_TASK != task_to_signal)
+			{
+				SCH_Signal_task(task_to_signal, DATA_TRIGGERED);
+			}
+		}
+		//
+		check_transmit_space_wanted(port_ptr);
 	}
 	else
 	{
 		// disable the UDRE interrupt
-		UCSR0B &= ~UART_DATA_REGISTER_EMPTY_INTERRUPT_ENABLE;
+		*registers_ptr->ucsrb_ptr &= ~UART_DATA_REGISTER_EMPTY_INTERRUPT_ENABLE;
+	}
+}
+
+// name:	transmit_complete_interrupt
+// Desc:	transmit complete interrupt for the port, only enabled while a
+//			baud rate change is waiting or an rs-485 port is driving the bus. 
+//			Once nothing is left to send the new rate is set and the bus is 
+//			released, if more was queued this fires again when that has gone.
+static inline void transmit_complete_interrupt(SRL_PORT port)
+{
+	const SRL_PORT_REGISTERS registers = GET_ISR_PORT_REGISTERS(port);
+	const SRL_PORT_REGISTERS *registers_ptr = &registers;
+	SRL_PORT_STATE *port_ptr = &srl_ports[port];
+	unsigned char ubrr;
+	
+	if((0 == port_ptr->transmit_fragment_bytes_left) && (port_ptr->transmit_descriptors_head == port_ptr->transmit_descriptors_tail))
+	{
+		// writing the rate restarts the baud generator so only do it for a change
+		ubrr = pgm_read_byte(&srl_baud_rate_ubrr[port_ptr->baud_rate]);
+		//
+		if(ubrr != *registers_ptr->ubrrl_ptr)
+		{
+			*registers_ptr->ubrrl_ptr = ubrr;
+		}
+		//
+		*registers_ptr->ucsrb_ptr &= ~UART_TX_COMPLETE_INTERRUPT_ENABLE;
+		port_ptr->transmitter_idle = True;
+#if (SRL_RS485 == SRL_RS485_PORT_1)
+		//
+		// the last stop bit has gone so hand the bus back and listen again
+		if(RS485_SERIAL_PORT == port)
+		{
+			RS485_PORT &= ~RS485_DRIVER_ENABLE_PIN;
+			port_ptr->address_filter_state = ADDRESS_FILTER_HUNTING;
+			*registers_ptr->ucsrb_ptr |= UART_RX_INTERRUPT_ENABLE | RECEIVER_ENABLE;
+		}
+#endif
+	}
+}
+
+// name:	ISR(USART0_RX_vect)
+// Desc:	port 0 UART receive interrupt.
+ISR(USART0_RX_vect)
+{
+	STS_TIMING_START();
+	
+	receive_interrupt(SRL_PORT_0);
+	//
+	STS_ISR_TIMING_END(STS_ISR_USART0_RX);
+}
+
+// name:	ISR(USART0_UDRE_vect)
+// Desc:	port 0 UART Data register empty interrupt.
+ISR(USART0_UDRE_vect)
+{
+	STS_TIMING_START();
+	
+	data_register_empty_interrupt(SRL_PORT_0);
+	//
+	STS_ISR_TIMING_END(STS_ISR_USART0_UDRE);
+}
+
+// name:	ISR(USART0_TX_vect)
+// Desc:	port 0 transmit complete interrupt.
+ISR(USART0_TX_vect)
+{
+	STS_TIMING_START();
+	
+	transmit_complete_interrupt(SRL_PORT_0);
+	//
+	STS_ISR_TIMING_END(STS_ISR_USART0_TX);
+}
+
+// name:	ISR(USART1_RX_vect)
+// Desc:	port 1 UART receive interrupt.
+ISR(USART1_RX_vect)
+{
+	STS_TIMING_START();
+	
+	receive_interrupt(SRL_PORT_1);
+	//
+	STS_ISR_TIMING_END(STS_ISR_USART1_RX);
+}
+
+// name:	ISR(USART1_UDRE_vect)
+// Desc:	port 1 UART Data register empty interrupt.
+ISR(USART1_UDRE_vect)
+{
+	STS_TIMING_START();
+	
+	data_register_empty_interrupt(SRL_PORT_1);
+	//
+	STS_ISR_TIMING_END(STS_ISR_USART1_UDRE);
+}
+
+// name:	ISR(USART1_TX_vect)
+// Desc:	port 1 transmit complete interrupt.
+ISR(USART1_TX_vect)
+{
+	STS_TIMING_START();
+	
+	transmit_complete_interrupt(SRL_PORT_1);
+	//
+	STS_ISR_TIMING_END(STS_ISR_USART1_TX);
+}
+#if (SRL_FLOW_CONTROL == SRL_FLOW_CONTROL_RTS_CTS)
+
+// name:	ISR(PCINT3_vect)
+// Desc:	port d pin change interrupt, restarts sending when the host 
+//			lowers CTS. The udre interrupt turns itself off again if there 
+//			is nothing to send.
+ISR(PCINT3_vect)
+{
+	STS_TIMING_START();
+	
+	if(0 == (FLOW_CONTROL_PORT_PIN & FLOW_CONTROL_CTS_PIN))
+	{
+		*GET_ISR_PORT_REGISTERS(FLOW_CONTROL_SERIAL_PORT).ucsrb_ptr |= UART_DATA_REGISTER_EMPTY_INTERRUPT_ENABLE;
 	}
-}
\ No newline at end of file
+	//
+	STS_ISR_TIMING_END(STS_ISR_PCINT3);
+}
+#endif
@@ -3,18 +3,95 @@
  *
  * Created:		10/05/2018 19:51:15
  * Author:		Graham
- * Description:	Module responsible for receiving data from the serial port
+ * Description:	Module responsible for receiving data from the serial ports
  */ 
 
 
 #ifndef SERIAL_H_
 #define SERIAL_H_
 
+#include "utilities.h"
+
+// the two usarts, each port has its own buffers and interrupts
+typedef enum
+{
+	SRL_PORT_0 = 0,
+	SRL_PORT_1,
+	NUMBER_OF_SRL_PORTS
+}SRL_PORT;
+
+// receive flow control, with RTS/CTS the RTS output is raised to ask the host 
+// to stop sending when the rx buffer is nearly full and nothing is sent while 
+// the host holds the CTS input high. XON/XOFF isn't offered as the packets 
+// are binary and use both of those byte values. Only port 0 has the lines.
+#define SRL_FLOW_CONTROL_NONE		0
+#define SRL_FLOW_CONTROL_RTS_CTS	1
+
+#ifndef SRL_FLOW_CONTROL
+#define SRL_FLOW_CONTROL			SRL_FLOW_CONTROL_NONE
+#endif
+
+// RS-485 half duplex on port 1, the transceiver's driver enable output is 
+// raised as the first byte goes to the uart and lowered by the transmit 
+// complete interrupt as soon as the last stop bit has left, handing the bus 
+// straight back. The receiver is off while driving so no node hears itself.
+#define SRL_RS485_NONE				0
+#define SRL_RS485_PORT_1			1
+
+#ifndef SRL_RS485
+#define SRL_RS485					SRL_RS485_NONE
+#endif
+
+// baud rates the port can run at, with the 8MHz clock all but the default 
+// are exact
+typedef enum
+{
+	SRL_BAUD_RATE_115200 = 0,
+	SRL_BAUD_RATE_250000,
+	SRL_BAUD_RATE_500000,
+	SRL_BAUD_RATE_1000000,
+	NUMBER_OF_SRL_BAUD_RATES
+}SRL_BAUD_RATE;
+
+#define SRL_DEFAULT_BAUD_RATE		SRL_BAUD_RATE_115200
+
+// a block of data sent straight from the caller's buffer, the buffer must be 
+// left alone until the task passed with it has been signalled
+typedef struct
+{
+	const unsigned char *data_ptr;
+	unsigned short data_length;
+}SRL_TX_FRAGMENT;
+
+// packets on a shared bus carry an address after their start byte and then a 
+// length byte, after which come the length plus a fixed number of bytes. With 
+// a filter set the receive interrupt only keeps packets for the address or 
+// the broadcast address, everything else on the bus is dropped before it 
+// reaches the rx buffer.
+typedef struct
+{
+	unsigned char start_byte;
+	unsigned char address;
+	unsigned char broadcast_address;
+	unsigned char bytes_after_length;
+}SRL_ADDRESS_FILTER;
+
 void SRL_Init(void);
+void SRL_Set_baud_rate(SRL_PORT port, SRL_BAUD_RATE baud_rate);
+SRL_BAUD_RATE SRL_Get_baud_rate(SRL_PORT port);
 
-void SRL_Add_data_to_transmit_buffer(const unsigned char *data_to_add_ptr, unsigned short data_length);
-unsigned char SRL_Get_data_byte_from_receive_buffer(void);
-unsigned short SRL_Get_number_of_bytes_in_rx_buffer(void);
-void SRL_Set_task_to_signal_on_data_rx(unsigned char index_of_task_to_signal);
+unsigned short SRL_Write_data_to_transmit_buffer(SRL_PORT port, const unsigned char *data_to_add_ptr, unsigned short data_length);
+unsigned char SRL_Get_transmit_buffer_space(SRL_PORT port);
+void SRL_Set_task_to_signal_on_tx_space(SRL_PORT port, unsigned char index_of_task_to_signal, unsigned char bytes_wanted);
+Boolean SRL_Queue_data_to_transmit(SRL_PORT port, const SRL_TX_FRAGMENT *fragment_ptr, unsigned char number_of_fragments, unsigned char task_to_signal_when_sent);
+unsigned char SRL_Get_data_byte_from_receive_buffer(SRL_PORT port);
+unsigned char SRL_Peek_receive_span(SRL_PORT port, unsigned char byte_offset, const unsigned char **span_ptr_ptr);
+void SRL_Commit_received_bytes(SRL_PORT port, unsigned char number_of_bytes);
+unsigned short SRL_Get_number_of_bytes_in_rx_buffer(SRL_PORT port);
+void SRL_Set_task_to_signal_on_data_rx(SRL_PORT port, unsigned char index_of_task_to_signal);
+void SRL_Set_byte_to_timestamp(SRL_PORT port, unsigned char byte_to_timestamp);
+void SRL_Set_address_filter(SRL_PORT port, const SRL_ADDRESS_FILTER *address_filter_ptr);
+Boolean SRL_Get_receive_timestamp(SRL_PORT port, unsigned char byte_offset, unsigned long *timestamp_us_ptr);
+void SRL_Arm_receive_timestamp(SRL_PORT port);
 
 #endif /* SERIAL_H_ */
\ No newline at end of file
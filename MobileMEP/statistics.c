@@ -0,0 +1,332 @@
+/*
+ * statistics.c
+ *
+ * Description:	Module responsible for run time performance counters
+ */ 
+
+#include "statistics.h"
+#include "schedular.h"
+#include "power.h"
+#include "utilities.h"
+#include "communications.h"
+
+#include <string.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#define STATISTICS_FORMAT_VERSION	3
+
+#define MAXIMUM_COUNT				0xFFFF
+#define MINIMUM_TIME_RESET_VALUE	0xFFFF
+
+// header bytes plus a 16 bit value per counter and high water mark, then 
+// the first timing and number of timings in the response
+#define STATISTICS_HEADER_BYTES		(4 + (2 * NUMBER_OF_STS_COUNTERS) + (2 * NUMBER_OF_STS_HIGH_WATERS) + 2)
+#define FIRST_TIMING_BYTE			(STATISTICS_HEADER_BYTES - 2)
+#define NUMBER_OF_TIMINGS_BYTE		(STATISTICS_HEADER_BYTES - 1)
+#define TIMING_BYTES				12
+#define NUMBER_OF_TIMINGS			(NUMBER_OF_STS_ISRS + NUMBER_OF_TASKS)
+
+// the statistics commands take the first timing wanted, or none for the first page
+#define FIRST_TIMING_REQUEST_BYTE	0
+#define FIRST_TIMING_REQUEST_BYTES	1
+
+// run time information for an isr or task
+typedef struct
+{
+	unsigned long run_count;
+	unsigned long total_time_us;
+	unsigned short minimum_time_us;
+	unsigned short maximum_time_us;
+}STS_TIMING;
+
+static STS_TIMING sts_isr_timings[NUMBER_OF_STS_ISRS];
+static STS_TIMING sts_task_timings[NUMBER_OF_TASKS];
+static unsigned short sts_counters[NUMBER_OF_STS_COUNTERS];
+static unsigned short sts_high_waters[NUMBER_OF_STS_HIGH_WATERS];
+
+static inline void reset_timing(STS_TIMING *timing_ptr);
+static inline void record_time(STS_TIMING *timing_ptr, unsigned short start_timestamp);
+static inline unsigned char *add_16_bit_value(unsigned char *data_ptr, unsigned short value);
+static inline unsigned char *add_32_bit_value(unsigned char *data_ptr, unsigned long value);
+static inline unsigned char *add_timing(unsigned char *data_ptr, const STS_TIMING *timing_ptr);
+
+// name:	STS_Init
+// Desc:	Module initialisation function.
+void STS_Init(void)
+{
+	STS_Reset();
+}
+
+// name:	STS_Reset
+// Desc:	clears all timings, counters and high water marks.
+void STS_Reset(void)
+{
+	unsigned char saved_sreg;
+	unsigned char i;
+	
+	// ISRs update most of these so keep them out while clearing
+	saved_sreg = SREG;
+	cli();
+	//
+	for(i = 0; i < NUMBER_OF_STS_ISRS; i++)
+	{
+		reset_timing(&sts_isr_timings[i]);
+	}
+	//
+	for(i = 0; i < NUMBER_OF_TASKS; i++)
+	{
+		reset_timing(&sts_task_timings[i]);
+	}
+	//
+	memset((void*)&sts_counters[0], 0, sizeof(sts_counters));
+	memset((void*)&sts_high_waters[0], 0, sizeof(sts_high_waters));
+	//
+	SREG = saved_sreg;
+}
+
+// name:	STS_Record_isr_time
+// Desc:	adds the time from the start timestamp to now to the isr timing, 
+//			only to be called at the end of the isr.
+void STS_Record_isr_time(STS_ISR isr, unsigned short start_timestamp)
+{
+	if(NUMBER_OF_STS_ISRS > isr)
+	{
+		record_time(&sts_isr_timings[isr], start_timestamp);
+	}
+}
+
+// name:	STS_Record_task_time
+// Desc:	adds the time from the start timestamp to now to the task timing.
+void STS_Record_task_time(unsigned char task_index, unsigned short start_timestamp)
+{
+	if(NUMBER_OF_TASKS > task_index)
+	{
+		record_time(&sts_task_timings[task_index], start_timestamp);
+	}
+}
+
+// name:	STS_Increment_counter
+// Desc:	adds one to the counter, stopping at the maximum count. Called 
+//			from tasks and ISRs.
+void STS_Increment_counter(STS_COUNTER counter)
+{
+	unsigned char saved_sreg;
+	
+	if(NUMBER_OF_STS_COUNTERS > counter)
+	{
+		// the read, modify and write of a 16 bit value mustn't be split by an ISR
+		saved_sreg = SREG;
+		cli();
+		//
+		if(MAXIMUM_COUNT != sts_counters[counter])
+		{
+			sts_counters[counter]++;
+		}
+		//
+		SREG = saved_sreg;
+	}
+}
+
+// name:	STS_Update_high_water
+// Desc:	keeps the level if it is the highest seen. Called from tasks and ISRs.
+void STS_Update_high_water(STS_HIGH_WATER high_water, unsigned short level)
+{
+	unsigned char saved_sreg;
+	
+	if(NUMBER_OF_STS_HIGH_WATERS > high_water)
+	{
+		saved_sreg = SREG;
+		cli();
+		//
+		if(level > sts_high_waters[high_water])
+		{
+			sts_high_waters[high_water] = level;
+		}
+		//
+		SREG = saved_sreg;
+	}
+}
+
+// name:	STS_Get_statistics
+// Desc:	copies the statistics into the data buffer, little endian, and
+//			returns the number of bytes used or 0 if the header won't fit or 
+//			the first timing is past the last one. The isr and task timings 
+//			are too many for one response so they are sent a page at a time, 
+//			as many as fit from the first timing on.
+//			The layout is: format version, idle percentage, number of isr
+//			timings, number of task timings, the counters, the high water 
+//			marks, the first timing and number of timings in the page, then 
+//			the timings. Timings are numbered with the isrs first then the 
+//			tasks in id order, each is run count, total time, minimum time 
+//			and maximum time.
+unsigned char STS_Get_statistics(unsigned char *data_ptr, unsigned char maximum_bytes, unsigned char first_timing)
+{
+	STS_TIMING timing;
+	unsigned short counters[NUMBER_OF_STS_COUNTERS];
+	unsigned short high_waters[NUMBER_OF_STS_HIGH_WATERS];
+	unsigned char *start_ptr = data_ptr;
+	unsigned char number_of_timings;
+	unsigned char saved_sreg;
+	unsigned char i;
+	
+	if((STATISTICS_HEADER_BYTES > maximum_bytes) || (NUMBER_OF_TIMINGS < first_timing))
+	{
+		return 0;
+	}
+	//
+	// send as many of the timings as there is room for
+	number_of_timings = (maximum_bytes - STATISTICS_HEADER_BYTES) / TIMING_BYTES;
+	//
+	if(number_of_timings > (NUMBER_OF_TIMINGS - first_timing))
+	{
+		number_of_timings = NUMBER_OF_TIMINGS - first_timing;
+	}
+	//
+	// take a copy of everything ISRs can change so the values are consistent, 
+	// the task timings are only changed by tasks so they can't change under us
+	saved_sreg = SREG;
+	cli();
+	//
+	memcpy((void*)&counters[0], (void*)&sts_counters[0], sizeof(counters));
+	memcpy((void*)&high_waters[0], (void*)&sts_high_waters[0], sizeof(high_waters));
+	//
+	SREG = saved_sreg;
+	//
+	*data_ptr++ = STATISTICS_FORMAT_VERSION;
+	*data_ptr++ = PWR_Get_idle_percentage();
+	*data_ptr++ = NUMBER_OF_STS_ISRS;
+	*data_ptr++ = NUMBER_OF_TASKS;
+	//
+	for(i = 0; i < NUMBER_OF_STS_COUNTERS; i++)
+	{
+		data_ptr = add_16_bit_value(data_ptr, counters[i]);
+	}
+	//
+	for(i = 0; i < NUMBER_OF_STS_HIGH_WATERS; i++)
+	{
+		data_ptr = add_16_bit_value(data_ptr, high_waters[i]);
+	}
+	//
+	*data_ptr++ = first_timing;
+	*data_ptr++ = number_of_timings;
+	//
+	for(i = first_timing; i < (first_timing + number_of_timings); i++)
+	{
+		if(NUMBER_OF_STS_ISRS > i)
+		{
+			saved_sreg = SREG;
+			cli();
+			//
+			timing = sts_isr_timings[i];
+			//
+			SREG = saved_sreg;
+		}
+		else
+		{
+			timing = sts_task_timings[i - NUMBER_OF_STS_ISRS];
+		}
+		//
+		data_ptr = add_timing(data_ptr, &timing);
+	}
+	
+	return (unsigned char)(data_ptr - start_ptr);
+}
+
+// name:	reset_timing
+// Desc:	clears a timing so the next time recorded sets the minimum.
+static inline void reset_timing(STS_TIMING *timing_ptr)
+{
+	timing_ptr->run_count = 0;
+	timing_ptr->total_time_us = 0;
+	timing_ptr->minimum_time_us = MINIMUM_TIME_RESET_VALUE;
+	timing_ptr->maximum_time_us = 0;
+}
+
+// name:	record_time
+// Desc:	adds the time from the start timestamp to now to the timing.
+static inline void record_time(STS_TIMING *timing_ptr, unsigned short start_timestamp)
+{
+	unsigned short time_us;
+	
+	time_us = CLK_Get_timestamp_us() - start_timestamp;
+	//
+	timing_ptr->run_count++;
+	timing_ptr->total_time_us += time_us;
+	//
+	if(time_us < timing_ptr->minimum_time_us)
+	{
+		timing_ptr->minimum_time_us = time_us;
+	}
+	//
+	if(time_us > timing_ptr->maximum_time_us)
+	{
+		timing_ptr->maximum_time_us = time_us;
+	}
+}
+
+// name:	add_16_bit_value
+// Desc:	adds a value lsb first and returns the next position.
+static inline unsigned char *add_16_bit_value(unsigned char *data_ptr, unsigned short value)
+{
+	*data_ptr++ = GET_16_BIT_LSB(value);
+	*data_ptr++ = GET_16_BIT_MSB(value);
+	
+	return data_ptr;
+}
+
+// name:	add_32_bit_value
+// Desc:	adds a value lsb first and returns the next position.
+static inline unsigned char *add_32_bit_value(unsigned char *data_ptr, unsigned long value)
+{
+	data_ptr = add_16_bit_value(data_ptr, (unsigned short)(value & 0xFFFF));
+	
+	return add_16_bit_value(data_ptr, (unsigned short)(value >> 16));
+}
+
+// name:	add_timing
+// Desc:	adds a timing and returns the next position.
+static inline unsigned char *add_timing(unsigned char *data_ptr, const STS_TIMING *timing_ptr)
+{
+	data_ptr = add_32_bit_value(data_ptr, timing_ptr->run_count);
+	data_ptr = add_32_bit_value(data_ptr, timing_ptr->total_time_us);
+	data_ptr = add_16_bit_value(data_ptr, timing_ptr->minimum_time_us);
+	
+	return add_16_bit_value(data_ptr, timing_ptr->maximum_time_us);
+}
+
+#ifdef STATISTICS_ENABLED
+// name:	STS_Get_statistics_command
+// Desc:	GET_STATS handler, responds with the statistics and the page of 
+//			timings from the first timing in the request, or from the start.
+unsigned char STS_Get_statistics_command(const unsigned char *request_data_ptr, unsigned char request_data_length, unsigned char *response_data_ptr)
+{
+	unsigned char first_timing = 0;
+	
+	if(FIRST_TIMING_REQUEST_BYTES == request_data_length)
+	{
+		first_timing = request_data_ptr[FIRST_TIMING_REQUEST_BYTE];
+	}
+	
+	return STS_Get_statistics(response_data_ptr, CMS_MAX_DATA_BYTES, first_timing);
+}
+
+// name:	STS_Get_and_reset_statistics_command
+// Desc:	GET_AND_RESET_STATS handler, responds as GET_STATS then clears 
+//			the statistics once the page with the last timing has been taken, 
+//			so a host reading every page in turn sees one period.
+unsigned char STS_Get_and_reset_statistics_command(const unsigned char *request_data_ptr, unsigned char request_data_length, unsigned char *response_data_ptr)
+{
+	unsigned char response_data_bytes;
+	
+	response_data_bytes = STS_Get_statistics_command(request_data_ptr, request_data_length, response_data_ptr);
+	//
+	if((0 != response_data_bytes) && 
+		(NUMBER_OF_TIMINGS == (response_data_ptr[FIRST_TIMING_BYTE] + response_data_ptr[NUMBER_OF_TIMINGS_BYTE])))
+	{
+		STS_Reset();
+	}
+	
+	return response_data_bytes;
+}
+#endif
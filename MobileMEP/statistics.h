@@ -0,0 +1,86 @@
+/*
+ * statistics.h
+ *
+ * Description:	Module responsible for run time performance counters
+ */ 
+
+
+#ifndef STATISTICS_H_
+#define STATISTICS_H_
+
+#include "clock.h"
+
+// remove to compile all of the instrumentation out
+#define STATISTICS_ENABLED
+
+// interrupts which are timed, the pin change interrupt is only used with 
+// rts/cts flow control
+typedef enum
+{
+	STS_ISR_USART0_RX = 0,
+	STS_ISR_USART0_UDRE,
+	STS_ISR_USART0_TX,
+	STS_ISR_USART1_RX,
+	STS_ISR_USART1_UDRE,
+	STS_ISR_USART1_TX,
+	STS_ISR_TIMER0_COMPA,
+	STS_ISR_TIMER1_COMPA,
+	STS_ISR_TIMER1_OVF,
+	STS_ISR_PCINT3,
+	NUMBER_OF_STS_ISRS
+}STS_ISR;
+
+// error counters
+typedef enum
+{
+	STS_COUNTER_RX_BYTES_WITH_ERRORS = 0,
+	STS_COUNTER_RX_BUFFER_OVERFLOWS,
+	STS_COUNTER_FRAMING_ERRORS,
+	STS_COUNTER_CRC_FAILURES,
+	STS_COUNTER_RX_PACKET_POOL_EXHAUSTED,
+	STS_COUNTER_LENGTH_ERRORS,
+	STS_COUNTER_RX_PACKET_TIMEOUTS,
+	STS_COUNTER_RX_PACKET_NO_TIMER,
+	STS_COUNTER_REQUEST_RETRIES,
+	STS_COUNTER_REQUEST_TIMEOUTS,
+	STS_COUNTER_UNMATCHED_RESPONSES,
+	NUMBER_OF_STS_COUNTERS
+}STS_COUNTER;
+
+// levels which have their highest value kept
+typedef enum
+{
+	STS_HIGH_WATER_RX_BUFFER = 0,
+	STS_HIGH_WATER_TX_BUFFER,
+	STS_HIGH_WATER_PENDING_TASKS,
+	STS_HIGH_WATER_RX_PACKETS,
+	STS_HIGH_WATER_RX_PACKET_POOL_BYTES,
+	NUMBER_OF_STS_HIGH_WATERS
+}STS_HIGH_WATER;
+
+// instrumentation macros, timings are in microseconds from the 
+// clock so anything over 65ms will wrap
+#ifdef STATISTICS_ENABLED
+#define STS_TIMING_START()							unsigned short sts_start_timestamp = CLK_Get_timestamp_us()
+#define STS_ISR_TIMING_END(isr)						STS_Record_isr_time((isr), sts_start_timestamp)
+#define STS_TASK_TIMING_END(task_index)				STS_Record_task_time((task_index), sts_start_timestamp)
+#define STS_INCREMENT_COUNTER(counter)				STS_Increment_counter(counter)
+#define STS_UPDATE_HIGH_WATER(high_water, level)	STS_Update_high_water((high_water), (level))
+#else
+#define STS_TIMING_START()
+#define STS_ISR_TIMING_END(isr)
+#define STS_TASK_TIMING_END(task_index)
+#define STS_INCREMENT_COUNTER(counter)
+#define STS_UPDATE_HIGH_WATER(high_water, level)
+#endif
+
+void STS_Init(void);
+void STS_Reset(void);
+void STS_Record_isr_time(STS_ISR isr, unsigned short start_timestamp);
+void STS_Record_task_time(unsigned char task_index, unsigned short start_timestamp);
+void STS_Increment_counter(STS_COUNTER counter);
+void STS_Update_high_water(STS_HIGH_WATER high_water, unsigned short level);
+unsigned char STS_Get_statistics(unsigned char *data_ptr, unsigned char maximum_bytes, unsigned char first_timing);
+
+
+#endif /* STATISTICS_H_ */
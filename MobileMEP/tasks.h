@@ -0,0 +1,35 @@
+/*
+ * tasks.h
+ *
+ * Description:	build time list of the background tasks run by the schedular
+ */ 
+
+
+#ifndef TASKS_H_
+#define TASKS_H_
+
+// every background task has an entry SCH_TASK(task id, task function, priority),
+// the task id is the index of the entry and is used to signal the task. 
+// Task functions take no parameters and return nothing.
+#define SCH_TASK_TABLE \
+	SCH_TASK(TASK_CMS_POPULATE_RECEIVED_PACKET_0,	CMS_Populate_received_packet_0_task,	TASK_PRIORITY_HIGH) \
+	SCH_TASK(TASK_CMS_PARSE_RECEIVED_PACKET_0,		CMS_Parse_received_packet_0_task,		TASK_PRIORITY_HIGH) \
+	SCH_TASK(TASK_CMS_PACKET_TRANSMITTED_0,			CMS_Packet_transmitted_0_task,			TASK_PRIORITY_HIGH) \
+	SCH_TASK(TASK_CMS_POPULATE_RECEIVED_PACKET_1,	CMS_Populate_received_packet_1_task,	TASK_PRIORITY_HIGH) \
+	SCH_TASK(TASK_CMS_PARSE_RECEIVED_PACKET_1,		CMS_Parse_received_packet_1_task,		TASK_PRIORITY_HIGH) \
+	SCH_TASK(TASK_CMS_PACKET_TRANSMITTED_1,			CMS_Packet_transmitted_1_task,			TASK_PRIORITY_HIGH) \
+	SCH_TASK(TASK_CMS_REQUEST_TIMEOUT,				CMS_Request_timeout_task,				TASK_PRIORITY_NORMAL) \
+	SCH_TASK(TASK_CMS_REQUEST_SENT_0,				CMS_Request_sent_task,					TASK_PRIORITY_NORMAL) \
+	SCH_TASK(TASK_CMS_REQUEST_SENT_1,				CMS_Request_sent_task,					TASK_PRIORITY_NORMAL) \
+	SCH_TASK(TASK_CMS_REQUEST_SENT_2,				CMS_Request_sent_task,					TASK_PRIORITY_NORMAL) \
+	SCH_TASK(TASK_CMS_REQUEST_SENT_3,				CMS_Request_sent_task,					TASK_PRIORITY_NORMAL) \
+	SCH_TASK(TASK_CMS_BAUD_RATE_TIMEOUT,			CMS_Baud_rate_timeout_task,				TASK_PRIORITY_NORMAL) \
+	SCH_TASK(TASK_HDW_HEARTBEAT_LED,				HDW_Heartbeat_led_task,					TASK_PRIORITY_LOW) \
+	SCH_EXTRA_TASK_TABLE
+
+// builds such as the host benchmark can append their own tasks
+#ifndef SCH_EXTRA_TASK_TABLE
+#define SCH_EXTRA_TASK_TABLE
+#endif
+
+#endif /* TASKS_H_ */
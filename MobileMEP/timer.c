@@ -8,130 +8,437 @@
 
 #include "timer.h"
 #include "schedular.h"
+#include "statistics.h"
 
+#include <avr/io.h>
 #include <avr/interrupt.h>
 
-#define MAX_TIMERS	20
+#define MAX_TIMERS	24
+
+// terminates the active and free timer lists
+#define NO_TIMER						0xFF
+
+#if (MAX_TIMERS >= NO_TIMER)
+#error "too many timers for an unsigned char index"
+#endif
 
 #define CLEAR_TIMER_ON_COMPARE_MATCH			0x02
+#define CLOCK_STOPPED							0x00
 #define CLOCK_DIVIDED_BY_1024					0x05
 #define TIMER_COMPARE_MATCH_INTERRUPT_ENABLE	0x02
+#define TIMER_COMPARE_MATCH_FLAG				0x02
 
 #define OUTPUT_COMPARE_VALUE			78
 
+// the timer only interrupts when the next timer is due rather than every tick,
+// the 8 bit counter limits the longest interval to a few ticks. At the slowest
+// prescaler that is 3 ticks, so a timer due further away still wakes the
+// processor every 30ms to count down, and the clock's timer 1 overflow wakes
+// it every 65ms regardless. Waking less often would need a 16 bit counter,
+// and timer 1 is already used by the clock.
+#define TIMER_TICK_COUNTS				(OUTPUT_COMPARE_VALUE + 1)
+#define MAX_TICKS_PER_COMPARE			(256 / TIMER_TICK_COUNTS)
+
+// active timers are kept in a list sorted by when they are due, each holding 
+// the ticks after the timer before it, so the interrupt only has to look at
+// the head of the list and the timers which are expiring
 typedef struct  
 {
 	Boolean timer_active;
-	unsigned short timer_count;
-	unsigned short reload_count;
+	unsigned char generation;		// changes each time the timer is freed so old handles can be spotted
+	unsigned short delta_ticks;
+	TIMER_COUNT reload_count;
 	unsigned char task_to_signal;
+	unsigned char next_timer;
+	unsigned char previous_timer;
 }TIMER_STRUCT;
 
-static inline void reset_timer(unsigned char timer_index);
-static inline void process_all_timers(void);
+static inline Boolean get_timer_index(TIMER_HANDLE timer_handle, unsigned char *timer_index_ptr);
+static inline void schedule_timer(unsigned char timer_index, TIMER_COUNT timer_count, TIMER_COUNT reload_count);
+static inline void insert_timer(unsigned char timer_index, unsigned short ticks);
+static inline void remove_timer(unsigned char timer_index);
+static inline void free_timer(unsigned char timer_index);
+static inline unsigned short process_expired_timers(unsigned char elapsed_ticks);
+static inline void start_tick_interval(unsigned char ticks);
+static inline void stop_tick_interval(void);
 
 static TIMER_STRUCT timers[MAX_TIMERS];
 
+// first timer due and first unused timer
+static unsigned char tmr_active_timers_head;
+static unsigned char tmr_free_timers_head;
+
+// ticks from the start of the current interval to the next compare match, 0 when stopped
+static unsigned char tmr_ticks_programmed;
+
 // name:	TMR_Init
 // Desc:	Module initialisation function.
 void TMR_Init(void)
 {
-	int i;
+	unsigned char i;
 	
-	// initialise the timers array
+	// put all of the timers on the free list
 	for(i = 0; i < MAX_TIMERS; i++)
 	{
-		reset_timer(i);
+		timers[i].timer_active = False;
+		timers[i].generation = 0;
+		timers[i].delta_ticks = 0;
+		timers[i].reload_count = TIMER_COUNT_NONE;
+		timers[i].task_to_signal = NO_TASK;
+		timers[i].previous_timer = NO_TIMER;
+		timers[i].next_timer = ((MAX_TIMERS - 1) == i) ? NO_TIMER : (i + 1);
 	}
 	//
-	// set up timer interrupt
+	tmr_active_timers_head = NO_TIMER;
+	tmr_free_timers_head = 0;
+	//
+	// set up the timer but leave it stopped until a timer is set
 	TCCR0A = CLEAR_TIMER_ON_COMPARE_MATCH;
-	TCCR0B = CLOCK_DIVIDED_BY_1024;
-	TIMSK0 = TIMER_COMPARE_MATCH_INTERRUPT_ENABLE;
 	//
-	OCR0A = OUTPUT_COMPARE_VALUE;
+	stop_tick_interval();
 }
 
 // name:	TMR_Set_timer_to_signal_task
-// Desc:	Sets up a timer to signal the passed task.
-void TMR_Set_timer_to_signal_task(unsigned char task_to_signal, TIMER_COUNT timer_count, TIMER_COUNT reload_count)
+// Desc:	Sets up a timer to signal the passed task. Returns a handle for 
+//			the timer or TIMER_HANDLE_NONE if all the timers are in use.
+TIMER_HANDLE TMR_Set_timer_to_signal_task(unsigned char task_to_signal, TIMER_COUNT timer_count, TIMER_COUNT reload_count)
 {
-	int i;
-	Boolean timer_slot_found;
-	unsigned char timer_slot_index;
+	TIMER_HANDLE timer_handle = TIMER_HANDLE_NONE;
+	unsigned char timer_index;
+	unsigned char saved_sreg;
 	
-	timer_slot_found = False;
+	// the timer interrupt must not run while the timers are changed
+	saved_sreg = SREG;
+	cli();
 	//
-	// find the first empty slot
-	for(i = 0; ((i < MAX_TIMERS) && (timer_slot_found == False)); i++)
+	// take the first unused timer
+	if(NO_TIMER != tmr_free_timers_head)
 	{
-		if(False == timers[i].timer_active)
+		timer_index = tmr_free_timers_head;
+		tmr_free_timers_head = timers[timer_index].next_timer;
+		//
+		timers[timer_index].task_to_signal = task_to_signal;
+		timers[timer_index].timer_active = True;
+		//
+		schedule_timer(timer_index, timer_count, reload_count);
+		//
+		timer_handle = MAKE_16_BITS(timers[timer_index].generation, timer_index);
+	}
+	else
+	{
+		// TBD add error 
+	}
+	//
+	SREG = saved_sreg;
+	
+	return timer_handle;
+}
+
+// name:	TMR_Cancel_timer
+// Desc:	Stops the timer without signalling its task. Returns False if the
+//			handle no longer refers to an active timer.
+Boolean TMR_Cancel_timer(TIMER_HANDLE timer_handle)
+{
+	Boolean timer_cancelled = False;
+	unsigned char timer_index;
+	unsigned char saved_sreg;
+	
+	saved_sreg = SREG;
+	cli();
+	//
+	if(True == get_timer_index(timer_handle, &timer_index))
+	{
+		remove_timer(timer_index);
+		free_timer(timer_index);
+		//
+		// don't wake up for an interval with nothing left in it
+		if(NO_TIMER == tmr_active_timers_head)
 		{
-			timer_slot_index = i;
-			//
-			timer_slot_found = True;			
+			stop_tick_interval();
 		}
+		//
+		timer_cancelled = True;
 	}
 	//
-	// if a slot has been found then set up the timer
-	if(True == timer_slot_found)
+	SREG = saved_sreg;
+	
+	return timer_cancelled;
+}
+
+// name:	TMR_Reschedule_timer
+// Desc:	Restarts an active timer with new counts, keeping its handle and 
+//			task. Returns False if the handle no longer refers to an active timer.
+Boolean TMR_Reschedule_timer(TIMER_HANDLE timer_handle, TIMER_COUNT timer_count, TIMER_COUNT reload_count)
+{
+	Boolean timer_rescheduled = False;
+	unsigned char timer_index;
+	unsigned char saved_sreg;
+	
+	saved_sreg = SREG;
+	cli();
+	//
+	if(True == get_timer_index(timer_handle, &timer_index))
+	{
+		remove_timer(timer_index);
+		schedule_timer(timer_index, timer_count, reload_count);
+		//
+		timer_rescheduled = True;
+	}
+	//
+	SREG = saved_sreg;
+	
+	return timer_rescheduled;
+}
+
+// name:	TMR_Is_timer_active
+// Desc:	Returns True if the handle refers to a timer which is still running.
+Boolean TMR_Is_timer_active(TIMER_HANDLE timer_handle)
+{
+	unsigned char timer_index;
+	Boolean timer_active;
+	unsigned char saved_sreg;
+	
+	saved_sreg = SREG;
+	cli();
+	//
+	timer_active = get_timer_index(timer_handle, &timer_index);
+	//
+	SREG = saved_sreg;
+	
+	return timer_active;
+}
+
+// name:	get_timer_index
+// Desc:	gets the timer index from the handle, returns False if the handle 
+//			is stale or doesn't refer to an active timer.
+static inline Boolean get_timer_index(TIMER_HANDLE timer_handle, unsigned char *timer_index_ptr)
+{
+	Boolean handle_valid = False;
+	unsigned char timer_index;
+	
+	timer_index = GET_16_BIT_LSB(timer_handle);
+	//
+	if((MAX_TIMERS > timer_index) &&
+		(True == timers[timer_index].timer_active) &&
+		(timers[timer_index].generation == GET_16_BIT_MSB(timer_handle)))
+	{
+		*timer_index_ptr = timer_index;
+		handle_valid = True;
+	}
+	
+	return handle_valid;
+}
+
+// name:	schedule_timer
+// Desc:	adds a timer which isn't in the active list to it and brings the 
+//			compare match forward if needed. Must be called with interrupts disabled.
+static inline void schedule_timer(unsigned char timer_index, TIMER_COUNT timer_count, TIMER_COUNT reload_count)
+{
+	unsigned char elapsed_ticks;
+	unsigned short ticks_to_first_timer;
+	
+	// the whole interval will be taken off the list when it ends so add on
+	// the ticks already gone, including a finished interval not yet processed
+	elapsed_ticks = TCNT0 / TIMER_TICK_COUNTS;
+	//
+	if(0 != (TIFR0 & TIMER_COMPARE_MATCH_FLAG))
+	{
+		elapsed_ticks += tmr_ticks_programmed;
+	}
+	//
+	if(TIMER_COUNT_NONE == timer_count)
+	{
+		timer_count = TIMER_COUNT_10_MS;
+	}
+	//
+	timers[timer_index].reload_count = reload_count;
+	//
+	insert_timer(timer_index, (timer_count + elapsed_ticks));
+	//
+	// start the timer if it was stopped or bring the compare match 
+	// forward if the first timer is now due before the end of the interval
+	ticks_to_first_timer = timers[tmr_active_timers_head].delta_ticks;
+	//
+	if(0 == tmr_ticks_programmed)
 	{
-		timers[timer_slot_index].timer_count = timer_count;
-		timers[timer_slot_index].reload_count = reload_count;
-		timers[timer_slot_index].task_to_signal = task_to_signal;
-		timers[timer_slot_index].timer_active = True;
+		start_tick_interval((ticks_to_first_timer > MAX_TICKS_PER_COMPARE) ? MAX_TICKS_PER_COMPARE : ticks_to_first_timer);
+	}
+	else if((0 == (TIFR0 & TIMER_COMPARE_MATCH_FLAG)) && 
+			(ticks_to_first_timer < tmr_ticks_programmed))
+	{
+		tmr_ticks_programmed = ticks_to_first_timer;
+		OCR0A = (tmr_ticks_programmed * TIMER_TICK_COUNTS) - 1;
+	}
+}
+
+// name:	insert_timer
+// Desc:	puts the timer into the active list so it is due the passed ticks 
+//			after the start of the current interval. Timers due at the same 
+//			time expire in the order they were added.
+static inline void insert_timer(unsigned char timer_index, unsigned short ticks)
+{
+	unsigned char previous_timer = NO_TIMER;
+	unsigned char next_timer = tmr_active_timers_head;
+	
+	// find the first timer due after this one 
+	while((NO_TIMER != next_timer) && (timers[next_timer].delta_ticks <= ticks))
+	{
+		ticks -= timers[next_timer].delta_ticks;
+		previous_timer = next_timer;
+		next_timer = timers[next_timer].next_timer;
+	}
+	//
+	timers[timer_index].delta_ticks = ticks;
+	timers[timer_index].previous_timer = previous_timer;
+	timers[timer_index].next_timer = next_timer;
+	//
+	// the timer after this one is now due relative to this one
+	if(NO_TIMER != next_timer)
+	{
+		timers[next_timer].delta_ticks -= ticks;
+		timers[next_timer].previous_timer = timer_index;
+	}
+	//
+	if(NO_TIMER == previous_timer)
+	{
+		tmr_active_timers_head = timer_index;
 	}
 	else
 	{
-		// TBD add error 
+		timers[previous_timer].next_timer = timer_index;
 	}
 }
 
-// name:	reset_timer
-// Desc:	resets the timer values to default.
-static inline void reset_timer(unsigned char timer_index)
+// name:	remove_timer
+// Desc:	takes the timer out of the active list without changing when any
+//			of the other timers are due.
+static inline void remove_timer(unsigned char timer_index)
+{
+	unsigned char previous_timer = timers[timer_index].previous_timer;
+	unsigned char next_timer = timers[timer_index].next_timer;
+	
+	if(NO_TIMER != next_timer)
+	{
+		timers[next_timer].delta_ticks += timers[timer_index].delta_ticks;
+		timers[next_timer].previous_timer = previous_timer;
+	}
+	//
+	if(NO_TIMER == previous_timer)
+	{
+		tmr_active_timers_head = next_timer;
+	}
+	else
+	{
+		timers[previous_timer].next_timer = next_timer;
+	}
+}
+
+// name:	free_timer
+// Desc:	returns the timer to the free list, invalidating its handle.
+static inline void free_timer(unsigned char timer_index)
 {
 	timers[timer_index].timer_active = False;
-	timers[timer_index].timer_count = TIMER_COUNT_NONE;
-	timers[timer_index].reload_count = TIMER_COUNT_NONE;
+	timers[timer_index].generation++;
 	timers[timer_index].task_to_signal = NO_TASK;
+	timers[timer_index].next_timer = tmr_free_timers_head;
+	//
+	tmr_free_timers_head = timer_index;
 }
 
-// name:	process_all_timers
-// Desc:	decrements all active timers and signals any 
-//			tasks which the associated timer has elapsed.
-static inline void process_all_timers(void)
+// name:	process_expired_timers
+// Desc:	takes the elapsed ticks off the first timer and signals the tasks
+//			of all the timers which have expired. Returns the ticks until the 
+//			next timer is due or 0 if no timers are active.
+static inline unsigned short process_expired_timers(unsigned char elapsed_ticks)
 {
-	int i;
+	unsigned char timer_index;
+	unsigned short ticks_to_next_timer = 0;
 	
-	for(i = 0; i < MAX_TIMERS; i++)
+	// the compare match is never later than the first timer so this won't underflow
+	if(NO_TIMER != tmr_active_timers_head)
 	{
-		if(True == timers[i].timer_active)
+		timers[tmr_active_timers_head].delta_ticks -= elapsed_ticks;
+	}
+	//
+	while((NO_TIMER != tmr_active_timers_head) && (0 == timers[tmr_active_timers_head].delta_ticks))
+	{
+		timer_index = tmr_active_timers_head;
+		//
+		// timer count has elapsed so signal task
+		remove_timer(timer_index);
+		SCH_Signal_task(timers[timer_index].task_to_signal, TIMER_TRIGGERED);
+		//
+		// if the reload count is not TIMER_COUNT_NONE then put the 
+		// timer back in the list else kill it
+		if(TIMER_COUNT_NONE == timers[timer_index].reload_count)
+		{
+			free_timer(timer_index);
+		}
+		else
 		{
-			if((unsigned char)TIMER_COUNT_NONE == --timers[i].timer_count)
-			{
-				// timer count has elapsed so signal task
-				SCH_Signal_task(timers[i].task_to_signal, TIMER_TRIGGERED);
-				//
-				// if the reload count is not TIMER_COUNT_NONE then refresh 
-				// the timer else kill it
-				if(TIMER_COUNT_NONE == timers[i].reload_count)
-				{
-					reset_timer(i);
-				}
-				else
-				{
-					timers[i].timer_count = timers[i].reload_count;
-				}
-			}
+			insert_timer(timer_index, timers[timer_index].reload_count);
 		}
 	}
+	//
+	if(NO_TIMER != tmr_active_timers_head)
+	{
+		ticks_to_next_timer = timers[tmr_active_timers_head].delta_ticks;
+	}
+	
+	return ticks_to_next_timer;
+}
+
+// name:	start_tick_interval
+// Desc:	starts the timer counting from zero with a compare match after the passed ticks.
+static inline void start_tick_interval(unsigned char ticks)
+{
+	tmr_ticks_programmed = ticks;
+	//
+	TCNT0 = 0;
+	OCR0A = (ticks * TIMER_TICK_COUNTS) - 1;
+	TIFR0 = TIMER_COMPARE_MATCH_FLAG;
+	TIMSK0 = TIMER_COMPARE_MATCH_INTERRUPT_ENABLE;
+	TCCR0B = CLOCK_DIVIDED_BY_1024;
+}
+
+// name:	stop_tick_interval
+// Desc:	stops the timer so it doesn't wake the processor when no timers are active.
+static inline void stop_tick_interval(void)
+{
+	tmr_ticks_programmed = 0;
+	//
+	TCCR0B = CLOCK_STOPPED;
+	TIMSK0 = 0;
+	TCNT0 = 0;
+	TIFR0 = TIMER_COMPARE_MATCH_FLAG;
 }
 
 // name:	ISR(TIMER0_COMPA_vect)
 // Desc:	timer 0 compare match A interrupt.
 ISR(TIMER0_COMPA_vect)
 {
-	// process all the timers for time out
-	process_all_timers();
-}
\ No newline at end of file
+	unsigned short ticks_to_next_timer;
+	STS_TIMING_START();
+	
+	// take the interval that has just finished off all the timers
+	ticks_to_next_timer = process_expired_timers(tmr_ticks_programmed);
+	//
+	// the counter has already started the next interval so only the compare 
+	// value needs to change, or stop it if there are no timers left
+	if(0 == ticks_to_next_timer)
+	{
+		stop_tick_interval();
+	}
+	else
+	{
+		if(ticks_to_next_timer > MAX_TICKS_PER_COMPARE)
+		{
+			ticks_to_next_timer = MAX_TICKS_PER_COMPARE;
+		}
+		//
+		tmr_ticks_programmed = ticks_to_next_timer;
+		OCR0A = (tmr_ticks_programmed * TIMER_TICK_COUNTS) - 1;
+	}
+	//
+	STS_ISR_TIMING_END(STS_ISR_TIMER0_COMPA);
+}
@@ -16,12 +16,23 @@ typedef enum
 {
 	TIMER_COUNT_NONE	=	0,
 	TIMER_COUNT_10_MS	=	1,
+	TIMER_COUNT_50_MS	=	5,
 	TIMER_COUNT_500_MS	= 50,
 	TIMER_COUNT_1_S		= 100
 }TIMER_COUNT;
 
+// a handle identifies a timer until it is cancelled or, for one shot timers,
+// until it expires. Stale handles are ignored rather than affecting a timer
+// which has since reused the same slot.
+typedef unsigned short TIMER_HANDLE;
+
+#define TIMER_HANDLE_NONE	0xFFFF
+
 void TMR_Init(void);
-void TMR_Set_timer_to_signal_task(unsigned char task_to_signal, TIMER_COUNT timer_count, TIMER_COUNT reload_count);
+TIMER_HANDLE TMR_Set_timer_to_signal_task(unsigned char task_to_signal, TIMER_COUNT timer_count, TIMER_COUNT reload_count);
+Boolean TMR_Cancel_timer(TIMER_HANDLE timer_handle);
+Boolean TMR_Reschedule_timer(TIMER_HANDLE timer_handle, TIMER_COUNT timer_count, TIMER_COUNT reload_count);
+Boolean TMR_Is_timer_active(TIMER_HANDLE timer_handle);
 
 
 #endif /* TIMER1_H_ */
\ No newline at end of file
@@ -0,0 +1,145 @@
+/*
+ * crc_bench.c
+ *
+ * Description:	measures the crc engine it is built with. On the host each 
+ *				phase is timed with the system clock, on the avr the start 
+ *				and end of each phase are marked on GPIOR0 so the crc_sim 
+ *				harness can count the cycles.
+ */
+
+#include "crc.h"
+
+#include <avr/io.h>
+
+#ifdef HOST_BUILD
+#include <stdio.h>
+#include <time.h>
+#else
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+#endif
+
+#define BENCH_BLOCK_SIZE					200
+#ifdef HOST_BUILD
+#define BENCH_ROUNDS						100000UL
+#else
+#define BENCH_ROUNDS						20UL
+#endif
+
+// crc-16/ccitt-false of the ascii digits 1 to 9
+#define CHECK_STRING						"123456789"
+#define CHECK_STRING_LENGTH					9
+#define CHECK_VALUE							0x29B1
+
+// phases, the harness sees the phase number at the start and with the end flag at the end
+#define PHASE_BLOCK							1
+#define PHASE_SINGLE_BYTES					2
+#define PHASE_END							0x80
+
+#define CHECK_PASSED						1
+#define CHECK_FAILED						2
+
+static unsigned char bench_block[BENCH_BLOCK_SIZE];
+static volatile unsigned short bench_sink;
+
+#ifdef HOST_BUILD
+#if (CRC_BACKEND == CRC_BACKEND_TABLE_256)
+#define BACKEND_NAME						"table_256"
+#elif (CRC_BACKEND == CRC_BACKEND_NIBBLE_TABLE)
+#define BACKEND_NAME						"nibble_table"
+#elif (CRC_BACKEND == CRC_BACKEND_BITWISE)
+#define BACKEND_NAME						"bitwise"
+#else
+#define BACKEND_NAME						"avr_asm"
+#endif
+
+static unsigned long long phase_start_ns;
+static double phase_ns_per_byte[PHASE_SINGLE_BYTES + 1];
+
+// name:	now_ns
+// Desc:	returns a monotonic timestamp in nanoseconds.
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ((unsigned long long)ts.tv_sec * 1000000000ULL) + (unsigned long long)ts.tv_nsec;
+}
+#endif
+
+// name:	mark_phase
+// Desc:	marks the start or end of a phase.
+static void mark_phase(unsigned char phase)
+{
+#ifdef HOST_BUILD
+	if(0 == (phase & PHASE_END))
+	{
+		phase_start_ns = now_ns();
+	}
+	else
+	{
+		phase_ns_per_byte[phase & ~PHASE_END] = (double)(now_ns() - phase_start_ns) / (double)(BENCH_ROUNDS * BENCH_BLOCK_SIZE);
+	}
+#else
+	GPIOR0 = phase;
+#endif
+}
+
+// name:	main
+// Desc:	checks the engine against the known crc then times whole blocks 
+//			and single byte updates.
+int main(void)
+{
+	CRC_STATE crc_state;
+	unsigned char check_result;
+	unsigned long round;
+	unsigned short i;
+
+	for(i = 0; i < BENCH_BLOCK_SIZE; i++)
+	{
+		bench_block[i] = (unsigned char)(i * 7);
+	}
+	//
+	check_result = (CHECK_VALUE == CRC_Calculate_crc((const unsigned char *)CHECK_STRING, CHECK_STRING_LENGTH)) ? CHECK_PASSED : CHECK_FAILED;
+	//
+	mark_phase(PHASE_BLOCK);
+	//
+	for(round = 0; round < BENCH_ROUNDS; round++)
+	{
+		bench_sink = CRC_Calculate_crc(bench_block, BENCH_BLOCK_SIZE);
+	}
+	//
+	mark_phase(PHASE_BLOCK | PHASE_END);
+	mark_phase(PHASE_SINGLE_BYTES);
+	//
+	for(round = 0; round < BENCH_ROUNDS; round++)
+	{
+		CRC_Init(&crc_state);
+		//
+		for(i = 0; i < BENCH_BLOCK_SIZE; i++)
+		{
+			CRC_Update_byte(&crc_state, bench_block[i]);
+		}
+		//
+		bench_sink = CRC_Final(&crc_state);
+	}
+	//
+	mark_phase(PHASE_SINGLE_BYTES | PHASE_END);
+	//
+#ifdef HOST_BUILD
+	printf("%-14s %12.2f %12.2f %8s\n", BACKEND_NAME, phase_ns_per_byte[PHASE_BLOCK], phase_ns_per_byte[PHASE_SINGLE_BYTES],
+			(CHECK_PASSED == check_result) ? "ok" : "FAIL");
+
+	return (CHECK_PASSED == check_result) ? 0 : 1;
+#else
+	GPIOR1 = check_result;
+	//
+	// sleeping with interrupts off ends the simulation
+	cli();
+	sleep_enable();
+	sleep_cpu();
+	//
+	return 0;
+#endif
+}
@@ -0,0 +1,159 @@
+/*
+ * crc_sim.c
+ *
+ * Description:	runs a crc_bench ELF under simavr and prints the cycles per
+ *				byte of each phase along with the engine's flash and RAM cost.
+ */
+
+#include "sim_avr.h"
+#include "sim_elf.h"
+#include "sim_io.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MCU_NAME							"atmega644p"
+#define MCU_FREQUENCY						8000000UL
+#define MAX_CYCLES							(MCU_FREQUENCY * 60)
+
+// data space addresses of the general purpose io registers the bench writes
+#define GPIOR0_ADDRESS						0x3E
+#define GPIOR1_ADDRESS						0x4A
+
+// mirrored from crc_bench.c
+#define BENCH_BLOCK_SIZE					200
+#define BENCH_ROUNDS						20UL
+#define PHASE_BLOCK							1
+#define PHASE_SINGLE_BYTES					2
+#define PHASE_END							0x80
+#define CHECK_PASSED						1
+
+static avr_cycle_count_t phase_start_cycle[PHASE_SINGLE_BYTES + 1];
+static avr_cycle_count_t phase_cycles[PHASE_SINGLE_BYTES + 1];
+static unsigned char check_result;
+
+// name:	phase_write
+// Desc:	notes the cycle count at the start and end of each phase.
+static void phase_write(avr_t *avr, avr_io_addr_t address, uint8_t value, void *param)
+{
+	unsigned char phase = value & ~PHASE_END;
+
+	avr->data[address] = value;
+	//
+	if(phase <= PHASE_SINGLE_BYTES)
+	{
+		if(0 == (value & PHASE_END))
+		{
+			phase_start_cycle[phase] = avr->cycle;
+		}
+		else
+		{
+			phase_cycles[phase] = avr->cycle - phase_start_cycle[phase];
+		}
+	}
+}
+
+// name:	check_write
+// Desc:	picks up the result of the known value check.
+static void check_write(avr_t *avr, avr_io_addr_t address, uint8_t value, void *param)
+{
+	avr->data[address] = value;
+	check_result = value;
+}
+
+// name:	usage
+// Desc:	prints command line help.
+static void usage(const char *program_name)
+{
+	fprintf(stderr,
+		"usage: %s [-b backend_name] [-f flash_bytes] [-r ram_bytes] crc_bench.elf\n"
+		"  -b  name printed for the engine\n"
+		"  -f  flash used by the engine, printed as given\n"
+		"  -r  RAM used by the engine, printed as given\n",
+		program_name);
+}
+
+// name:	main
+// Desc:	loads the bench, runs it to the end and prints a result line.
+int main(int argc, char *argv[])
+{
+	elf_firmware_t firmware;
+	avr_t *avr;
+	const char *backend_name = "crc";
+	unsigned long flash_bytes = 0;
+	unsigned long ram_bytes = 0;
+	double bytes;
+	int run_state = cpu_Running;
+	int option;
+
+	while(-1 != (option = getopt(argc, argv, "b:f:r:h")))
+	{
+		switch(option)
+		{
+			case 'b':
+				backend_name = optarg;
+				break;
+			case 'f':
+				flash_bytes = strtoul(optarg, NULL, 0);
+				break;
+			case 'r':
+				ram_bytes = strtoul(optarg, NULL, 0);
+				break;
+			default:
+				usage(argv[0]);
+				return 2;
+		}
+	}
+	//
+	if(optind >= argc)
+	{
+		usage(argv[0]);
+		return 2;
+	}
+	//
+	memset(&firmware, 0, sizeof(firmware));
+	//
+	if(0 != elf_read_firmware(argv[optind], &firmware))
+	{
+		fprintf(stderr, "unable to read %s\n", argv[optind]);
+		return 2;
+	}
+	//
+	avr = avr_make_mcu_by_name(MCU_NAME);
+	//
+	if(NULL == avr)
+	{
+		fprintf(stderr, "simavr has no %s core\n", MCU_NAME);
+		return 2;
+	}
+	//
+	avr_init(avr);
+	firmware.frequency = MCU_FREQUENCY;
+	avr_load_firmware(avr, &firmware);
+	avr->frequency = MCU_FREQUENCY;
+	avr->log = LOG_NONE;
+	//
+	avr_register_io_write(avr, GPIOR0_ADDRESS, phase_write, NULL);
+	avr_register_io_write(avr, GPIOR1_ADDRESS, check_write, NULL);
+	//
+	while((cpu_Done != run_state) && (cpu_Crashed != run_state) && (avr->cycle < MAX_CYCLES))
+	{
+		run_state = avr_run(avr);
+	}
+	//
+	if(cpu_Done != run_state)
+	{
+		fprintf(stderr, "%s: bench did not finish\n", backend_name);
+		return 1;
+	}
+	//
+	bytes = (double)(BENCH_ROUNDS * BENCH_BLOCK_SIZE);
+	//
+	printf("%-14s %8lu %6lu %12.2f %12.2f %8s\n", backend_name, flash_bytes, ram_bytes,
+			(double)phase_cycles[PHASE_BLOCK] / bytes, (double)phase_cycles[PHASE_SINGLE_BYTES] / bytes,
+			(CHECK_PASSED == check_result) ? "ok" : "FAIL");
+
+	return (CHECK_PASSED == check_result) ? 0 : 1;
+}
@@ -0,0 +1,24 @@
+/*
+ * bench_tasks.h
+ *
+ * Description:	tasks appended to the firmware task table for the host 
+ *				benchmark, force included into every host translation unit.
+ */ 
+
+
+#ifndef BENCH_TASKS_H_
+#define BENCH_TASKS_H_
+
+#define SCH_EXTRA_TASK_TABLE \
+	SCH_TASK(TASK_BENCH_0,	BENCH_Task,	TASK_PRIORITY_NORMAL) \
+	SCH_TASK(TASK_BENCH_1,	BENCH_Task,	TASK_PRIORITY_NORMAL) \
+	SCH_TASK(TASK_BENCH_2,	BENCH_Task,	TASK_PRIORITY_NORMAL) \
+	SCH_TASK(TASK_BENCH_3,	BENCH_Task,	TASK_PRIORITY_NORMAL) \
+	SCH_TASK(TASK_BENCH_4,	BENCH_Task,	TASK_PRIORITY_NORMAL) \
+	SCH_TASK(TASK_BENCH_5,	BENCH_Task,	TASK_PRIORITY_NORMAL) \
+	SCH_TASK(TASK_BENCH_6,	BENCH_Task,	TASK_PRIORITY_NORMAL) \
+	SCH_TASK(TASK_BENCH_7,	BENCH_Task,	TASK_PRIORITY_NORMAL)
+
+#define NUMBER_OF_BENCH_TASKS	8
+
+#endif /* BENCH_TASKS_H_ */
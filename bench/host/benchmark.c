@@ -0,0 +1,413 @@
+/*
+ * benchmark.c
+ *
+ * Description:	host microbenchmarks for the schedular, crc and packet handling
+ *				stages of the firmware. The firmware modules are compiled
+ *				unmodified against the register shim and driven by calling
+ *				the interrupt service routines directly.
+ */
+
+#include "schedular.h"
+#include "hardware.h"
+#include "serial.h"
+#include "communications.h"
+#include "timer.h"
+#include "clock.h"
+#include "hires_timer.h"
+#include "statistics.h"
+#include "utilities.h"
+#include "crc.h"
+
+#include <avr/io.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define DEFAULT_ITERATIONS					200000
+#define MAX_SPIN_DISPATCHES					10000
+#define BENCH_TIMERS						20
+
+#define UART_DATA_REGISTER_EMPTY_INTERRUPT_ENABLE	0x20
+
+// protocol constants, mirrored from communications.c
+#define START_OF_PACKET						0x73
+#define END_OF_PACKET						0xD9
+#define COMMAND_GET_STATUS_REQUEST			0x90
+#define DEFAULT_PACKET_SIZE					7
+#define DEFAULT_BYTES_INCLUDED_IN_CRC		4
+#define MAX_PACKET_BYTES					200
+
+#define CRC_BLOCK_SIZE						MAX_PACKET_BYTES
+
+// interrupt service routines provided by the firmware modules
+void USART0_RX_vect(void);
+void USART0_UDRE_vect(void);
+void TIMER0_COMPA_vect(void);
+
+typedef struct
+{
+	const char *name;
+	unsigned long packets;
+	unsigned long bytes;
+	unsigned long long elapsed_ns;
+}STAGE_RESULT;
+
+static volatile unsigned long bench_task_runs;
+static unsigned char bench_response[MAX_PACKET_BYTES];
+static unsigned short bench_response_length;
+
+// name:	now_ns
+// Desc:	returns a monotonic timestamp in nanoseconds.
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ((unsigned long long)ts.tv_sec * 1000000000ULL) + (unsigned long long)ts.tv_nsec;
+}
+
+// name:	init_firmware
+// Desc:	runs the module initialisation functions in the same order as main().
+static void init_firmware(void)
+{
+	SCH_Init();
+	CLK_Init();
+	STS_Init();
+	HRT_Init();
+	TMR_Init();
+	HDW_Init();
+	SRL_Init();
+	CMS_Init();
+}
+
+// name:	build_get_status_request
+// Desc:	builds a GET_STATUS request padded with additional data bytes
+//			and returns the total packet length.
+static unsigned short build_get_status_request(unsigned char *packet_ptr, unsigned char additional_bytes)
+{
+	unsigned short crc;
+	unsigned char i;
+
+	packet_ptr[0] = START_OF_PACKET;
+	packet_ptr[1] = additional_bytes;
+	packet_ptr[2] = COMMAND_GET_STATUS_REQUEST;
+	packet_ptr[3] = 0x00;
+	//
+	for(i = 0; i < additional_bytes; i++)
+	{
+		packet_ptr[DEFAULT_BYTES_INCLUDED_IN_CRC + i] = (unsigned char)(i * 31);
+	}
+	//
+	crc = CRC_Calculate_crc(packet_ptr, (DEFAULT_BYTES_INCLUDED_IN_CRC + additional_bytes));
+	//
+	packet_ptr[DEFAULT_BYTES_INCLUDED_IN_CRC + additional_bytes] = GET_16_BIT_LSB(crc);
+	packet_ptr[DEFAULT_BYTES_INCLUDED_IN_CRC + additional_bytes + 1] = GET_16_BIT_MSB(crc);
+	packet_ptr[DEFAULT_BYTES_INCLUDED_IN_CRC + additional_bytes + 2] = END_OF_PACKET;
+
+	return (DEFAULT_PACKET_SIZE + additional_bytes);
+}
+
+// name:	receive_bytes
+// Desc:	feeds bytes into the firmware through the usart receive interrupt.
+static void receive_bytes(const unsigned char *data_ptr, unsigned short length)
+{
+	unsigned short i;
+
+	for(i = 0; i < length; i++)
+	{
+		UCSR0A = 0;
+		UDR0 = data_ptr[i];
+		USART0_RX_vect();
+	}
+}
+
+// name:	run_until_response_queued
+// Desc:	runs background tasks until the firmware starts transmitting,
+//			returns False if no response appeared.
+static Boolean run_until_response_queued(void)
+{
+	unsigned short dispatches;
+
+	for(dispatches = 0; dispatches < MAX_SPIN_DISPATCHES; dispatches++)
+	{
+		if(0 != (UCSR0B & UART_DATA_REGISTER_EMPTY_INTERRUPT_ENABLE))
+		{
+			return True;
+		}
+		//
+		SCH_Run_background_tasks();
+	}
+
+	return False;
+}
+
+// name:	drain_transmitter
+// Desc:	clocks every queued byte out through the data register empty
+//			interrupt, capturing the bytes that were sent. The interrupt 
+//			turns itself off instead of loading a byte once the buffer is empty.
+static void drain_transmitter(void)
+{
+	bench_response_length = 0;
+	//
+	while(0 != (UCSR0B & UART_DATA_REGISTER_EMPTY_INTERRUPT_ENABLE))
+	{
+		USART0_UDRE_vect();
+		//
+		if((0 != (UCSR0B & UART_DATA_REGISTER_EMPTY_INTERRUPT_ENABLE)) && (bench_response_length < MAX_PACKET_BYTES))
+		{
+			bench_response[bench_response_length++] = UDR0;
+		}
+	}
+}
+
+// name:	BENCH_Task
+// Desc:	empty task used to measure schedular overhead.
+void BENCH_Task(void)
+{
+	bench_task_runs++;
+}
+
+// name:	bench_crc
+// Desc:	crc throughput over maximum sized packets.
+static STAGE_RESULT bench_crc(unsigned long iterations)
+{
+	STAGE_RESULT result = {"crc", 0, 0, 0};
+	unsigned char block[CRC_BLOCK_SIZE];
+	volatile unsigned short sink = 0;
+	unsigned long long start;
+	unsigned long i;
+
+	for(i = 0; i < CRC_BLOCK_SIZE; i++)
+	{
+		block[i] = (unsigned char)(i * 7);
+	}
+	//
+	start = now_ns();
+	//
+	for(i = 0; i < iterations; i++)
+	{
+		block[0] = (unsigned char)i;
+		sink ^= CRC_Calculate_crc(block, CRC_BLOCK_SIZE);
+	}
+	//
+	result.elapsed_ns = now_ns() - start;
+	result.packets = iterations;
+	result.bytes = iterations * CRC_BLOCK_SIZE;
+	(void)sink;
+
+	return result;
+}
+
+// name:	bench_schedular
+// Desc:	cost of one signal plus one dispatch of an empty task.
+static STAGE_RESULT bench_schedular(unsigned long iterations)
+{
+	STAGE_RESULT result = {"schedular signal+run", 0, 0, 0};
+	unsigned long long start;
+	unsigned long i;
+	unsigned char j;
+
+	SCH_Init();
+	//
+	bench_task_runs = 0;
+	start = now_ns();
+	//
+	for(i = 0; i < iterations; i++)
+	{
+		for(j = 0; j < NUMBER_OF_BENCH_TASKS; j++)
+		{
+			SCH_Signal_task((TASK_BENCH_0 + j), SELF_TRIGGERED);
+		}
+		//
+		for(j = 0; j < NUMBER_OF_BENCH_TASKS; j++)
+		{
+			SCH_Run_background_tasks();
+		}
+	}
+	//
+	result.elapsed_ns = now_ns() - start;
+	result.packets = bench_task_runs;
+
+	return result;
+}
+
+// name:	bench_timers
+// Desc:	cost of the timer interrupt with a number of periodic timers active.
+static STAGE_RESULT bench_timers(unsigned long iterations)
+{
+	STAGE_RESULT result = {"timer isr (20 timers)", 0, 0, 0};
+	unsigned long long start;
+	unsigned long i;
+	unsigned char j;
+
+	SCH_Init();
+	TMR_Init();
+	//
+	// spread the reload counts so a few timers expire on each interrupt
+	for(j = 0; j < BENCH_TIMERS; j++)
+	{
+		TMR_Set_timer_to_signal_task((TASK_BENCH_0 + (j % NUMBER_OF_BENCH_TASKS)), (TIMER_COUNT)(1 + j), (TIMER_COUNT)(1 + (j * 5)));
+	}
+	//
+	start = now_ns();
+	//
+	for(i = 0; i < iterations; i++)
+	{
+		TIMER0_COMPA_vect();
+		//
+		if(True == SCH_Are_tasks_pending())
+		{
+			SCH_Init();
+		}
+	}
+	//
+	result.elapsed_ns = now_ns() - start;
+	result.packets = iterations;
+
+	return result;
+}
+
+// name:	bench_packets
+// Desc:	end to end GET_STATUS handling, optionally split into stages.
+static void bench_packets(unsigned long iterations, unsigned char additional_bytes, STAGE_RESULT *results_ptr)
+{
+	unsigned char request[MAX_PACKET_BYTES];
+	unsigned short request_length;
+	unsigned long long start;
+	unsigned long long stage_start;
+	unsigned long responses;
+	unsigned long i;
+
+	init_firmware();
+	//
+	request_length = build_get_status_request(request, additional_bytes);
+	responses = 0;
+	//
+	// stage 0 is the uninstrumented end to end run
+	start = now_ns();
+	//
+	for(i = 0; i < iterations; i++)
+	{
+		receive_bytes(request, request_length);
+		//
+		if(True == run_until_response_queued())
+		{
+			drain_transmitter();
+			responses++;
+		}
+	}
+	//
+	results_ptr[0].elapsed_ns = now_ns() - start;
+	results_ptr[0].packets = responses;
+	results_ptr[0].bytes = responses * request_length;
+	//
+	// stages 1 to 3 time each part of the same loop separately
+	for(i = 0; i < iterations; i++)
+	{
+		stage_start = now_ns();
+		receive_bytes(request, request_length);
+		results_ptr[1].elapsed_ns += now_ns() - stage_start;
+		//
+		stage_start = now_ns();
+		if(True == run_until_response_queued())
+		{
+			results_ptr[2].elapsed_ns += now_ns() - stage_start;
+			//
+			stage_start = now_ns();
+			drain_transmitter();
+			results_ptr[3].elapsed_ns += now_ns() - stage_start;
+			//
+			results_ptr[1].packets++;
+			results_ptr[2].packets++;
+			results_ptr[3].packets++;
+			results_ptr[1].bytes += request_length;
+			results_ptr[2].bytes += request_length;
+			results_ptr[3].bytes += bench_response_length;
+		}
+	}
+	//
+	if((responses != iterations) || (bench_response[0] != START_OF_PACKET))
+	{
+		fprintf(stderr, "warning: %lu of %lu requests (%u data bytes) were answered\n", responses, iterations, additional_bytes);
+	}
+}
+
+// name:	print_result
+// Desc:	prints a single stage result line.
+static void print_result(const STAGE_RESULT *result_ptr)
+{
+	double seconds = (double)result_ptr->elapsed_ns / 1e9;
+	double packets_per_second = 0.0;
+	double bytes_per_second = 0.0;
+	double ns_per_byte = 0.0;
+
+	if(seconds > 0.0)
+	{
+		packets_per_second = (double)result_ptr->packets / seconds;
+		bytes_per_second = (double)result_ptr->bytes / seconds;
+	}
+	//
+	if(0 != result_ptr->bytes)
+	{
+		ns_per_byte = (double)result_ptr->elapsed_ns / (double)result_ptr->bytes;
+		printf("%-34s %14.0f %14.0f %10.2f\n", result_ptr->name, packets_per_second, bytes_per_second, ns_per_byte);
+	}
+	else
+	{
+		printf("%-34s %14.0f %14s %10s\n", result_ptr->name, packets_per_second, "-", "-");
+	}
+}
+
+// name:	main
+// Desc:	runs every benchmark stage and prints a summary table.
+int main(int argc, char *argv[])
+{
+	static const unsigned char payload_sizes[] = {0, 64, 193};
+	STAGE_RESULT packet_results[4];
+	STAGE_RESULT result;
+	char names[4][40];
+	unsigned long iterations = DEFAULT_ITERATIONS;
+	unsigned char i;
+
+	if(argc > 1)
+	{
+		iterations = strtoul(argv[1], NULL, 0);
+	}
+	//
+	printf("%-34s %14s %14s %10s\n", "stage", "packets/s", "bytes/s", "ns/byte");
+	//
+	result = bench_crc(iterations);
+	print_result(&result);
+	//
+	result = bench_schedular(iterations);
+	print_result(&result);
+	//
+	result = bench_timers(iterations);
+	print_result(&result);
+	//
+	for(i = 0; i < sizeof(payload_sizes); i++)
+	{
+		memset(packet_results, 0, sizeof(packet_results));
+		//
+		snprintf(names[0], sizeof(names[0]), "get_status +%u end to end", payload_sizes[i]);
+		snprintf(names[1], sizeof(names[1]), "get_status +%u rx isr", payload_sizes[i]);
+		snprintf(names[2], sizeof(names[2]), "get_status +%u populate+parse", payload_sizes[i]);
+		snprintf(names[3], sizeof(names[3]), "get_status +%u tx isr", payload_sizes[i]);
+		packet_results[0].name = names[0];
+		packet_results[1].name = names[1];
+		packet_results[2].name = names[2];
+		packet_results[3].name = names[3];
+		//
+		bench_packets(iterations / (1 + (payload_sizes[i] / 16)), payload_sizes[i], packet_results);
+		//
+		print_result(&packet_results[0]);
+		print_result(&packet_results[1]);
+		print_result(&packet_results[2]);
+		print_result(&packet_results[3]);
+	}
+
+	return 0;
+}
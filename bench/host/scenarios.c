@@ -0,0 +1,1513 @@
+/*
+ * scenarios.c
+ *
+ * Description:	host functional scenarios for the protocol paths which the
+ *				benchmark doesn't reach. The firmware modules are compiled
+ *				unmodified against the register shim, bytes are fed in and
+ *				clocked out through the interrupt service routines and time
+ *				is moved on through the timer interrupt. Exits non zero if
+ *				any check fails.
+ */
+
+#include "schedular.h"
+#include "hardware.h"
+#include "serial.h"
+#include "communications.h"
+#include "timer.h"
+#include "clock.h"
+#include "hires_timer.h"
+#include "statistics.h"
+#include "utilities.h"
+#include "crc.h"
+
+#include <avr/io.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#define MAX_SPIN_DISPATCHES					1000
+#define MAX_EXCHANGE_ROUNDS					8
+#define TIMER_TICK_MS						10
+#define TIMER_TICK_COUNTS					79
+
+#define UART_TX_COMPLETE_INTERRUPT_ENABLE			0x40
+#define UART_DATA_REGISTER_EMPTY_INTERRUPT_ENABLE	0x20
+#define TRANSMIT_COMPLETE							0x40
+#define DATA_REGISTER_EMPTY							0x20
+#define RECEIVER_ENABLE								0x10
+#define UART_RX_INTERRUPT_ENABLE					0x80
+#define RS485_DRIVER_ENABLE_PIN						(1<<6)
+#define OUTPUT_COMPARE_A_INTERRUPT_ENABLE			0x02
+
+// protocol constants, mirrored from communications.c
+#define START_OF_PACKET						0x73
+#define ADDRESSED_START_OF_PACKET			0x74
+#define NO_ADDRESS							-1
+#define END_OF_PACKET						0xD9
+#define COMMAND_IS_REQUEST					0x80
+#define BYTE_COUNT_BYTE						1
+#define COMMAND_BYTE						2
+#define START_OF_ADDITIONAL_DATA			4
+#define DEFAULT_PACKET_SIZE					7
+#define MAX_PACKET_BYTES					200
+#define REQUEST_SEQUENCE_NUMBER_BYTE		START_OF_ADDITIONAL_DATA
+#define MAX_TIMERS							24
+#define REQUEST_TIMEOUT_MS					500
+#define REQUEST_RETRIES						2
+#define HIRES_PERIODS						20
+#define BATCH_NOT_HANDLED					0xFF
+#define BATCH_MALFORMED						0xFE
+#define BATCH_NO_ROOM						0xFD
+#define UNHANDLED_COMMAND					0x7E
+#define BYTE_TIME_US						87
+#define TIME_SYNC_RECEIVE_TIME_BYTE			START_OF_ADDITIONAL_DATA
+#define TIME_SYNC_TRANSMIT_TIME_BYTE		(START_OF_ADDITIONAL_DATA + 4)
+#define TIME_SYNC_ECHO_BYTE					(START_OF_ADDITIONAL_DATA + 8)
+
+#define STATS_FORMAT_VERSION				3
+#define STATS_NUMBER_OF_ISRS_BYTE			2
+#define STATS_NUMBER_OF_TASKS_BYTE			3
+#define STATS_COUNTERS_BYTE					4
+#define STATS_FIRST_TIMING_BYTE				(STATS_COUNTERS_BYTE + (2 * NUMBER_OF_STS_COUNTERS) + (2 * NUMBER_OF_STS_HIGH_WATERS))
+#define STATS_NUMBER_OF_TIMINGS_BYTE		(STATS_FIRST_TIMING_BYTE + 1)
+#define STATS_TIMINGS_BYTE					(STATS_FIRST_TIMING_BYTE + 2)
+#define STATS_TIMING_BYTES					12
+#define STATS_TIMINGS						(NUMBER_OF_STS_ISRS + NUMBER_OF_TASKS)
+// a command the unit sends requests for
+#define SCENARIO_REQUEST_COMMAND			0x21
+#define SCENARIO_REGISTERED_COMMAND			0x22
+
+#define CHECK(condition)					check((condition), #condition, __LINE__)
+
+// interrupt service routines provided by the firmware modules
+void USART0_RX_vect(void);
+void USART0_UDRE_vect(void);
+void USART0_TX_vect(void);
+void USART1_RX_vect(void);
+void USART1_UDRE_vect(void);
+void USART1_TX_vect(void);
+void TIMER0_COMPA_vect(void);
+void TIMER1_COMPA_vect(void);
+void TIMER1_OVF_vect(void);
+
+// the registers and interrupts of each usart
+typedef struct
+{
+	volatile uint8_t *ucsra_ptr;
+	volatile uint8_t *ucsrb_ptr;
+	volatile uint8_t *ubrrl_ptr;
+	volatile uint8_t *udr_ptr;
+	void (*receive_isr)(void);
+	void (*data_register_empty_isr)(void);
+	void (*transmit_complete_isr)(void);
+}HOST_PORT;
+
+static const HOST_PORT host_ports[NUMBER_OF_SRL_PORTS] =
+{
+	{ &UCSR0A, &UCSR0B, &UBRR0L, &UDR0, USART0_RX_vect, USART0_UDRE_vect, USART0_TX_vect },
+	{ &UCSR1A, &UCSR1B, &UBRR1L, &UDR1, USART1_RX_vect, USART1_UDRE_vect, USART1_TX_vect }
+};
+
+static unsigned short scenario_failures;
+static unsigned short scenario_checks;
+static const char *scenario_name;
+
+// how the last request we sent finished
+static unsigned char requests_finished;
+static CMS_REQUEST_RESULT request_result;
+static unsigned char request_response[MAX_PACKET_BYTES];
+static unsigned char request_response_length;
+
+// how many times a bench task has run
+static unsigned short bench_task_runs;
+
+// the order the bench tasks ran in
+static char task_log[16];
+static unsigned char task_log_length;
+
+// how many times the counting command has run
+static unsigned short counting_command_runs;
+
+// when each high resolution timer callback ran
+static unsigned long hires_callback_times_us[HIRES_PERIODS];
+static unsigned char hires_callbacks;
+
+// what the rs-485 driver enable and receiver did while port 1 was draining
+static unsigned short bus_bytes_sent;
+static unsigned short bus_bytes_sent_driving;
+static Boolean bus_receiver_on_while_driving;
+static Boolean bus_driven_at_transmit_complete;
+
+// name:	resumable_task
+// Desc:	notes each step in the task log and yields between them, signalling 
+//			the first bench task each time so it runs in between.
+static void resumable_task(void)
+{
+	SCH_TASK_BEGIN();
+	task_log[task_log_length++] = 'A';
+	SCH_Signal_task(TASK_BENCH_0, SELF_TRIGGERED);
+	SCH_TASK_YIELD();
+	task_log[task_log_length++] = 'B';
+	SCH_Signal_task(TASK_BENCH_0, SELF_TRIGGERED);
+	SCH_TASK_YIELD();
+	task_log[task_log_length++] = 'C';
+	SCH_TASK_END();
+}
+
+// name:	BENCH_Task
+// Desc:	counts the runs of the bench tasks, which scenarios signal, noting 
+//			them in the task log. The second bench task is resumable.
+void BENCH_Task(void)
+{
+	if(TASK_BENCH_1 == SCH_Get_running_task())
+	{
+		resumable_task();
+	}
+	else
+	{
+		bench_task_runs++;
+		//
+		if(task_log_length < sizeof(task_log))
+		{
+			task_log[task_log_length++] = 'o';
+		}
+	}
+}
+
+// name:	record_hires_callback
+// Desc:	notes when a high resolution timer callback ran.
+static void record_hires_callback(void)
+{
+	if(hires_callbacks < HIRES_PERIODS)
+	{
+		hires_callback_times_us[hires_callbacks] = CLK_Get_time_us();
+	}
+	//
+	hires_callbacks++;
+}
+
+// name:	check
+// Desc:	counts a check and reports it if it failed.
+static void check(Boolean passed, const char *condition_ptr, unsigned short line)
+{
+	scenario_checks++;
+	//
+	if(False == passed)
+	{
+		scenario_failures++;
+		printf("FAIL %s: %s (line %u)\n", scenario_name, condition_ptr, line);
+	}
+}
+
+// name:	init_firmware
+// Desc:	runs the module initialisation functions in the same order as main().
+static void init_firmware(void)
+{
+	SCH_Init();
+	CLK_Init();
+	STS_Init();
+	HRT_Init();
+	TMR_Init();
+	HDW_Init();
+	SRL_Init();
+	CMS_Init();
+	//
+	UCSR0A = DATA_REGISTER_EMPTY;
+	UCSR1A = DATA_REGISTER_EMPTY;
+	//
+	// the firmware clears interrupt flags by writing a one to them, which 
+	// sets them here. A set compare match flag makes new timers wait an 
+	// extra interval and a set overflow flag puts the clock 65ms ahead.
+	TIFR0 = 0;
+	TIFR1 = 0;
+}
+
+// name:	build_packet
+// Desc:	builds a packet, addressed unless the address is NO_ADDRESS, and 
+//			returns its length.
+static unsigned short build_packet(unsigned char *packet_ptr, int address, unsigned char command, const unsigned char *data_ptr, unsigned char data_length)
+{
+	unsigned short crc;
+	unsigned char prefix_bytes = 0;
+
+	if(NO_ADDRESS != address)
+	{
+		*packet_ptr++ = ADDRESSED_START_OF_PACKET;
+		*packet_ptr = (unsigned char)address;
+		prefix_bytes = 1;
+	}
+	else
+	{
+		*packet_ptr = START_OF_PACKET;
+	}
+	//
+	packet_ptr[1] = data_length;
+	packet_ptr[2] = command;
+	packet_ptr[3] = 0x00;
+	memcpy(&packet_ptr[START_OF_ADDITIONAL_DATA], data_ptr, data_length);
+	//
+	crc = CRC_Calculate_crc(packet_ptr - prefix_bytes, prefix_bytes + START_OF_ADDITIONAL_DATA + data_length);
+	//
+	packet_ptr[START_OF_ADDITIONAL_DATA + data_length] = GET_16_BIT_LSB(crc);
+	packet_ptr[START_OF_ADDITIONAL_DATA + data_length + 1] = GET_16_BIT_MSB(crc);
+	packet_ptr[START_OF_ADDITIONAL_DATA + data_length + 2] = END_OF_PACKET;
+
+	return (prefix_bytes + DEFAULT_PACKET_SIZE + data_length);
+}
+
+// name:	receive_bytes
+// Desc:	feeds bytes into the port's receive interrupt.
+static void receive_bytes(SRL_PORT port, const unsigned char *data_ptr, unsigned short length)
+{
+	unsigned short i;
+
+	for(i = 0; i < length; i++)
+	{
+		*host_ports[port].ucsra_ptr &= (uint8_t)(TRANSMIT_COMPLETE | DATA_REGISTER_EMPTY);
+		*host_ports[port].udr_ptr = data_ptr[i];
+		host_ports[port].receive_isr();
+	}
+}
+
+// name:	send_request
+// Desc:	feeds a request for the command to the port.
+static void send_request(SRL_PORT port, unsigned char command, const unsigned char *data_ptr, unsigned char data_length)
+{
+	unsigned char packet[MAX_PACKET_BYTES];
+
+	receive_bytes(port, packet, build_packet(packet, NO_ADDRESS, command | COMMAND_IS_REQUEST, data_ptr, data_length));
+}
+
+// name:	send_addressed_request
+// Desc:	feeds a request for the command sent to the address to the port.
+static void send_addressed_request(SRL_PORT port, unsigned char address, unsigned char command, const unsigned char *data_ptr, unsigned char data_length)
+{
+	unsigned char packet[MAX_PACKET_BYTES + 1];
+
+	receive_bytes(port, packet, build_packet(packet, address, command | COMMAND_IS_REQUEST, data_ptr, data_length));
+}
+
+// name:	get_32_bit_value
+// Desc:	reads a little endian value from a packet.
+static unsigned long get_32_bit_value(const unsigned char *data_ptr)
+{
+	return ((unsigned long)data_ptr[0] | ((unsigned long)data_ptr[1] << 8) |
+			((unsigned long)data_ptr[2] << 16) | ((unsigned long)data_ptr[3] << 24));
+}
+
+// name:	run_tasks
+// Desc:	runs background tasks until none are pending.
+static void run_tasks(void)
+{
+	unsigned short dispatches;
+
+	for(dispatches = 0; (dispatches < MAX_SPIN_DISPATCHES) && (True == SCH_Are_tasks_pending()); dispatches++)
+	{
+		SCH_Run_background_tasks();
+	}
+}
+
+// name:	receive_bytes_at
+// Desc:	feeds bytes into the port's receive interrupt a byte time apart 
+//			from the start time on the clock, running the tasks after each 
+//			as the firmware would.
+static void receive_bytes_at(SRL_PORT port, const unsigned char *data_ptr, unsigned short length, unsigned short start_time_us)
+{
+	unsigned short i;
+
+	for(i = 0; i < length; i++)
+	{
+		TCNT1 = start_time_us + (i * BYTE_TIME_US);
+		receive_bytes(port, &data_ptr[i], 1);
+		run_tasks();
+	}
+}
+
+// name:	drain_port
+// Desc:	clocks everything queued out of the port through the data register
+//			empty interrupt, then finishes the last byte as the uart would. 
+//			Transmit complete is only flagged if a byte went out and its 
+//			interrupt only runs if the flag is set, writing the flag clears 
+//			it as on the part. Returns the number of bytes sent.
+static unsigned short drain_port(SRL_PORT port, unsigned char *data_ptr, unsigned short maximum_bytes)
+{
+	const HOST_PORT *host_port_ptr = &host_ports[port];
+	unsigned short bytes_sent = 0;
+	uint8_t status;
+
+	while(0 != (*host_port_ptr->ucsrb_ptr & UART_DATA_REGISTER_EMPTY_INTERRUPT_ENABLE))
+	{
+		status = *host_port_ptr->ucsra_ptr | DATA_REGISTER_EMPTY;
+		*host_port_ptr->ucsra_ptr = status;
+		host_port_ptr->data_register_empty_isr();
+		//
+		if(0 != (*host_port_ptr->ucsrb_ptr & UART_DATA_REGISTER_EMPTY_INTERRUPT_ENABLE))
+		{
+			if(bytes_sent < maximum_bytes)
+			{
+				data_ptr[bytes_sent] = *host_port_ptr->udr_ptr;
+			}
+			//
+			bytes_sent++;
+			*host_port_ptr->ucsra_ptr &= (uint8_t)~TRANSMIT_COMPLETE;
+			//
+			if(SRL_PORT_1 == port)
+			{
+				bus_bytes_sent++;
+				//
+				if(0 != (PORTD & RS485_DRIVER_ENABLE_PIN))
+				{
+					bus_bytes_sent_driving++;
+					//
+					if(0 != (*host_port_ptr->ucsrb_ptr & (RECEIVER_ENABLE | UART_RX_INTERRUPT_ENABLE)))
+					{
+						bus_receiver_on_while_driving = True;
+					}
+				}
+			}
+		}
+	}
+	//
+	if(0 != bytes_sent)
+	{
+		*host_port_ptr->ucsra_ptr |= (TRANSMIT_COMPLETE | DATA_REGISTER_EMPTY);
+		//
+		if(SRL_PORT_1 == port)
+		{
+			bus_driven_at_transmit_complete = (0 != (PORTD & RS485_DRIVER_ENABLE_PIN)) ? True : False;
+		}
+	}
+	//
+	if((0 != (*host_port_ptr->ucsrb_ptr & UART_TX_COMPLETE_INTERRUPT_ENABLE)) && (0 != (*host_port_ptr->ucsra_ptr & TRANSMIT_COMPLETE)))
+	{
+		*host_port_ptr->ucsra_ptr &= (uint8_t)~TRANSMIT_COMPLETE;
+		host_port_ptr->transmit_complete_isr();
+	}
+
+	return (bytes_sent < maximum_bytes) ? bytes_sent : maximum_bytes;
+}
+
+// name:	exchange
+// Desc:	runs the tasks and drains the port until nothing more is sent,
+//			returns the number of bytes sent.
+static unsigned short exchange(SRL_PORT port, unsigned char *data_ptr, unsigned short maximum_bytes)
+{
+	unsigned short bytes_sent = 0;
+	unsigned short bytes_drained;
+	unsigned char rounds;
+
+	for(rounds = 0; rounds < MAX_EXCHANGE_ROUNDS; rounds++)
+	{
+		run_tasks();
+		bytes_drained = drain_port(port, &data_ptr[bytes_sent], maximum_bytes - bytes_sent);
+		bytes_sent += bytes_drained;
+	}
+
+	return bytes_sent;
+}
+
+// name:	advance_ms
+// Desc:	moves time on through the timer interrupt, running the tasks and 
+//			draining both ports after each one. Stops early if no timers are 
+//			running. Returns the number of bytes the passed port sent.
+static unsigned short advance_ms(unsigned short milliseconds, SRL_PORT port, unsigned char *data_ptr, unsigned short maximum_bytes)
+{
+	unsigned char scratch[MAX_PACKET_BYTES];
+	unsigned short ticks_left = milliseconds / TIMER_TICK_MS;
+	unsigned short ticks;
+	unsigned short bytes_sent = 0;
+	unsigned char other_port;
+
+	while((0 != ticks_left) && (0 != TIMSK0))
+	{
+		ticks = (OCR0A + 1) / TIMER_TICK_COUNTS;
+		TIMER0_COMPA_vect();
+		TIFR0 = 0;
+		bytes_sent += exchange(port, &data_ptr[bytes_sent], maximum_bytes - bytes_sent);
+		//
+		for(other_port = 0; other_port < NUMBER_OF_SRL_PORTS; other_port++)
+		{
+			if(port != other_port)
+			{
+				exchange((SRL_PORT)other_port, scratch, sizeof(scratch));
+			}
+		}
+		//
+		ticks_left = (ticks >= ticks_left) ? 0 : (ticks_left - ticks);
+	}
+
+	return bytes_sent;
+}
+
+// name:	advance_ms_without_sending
+// Desc:	moves time on through the timer interrupt and runs the tasks after 
+//			each one, without sending anything, as if the ports were backed 
+//			up. Stops early if no timers are running.
+static void advance_ms_without_sending(unsigned short milliseconds)
+{
+	unsigned short ticks_left = milliseconds / TIMER_TICK_MS;
+	unsigned short ticks;
+
+	while((0 != ticks_left) && (0 != TIMSK0))
+	{
+		ticks = (OCR0A + 1) / TIMER_TICK_COUNTS;
+		TIMER0_COMPA_vect();
+		TIFR0 = 0;
+		run_tasks();
+		//
+		ticks_left = (ticks >= ticks_left) ? 0 : (ticks_left - ticks);
+	}
+}
+
+// name:	is_packet_from
+// Desc:	checks a sent packet is whole with a good crc and the command byte, 
+//			addressed from the address unless that is NO_ADDRESS.
+static Boolean is_packet_from(const unsigned char *packet_ptr, unsigned short length, int address, unsigned char command)
+{
+	const unsigned char *header_ptr = packet_ptr;
+	unsigned short crc;
+	Boolean response_good = False;
+
+	if(NO_ADDRESS != address)
+	{
+		header_ptr++;
+		//
+		if((length < 2) || (ADDRESSED_START_OF_PACKET != packet_ptr[0]) || (address != packet_ptr[1]))
+		{
+			length = 0;
+		}
+	}
+	else if((0 == length) || (START_OF_PACKET != packet_ptr[0]))
+	{
+		length = 0;
+	}
+	//
+	if((length >= (header_ptr - packet_ptr) + DEFAULT_PACKET_SIZE) && (length == ((header_ptr - packet_ptr) + DEFAULT_PACKET_SIZE + header_ptr[BYTE_COUNT_BYTE])) &&
+		(command == header_ptr[COMMAND_BYTE]) && (END_OF_PACKET == packet_ptr[length - 1]))
+	{
+		crc = CRC_Calculate_crc(packet_ptr, length - 3);
+		response_good = ((GET_16_BIT_LSB(crc) == packet_ptr[length - 3]) && (GET_16_BIT_MSB(crc) == packet_ptr[length - 2]));
+	}
+
+	return response_good;
+}
+
+// name:	is_packet
+// Desc:	checks a sent packet is a whole unaddressed packet with the command byte.
+static Boolean is_packet(const unsigned char *packet_ptr, unsigned short length, unsigned char command)
+{
+	return is_packet_from(packet_ptr, length, NO_ADDRESS, command);
+}
+
+// name:	record_request_result
+// Desc:	response handler for the requests the scenarios send.
+static void record_request_result(CMS_REQUEST_RESULT result, const unsigned char *response_data_ptr, unsigned char response_data_length)
+{
+	requests_finished++;
+	request_result = result;
+	request_response_length = response_data_length;
+	memcpy(request_response, response_data_ptr, response_data_length);
+}
+
+// name:	echo_command
+// Desc:	registered command handler which sends the request data back.
+static unsigned char echo_command(const unsigned char *request_data_ptr, unsigned char request_data_length, unsigned char *response_data_ptr)
+{
+	memcpy(response_data_ptr, request_data_ptr, request_data_length);
+
+	return request_data_length;
+}
+
+// name:	scenario_baud_rate_fallback
+// Desc:	negotiates a faster rate then sends nothing, after the confirm
+//			timeout the port must be back at the default rate and answering.
+static void scenario_baud_rate_fallback(void)
+{
+	unsigned char response[MAX_PACKET_BYTES];
+	unsigned char rate = SRL_BAUD_RATE_500000;
+	unsigned short length;
+
+	scenario_name = "baud rate fallback";
+	init_firmware();
+	//
+	send_request(SRL_PORT_0, CMS_COMMAND_SET_BAUD_RATE, &rate, 1);
+	length = exchange(SRL_PORT_0, response, sizeof(response));
+	CHECK(True == is_packet(response, length, CMS_COMMAND_SET_BAUD_RATE));
+	CHECK(SRL_BAUD_RATE_500000 == response[START_OF_ADDITIONAL_DATA]);
+	CHECK(1 == UBRR0L);
+	//
+	// the host never follows so nothing arrives at the new rate
+	length = advance_ms(1200, SRL_PORT_0, response, sizeof(response));
+	CHECK(0 == length);
+	CHECK(SRL_DEFAULT_BAUD_RATE == SRL_Get_baud_rate(SRL_PORT_0));
+	CHECK(8 == UBRR0L);
+	//
+	send_request(SRL_PORT_0, CMS_COMMAND_GET_STATUS, NULL, 0);
+	length = exchange(SRL_PORT_0, response, sizeof(response));
+	CHECK(True == is_packet(response, length, CMS_COMMAND_GET_STATUS));
+	CHECK(8 == UBRR0L);
+}
+
+// name:	scenario_baud_rate_queue_full
+// Desc:	a SET_BAUD_RATE whose response can't be queued leaves the rate 
+//			alone, so the host's retry and the next response are at the old 
+//			rate, and the retry still changes it.
+static void scenario_baud_rate_queue_full(void)
+{
+	unsigned char response[MAX_PACKET_BYTES];
+	unsigned char filler = 0x55;
+	unsigned char rate = SRL_BAUD_RATE_500000;
+	SRL_TX_FRAGMENT fragment = { &filler, 1 };
+	unsigned short length;
+
+	scenario_name = "baud rate queue full";
+	init_firmware();
+	//
+	while(True == SRL_Queue_data_to_transmit(SRL_PORT_0, &fragment, 1, NO_TASK))
+	{
+	}
+	//
+	send_request(SRL_PORT_0, CMS_COMMAND_SET_BAUD_RATE, &rate, 1);
+	run_tasks();
+	CHECK(SRL_DEFAULT_BAUD_RATE == SRL_Get_baud_rate(SRL_PORT_0));
+	drain_port(SRL_PORT_0, response, sizeof(response));
+	//
+	send_request(SRL_PORT_0, CMS_COMMAND_GET_STATUS, NULL, 0);
+	length = exchange(SRL_PORT_0, response, sizeof(response));
+	CHECK(True == is_packet(response, length, CMS_COMMAND_GET_STATUS));
+	CHECK(SRL_DEFAULT_BAUD_RATE == SRL_Get_baud_rate(SRL_PORT_0));
+	CHECK(8 == UBRR0L);
+	//
+	send_request(SRL_PORT_0, CMS_COMMAND_SET_BAUD_RATE, &rate, 1);
+	length = exchange(SRL_PORT_0, response, sizeof(response));
+	CHECK(True == is_packet(response, length, CMS_COMMAND_SET_BAUD_RATE));
+	CHECK(1 == UBRR0L);
+}
+
+// name:	scenario_registered_command
+// Desc:	a command registered at run time is answered by its handler, and 
+//			one already handled, out of range or past the last free entry 
+//			can't be registered.
+static void scenario_registered_command(void)
+{
+	unsigned char response[MAX_PACKET_BYTES];
+	unsigned char data[3] = { 0x73, 0x22, 0xD9 };
+	unsigned short length;
+	unsigned char command;
+
+	scenario_name = "registered command";
+	init_firmware();
+	//
+	CHECK(True == CMS_Register_command(SCENARIO_REGISTERED_COMMAND, echo_command));
+	CHECK(False == CMS_Register_command(SCENARIO_REGISTERED_COMMAND, echo_command));
+	CHECK(False == CMS_Register_command(CMS_COMMAND_GET_STATUS, echo_command));
+	CHECK(False == CMS_Register_command(CMS_MAX_COMMANDS, echo_command));
+	CHECK(False == CMS_Register_command(SCENARIO_REGISTERED_COMMAND + 1, NULL));
+	//
+	send_request(SRL_PORT_0, SCENARIO_REGISTERED_COMMAND, data, sizeof(data));
+	length = exchange(SRL_PORT_0, response, sizeof(response));
+	CHECK(True == is_packet(response, length, SCENARIO_REGISTERED_COMMAND));
+	CHECK(sizeof(data) == response[BYTE_COUNT_BYTE]);
+	CHECK(0 == memcmp(&response[START_OF_ADDITIONAL_DATA], data, sizeof(data)));
+	//
+	for(command = SCENARIO_REGISTERED_COMMAND + 1; command < (SCENARIO_REGISTERED_COMMAND + CMS_MAX_REGISTERED_COMMANDS); command++)
+	{
+		CHECK(True == CMS_Register_command(command, echo_command));
+	}
+	//
+	CHECK(False == CMS_Register_command(command, echo_command));
+	//
+	// the built in commands are still there
+	send_request(SRL_PORT_0, CMS_COMMAND_GET_STATUS, NULL, 0);
+	length = exchange(SRL_PORT_0, response, sizeof(response));
+	CHECK(True == is_packet(response, length, CMS_COMMAND_GET_STATUS));
+}
+
+// name:	scenario_unaddressed_port
+// Desc:	a port which isn't on a bus doesn't answer addressed packets.
+static void scenario_unaddressed_port(void)
+{
+	unsigned char response[MAX_PACKET_BYTES];
+	unsigned short length;
+
+	scenario_name = "unaddressed port";
+	init_firmware();
+	//
+	send_addressed_request(SRL_PORT_0, 0x05, CMS_COMMAND_GET_STATUS, NULL, 0);
+	CHECK(0 == exchange(SRL_PORT_0, response, sizeof(response)));
+	//
+	send_request(SRL_PORT_0, CMS_COMMAND_GET_STATUS, NULL, 0);
+	length = exchange(SRL_PORT_0, response, sizeof(response));
+	CHECK(True == is_packet(response, length, CMS_COMMAND_GET_STATUS));
+}
+
+#if (SRL_RS485 == SRL_RS485_PORT_1)
+// name:	clear_bus_observations
+// Desc:	forgets what the rs-485 lines did while port 1 was last drained.
+static void clear_bus_observations(void)
+{
+	bus_bytes_sent = 0;
+	bus_bytes_sent_driving = 0;
+	bus_receiver_on_while_driving = False;
+	bus_driven_at_transmit_complete = False;
+}
+
+// name:	scenario_bus_address_accept
+// Desc:	a request for the address the unit was built with is answered 
+//			from that address. The driver is on for every byte and still on 
+//			when the last one completes, then the bus is handed back.
+static void scenario_bus_address_accept(void)
+{
+	unsigned char response[MAX_PACKET_BYTES];
+	unsigned short length;
+
+	scenario_name = "bus address accept";
+	init_firmware();
+	CHECK(0 == (PORTD & RS485_DRIVER_ENABLE_PIN));
+	CHECK(0 != (DDRD & RS485_DRIVER_ENABLE_PIN));
+	//
+	clear_bus_observations();
+	send_addressed_request(SRL_PORT_1, CMS_BUS_ADDRESS, CMS_COMMAND_GET_STATUS, NULL, 0);
+	length = exchange(SRL_PORT_1, response, sizeof(response));
+	CHECK(True == is_packet_from(response, length, CMS_BUS_ADDRESS, CMS_COMMAND_GET_STATUS));
+	CHECK(length == bus_bytes_sent);
+	CHECK(bus_bytes_sent == bus_bytes_sent_driving);
+	CHECK(False == bus_receiver_on_while_driving);
+	CHECK(True == bus_driven_at_transmit_complete);
+	//
+	// released once the last stop bit has gone
+	CHECK(0 == (PORTD & RS485_DRIVER_ENABLE_PIN));
+	CHECK((RECEIVER_ENABLE | UART_RX_INTERRUPT_ENABLE) == (UCSR1B & (RECEIVER_ENABLE | UART_RX_INTERRUPT_ENABLE)));
+	CHECK(0 == (UCSR1B & UART_TX_COMPLETE_INTERRUPT_ENABLE));
+}
+
+// name:	scenario_bus_address_reject
+// Desc:	packets for other units, broadcasts and unaddressed packets get no 
+//			answer and never drive the bus, a request for the unit straight 
+//			after them still does.
+static void scenario_bus_address_reject(void)
+{
+	unsigned char response[MAX_PACKET_BYTES];
+	unsigned char data[4] = { 0x74, CMS_BUS_ADDRESS, 0x73, 0x00 };
+	unsigned short length;
+
+	scenario_name = "bus address reject";
+	init_firmware();
+	clear_bus_observations();
+	//
+	send_addressed_request(SRL_PORT_1, CMS_BUS_ADDRESS + 1, CMS_COMMAND_GET_STATUS, data, sizeof(data));
+	CHECK(0 == SRL_Get_number_of_bytes_in_rx_buffer(SRL_PORT_1));
+	CHECK(0 == exchange(SRL_PORT_1, response, sizeof(response)));
+	//
+	send_addressed_request(SRL_PORT_1, CMS_ADDRESS_BROADCAST, CMS_COMMAND_GET_STATUS, NULL, 0);
+	CHECK(0 == exchange(SRL_PORT_1, response, sizeof(response)));
+	//
+	send_request(SRL_PORT_1, CMS_COMMAND_GET_STATUS, NULL, 0);
+	CHECK(0 == SRL_Get_number_of_bytes_in_rx_buffer(SRL_PORT_1));
+	CHECK(0 == exchange(SRL_PORT_1, response, sizeof(response)));
+	CHECK(0 == bus_bytes_sent);
+	CHECK(0 == (PORTD & RS485_DRIVER_ENABLE_PIN));
+	//
+	send_addressed_request(SRL_PORT_1, CMS_BUS_ADDRESS, CMS_COMMAND_GET_STATUS, NULL, 0);
+	length = exchange(SRL_PORT_1, response, sizeof(response));
+	CHECK(True == is_packet_from(response, length, CMS_BUS_ADDRESS, CMS_COMMAND_GET_STATUS));
+	//
+	// port 0 isn't on the bus
+	send_request(SRL_PORT_0, CMS_COMMAND_GET_STATUS, NULL, 0);
+	length = exchange(SRL_PORT_0, response, sizeof(response));
+	CHECK(True == is_packet(response, length, CMS_COMMAND_GET_STATUS));
+}
+
+// name:	scenario_bus_broadcast_baud_rate
+// Desc:	a broadcast SET_BAUD_RATE isn't answered so the rate changes at 
+//			once, the next response is at the new rate and doesn't change it 
+//			again.
+static void scenario_bus_broadcast_baud_rate(void)
+{
+	unsigned char response[MAX_PACKET_BYTES];
+	unsigned char rate = SRL_BAUD_RATE_500000;
+	unsigned short length;
+
+	scenario_name = "bus broadcast baud rate";
+	init_firmware();
+	//
+	send_addressed_request(SRL_PORT_1, CMS_ADDRESS_BROADCAST, CMS_COMMAND_SET_BAUD_RATE, &rate, 1);
+	CHECK(0 == exchange(SRL_PORT_1, response, sizeof(response)));
+	CHECK(SRL_BAUD_RATE_500000 == SRL_Get_baud_rate(SRL_PORT_1));
+	CHECK(1 == UBRR1L);
+	//
+	// a packet at the new rate confirms it
+	send_addressed_request(SRL_PORT_1, CMS_BUS_ADDRESS, CMS_COMMAND_GET_STATUS, NULL, 0);
+	length = exchange(SRL_PORT_1, response, sizeof(response));
+	CHECK(True == is_packet_from(response, length, CMS_BUS_ADDRESS, CMS_COMMAND_GET_STATUS));
+	advance_ms(1200, SRL_PORT_1, response, sizeof(response));
+	CHECK(SRL_BAUD_RATE_500000 == SRL_Get_baud_rate(SRL_PORT_1));
+	CHECK(1 == UBRR1L);
+}
+
+// name:	scenario_bus_bridge
+// Desc:	the unit bridges the host and the bus. A request from the host it 
+//			has no handler for goes onto the bus at the broadcast address, 
+//			and one from the bus for this unit goes to the host without an 
+//			address, each with the crc worked out for its new prefix. 
+//			Responses to this unit that it isn't waiting for go to the host.
+static void scenario_bus_bridge(void)
+{
+	unsigned char packet[MAX_PACKET_BYTES + 1];
+	unsigned char response[MAX_PACKET_BYTES];
+	unsigned char data[3] = { 0x74, CMS_BUS_ADDRESS, 0x73 };
+	unsigned short length;
+
+	scenario_name = "bus bridge";
+	init_firmware();
+	clear_bus_observations();
+	//
+	send_request(SRL_PORT_0, UNHANDLED_COMMAND, data, sizeof(data));
+	run_tasks();
+	CHECK(0 == drain_port(SRL_PORT_0, response, sizeof(response)));
+	length = exchange(SRL_PORT_1, response, sizeof(response));
+	CHECK(True == is_packet_from(response, length, CMS_ADDRESS_BROADCAST, UNHANDLED_COMMAND | COMMAND_IS_REQUEST));
+	CHECK(0 == memcmp(&response[START_OF_ADDITIONAL_DATA + 1], data, sizeof(data)));
+	CHECK(length == bus_bytes_sent_driving);
+	//
+	send_addressed_request(SRL_PORT_1, CMS_BUS_ADDRESS, UNHANDLED_COMMAND, data, sizeof(data));
+	run_tasks();
+	CHECK(0 == drain_port(SRL_PORT_1, response, sizeof(response)));
+	length = exchange(SRL_PORT_0, response, sizeof(response));
+	CHECK(True == is_packet(response, length, UNHANDLED_COMMAND | COMMAND_IS_REQUEST));
+	CHECK(0 == memcmp(&response[START_OF_ADDITIONAL_DATA], data, sizeof(data)));
+	//
+	receive_bytes(SRL_PORT_1, packet, build_packet(packet, CMS_BUS_ADDRESS, SCENARIO_REQUEST_COMMAND, data, sizeof(data)));
+	length = exchange(SRL_PORT_0, response, sizeof(response));
+	CHECK(True == is_packet(response, length, SCENARIO_REQUEST_COMMAND));
+	//
+	// packets for other units on the bus are still dropped
+	send_addressed_request(SRL_PORT_1, CMS_BUS_ADDRESS + 1, UNHANDLED_COMMAND, data, sizeof(data));
+	CHECK(0 == exchange(SRL_PORT_0, response, sizeof(response)));
+}
+#else
+// name:	scenario_forwarding_between_ports
+// Desc:	a request with no handler goes out of the forwarding port whole 
+//			with a good crc, as does a response nothing is waiting for, and 
+//			nothing is passed on once forwarding is turned off.
+static void scenario_forwarding_between_ports(void)
+{
+	unsigned char packet[MAX_PACKET_BYTES];
+	unsigned char response[MAX_PACKET_BYTES];
+	unsigned char data[3] = { 0x73, 0x11, 0xD9 };
+	unsigned short length;
+
+	scenario_name = "forwarding between ports";
+	init_firmware();
+	CMS_Set_forwarding_port(SRL_PORT_0, SRL_PORT_1);
+	CMS_Set_forwarding_port(SRL_PORT_1, SRL_PORT_0);
+	//
+	send_request(SRL_PORT_0, UNHANDLED_COMMAND, data, sizeof(data));
+	run_tasks();
+	CHECK(0 == drain_port(SRL_PORT_0, response, sizeof(response)));
+	length = exchange(SRL_PORT_1, response, sizeof(response));
+	CHECK(True == is_packet(response, length, UNHANDLED_COMMAND | COMMAND_IS_REQUEST));
+	CHECK(0 == memcmp(&response[START_OF_ADDITIONAL_DATA], data, sizeof(data)));
+	//
+	receive_bytes(SRL_PORT_1, packet, build_packet(packet, NO_ADDRESS, SCENARIO_REQUEST_COMMAND, data, sizeof(data)));
+	length = exchange(SRL_PORT_0, response, sizeof(response));
+	CHECK(True == is_packet(response, length, SCENARIO_REQUEST_COMMAND));
+	//
+	// handled requests are still answered on their own port
+	send_request(SRL_PORT_0, CMS_COMMAND_GET_STATUS, NULL, 0);
+	length = exchange(SRL_PORT_0, response, sizeof(response));
+	CHECK(True == is_packet(response, length, CMS_COMMAND_GET_STATUS));
+	CHECK(0 == exchange(SRL_PORT_1, response, sizeof(response)));
+	//
+	CMS_Set_forwarding_port(SRL_PORT_0, SRL_PORT_0);
+	send_request(SRL_PORT_0, UNHANDLED_COMMAND, data, sizeof(data));
+	CHECK(0 == exchange(SRL_PORT_0, response, sizeof(response)));
+	CHECK(0 == exchange(SRL_PORT_1, response, sizeof(response)));
+}
+#endif
+
+// name:	send_byte
+// Desc:	runs the port's data register empty interrupt once and returns the 
+//			byte it sent.
+static unsigned char send_byte(SRL_PORT port)
+{
+	*host_ports[port].ucsra_ptr |= DATA_REGISTER_EMPTY;
+	host_ports[port].data_register_empty_isr();
+
+	return *host_ports[port].udr_ptr;
+}
+
+// name:	scenario_resumable_task
+// Desc:	a task which yields carries on from the yield the next time it 
+//			runs, with other tasks run in between, and starts again from the 
+//			top once it has finished. Run outside the schedular it always 
+//			starts from the top.
+static void scenario_resumable_task(void)
+{
+	scenario_name = "resumable task";
+	init_firmware();
+	run_tasks();
+	task_log_length = 0;
+	//
+	SCH_Signal_task(TASK_BENCH_1, SELF_TRIGGERED);
+	run_tasks();
+	CHECK((5 == task_log_length) && (0 == memcmp(task_log, "AoBoC", 5)));
+	//
+	task_log_length = 0;
+	SCH_Signal_task(TASK_BENCH_1, SELF_TRIGGERED);
+	run_tasks();
+	CHECK((5 == task_log_length) && (0 == memcmp(task_log, "AoBoC", 5)));
+	//
+	task_log_length = 0;
+	CHECK(0 == *SCH_Get_task_resume_point());
+	resumable_task();
+	resumable_task();
+	CHECK((2 == task_log_length) && (0 == memcmp(task_log, "AA", 2)));
+	run_tasks();
+}
+
+// name:	scenario_transmit_backpressure
+// Desc:	a write to a nearly full tx buffer takes what fits and says how 
+//			much, a task waiting for space is signalled once as soon as that 
+//			much has been sent, and the bytes go out in the order written.
+static void scenario_transmit_backpressure(void)
+{
+	unsigned char data[80];
+	unsigned char sent[sizeof(data)];
+	unsigned short bytes_written;
+	unsigned short bytes_sent = 0;
+	unsigned char i;
+
+	scenario_name = "transmit backpressure";
+	init_firmware();
+	bench_task_runs = 0;
+	//
+	for(i = 0; i < sizeof(data); i++)
+	{
+		data[i] = i;
+	}
+	//
+	// the buffer holds one byte less than its size
+	CHECK(63 == SRL_Get_transmit_buffer_space(SRL_PORT_0));
+	CHECK(60 == SRL_Write_data_to_transmit_buffer(SRL_PORT_0, &data[0], 60));
+	CHECK(3 == SRL_Get_transmit_buffer_space(SRL_PORT_0));
+	bytes_written = 60 + SRL_Write_data_to_transmit_buffer(SRL_PORT_0, &data[60], 10);
+	CHECK(63 == bytes_written);
+	CHECK(0 == SRL_Get_transmit_buffer_space(SRL_PORT_0));
+	CHECK(0 == SRL_Write_data_to_transmit_buffer(SRL_PORT_0, &data[bytes_written], 1));
+	//
+	// the task isn't run until 20 bytes have gone and then only once
+	SRL_Set_task_to_signal_on_tx_space(SRL_PORT_0, TASK_BENCH_0, 20);
+	run_tasks();
+	CHECK(0 == bench_task_runs);
+	//
+	while(bytes_sent < 19)
+	{
+		sent[bytes_sent++] = send_byte(SRL_PORT_0);
+		run_tasks();
+	}
+	//
+	CHECK(0 == bench_task_runs);
+	sent[bytes_sent++] = send_byte(SRL_PORT_0);
+	run_tasks();
+	CHECK(1 == bench_task_runs);
+	CHECK(20 == SRL_Get_transmit_buffer_space(SRL_PORT_0));
+	//
+	sent[bytes_sent++] = send_byte(SRL_PORT_0);
+	run_tasks();
+	CHECK(1 == bench_task_runs);
+	//
+	// space already there signals straight away
+	SRL_Set_task_to_signal_on_tx_space(SRL_PORT_0, TASK_BENCH_0, 10);
+	run_tasks();
+	CHECK(2 == bench_task_runs);
+	//
+	CHECK((sizeof(data) - 63) == SRL_Write_data_to_transmit_buffer(SRL_PORT_0, &data[63], sizeof(data) - 63));
+	bytes_sent += drain_port(SRL_PORT_0, &sent[bytes_sent], sizeof(sent) - bytes_sent);
+	CHECK(sizeof(data) == bytes_sent);
+	CHECK(0 == memcmp(sent, data, sizeof(data)));
+	CHECK(2 == bench_task_runs);
+}
+
+// name:	scenario_time_sync_timestamps
+// Desc:	a TIME_SYNC request's receive time is when its start byte arrived, 
+//			however many start of packet values are in its data or the last 
+//			packet's data.
+static void scenario_time_sync_timestamps(void)
+{
+	unsigned char echo_data[12];
+	unsigned char request[MAX_PACKET_BYTES];
+	unsigned char response[MAX_PACKET_BYTES];
+	unsigned short request_length;
+	unsigned short length;
+	unsigned long start_time_us;
+
+	scenario_name = "time sync timestamps";
+	init_firmware();
+	//
+	memset((void*)&echo_data[0], START_OF_PACKET, sizeof(echo_data));
+	request_length = build_packet(request, NO_ADDRESS, CMS_COMMAND_TIME_SYNC | COMMAND_IS_REQUEST, echo_data, sizeof(echo_data));
+	//
+	for(start_time_us = 1000; start_time_us <= 3000; start_time_us += 1000)
+	{
+		receive_bytes_at(SRL_PORT_0, request, request_length, start_time_us);
+		length = exchange(SRL_PORT_0, response, sizeof(response));
+		CHECK(True == is_packet(response, length, CMS_COMMAND_TIME_SYNC));
+		CHECK(start_time_us == get_32_bit_value(&response[TIME_SYNC_RECEIVE_TIME_BYTE]));
+		CHECK((start_time_us + ((request_length - 1) * BYTE_TIME_US)) <= get_32_bit_value(&response[TIME_SYNC_TRANSMIT_TIME_BYTE]));
+		CHECK(0 == memcmp(&response[TIME_SYNC_ECHO_BYTE], echo_data, sizeof(echo_data)));
+	}
+}
+
+// name:	scenario_hires_periodic_drift
+// Desc:	a periodic high resolution timer run late each time is still due 
+//			a whole number of periods after its first due time, and a period 
+//			below the minimum is refused.
+static void scenario_hires_periodic_drift(void)
+{
+	const unsigned long start_time_us = 1000;
+	const unsigned long delay_us = 500;
+	const unsigned long period_us = 1000;
+	unsigned long due_time_us;
+	unsigned short late_us;
+	HRT_HANDLE timer_handle;
+	unsigned char period;
+
+	scenario_name = "hires periodic drift";
+	init_firmware();
+	hires_callbacks = 0;
+	TCNT1 = start_time_us;
+	//
+	CHECK(HRT_HANDLE_NONE == HRT_Start_timer(record_hires_callback, delay_us, HRT_PERIOD_MINIMUM - 1));
+	timer_handle = HRT_Start_timer(record_hires_callback, delay_us, period_us);
+	CHECK(HRT_HANDLE_NONE != timer_handle);
+	//
+	for(period = 0; period < HIRES_PERIODS; period++)
+	{
+		due_time_us = start_time_us + delay_us + (period * period_us);
+		CHECK((unsigned short)due_time_us == OCR1A);
+		CHECK(0 != (TIMSK1 & OUTPUT_COMPARE_A_INTERRUPT_ENABLE));
+		//
+		// the interrupt is held off by a different amount each time
+		late_us = (period % 4) * 90;
+		TCNT1 = due_time_us + late_us;
+		TIMER1_COMPA_vect();
+		//
+		CHECK((period + 1) == hires_callbacks);
+		CHECK((due_time_us + late_us) == hires_callback_times_us[period]);
+	}
+	//
+	CHECK((unsigned short)(start_time_us + delay_us + (HIRES_PERIODS * period_us)) == OCR1A);
+	//
+	// a period which is too short leaves the timer running as it was
+	CHECK(False == HRT_Reschedule_timer(timer_handle, delay_us, HRT_PERIOD_MINIMUM - 1));
+	CHECK(True == HRT_Is_timer_active(timer_handle));
+	CHECK((unsigned short)(start_time_us + delay_us + (HIRES_PERIODS * period_us)) == OCR1A);
+	CHECK(True == HRT_Cancel_timer(timer_handle));
+}
+
+// name:	scenario_hires_one_shot_cancel
+// Desc:	a one shot timer cancelled before it is due never calls back, its 
+//			handle is dead and the compare interrupt is off.
+static void scenario_hires_one_shot_cancel(void)
+{
+	HRT_HANDLE timer_handle;
+	HRT_HANDLE next_timer_handle;
+
+	scenario_name = "hires one shot cancel";
+	init_firmware();
+	hires_callbacks = 0;
+	TCNT1 = 2000;
+	//
+	timer_handle = HRT_Start_timer(record_hires_callback, 300, HRT_PERIOD_NONE);
+	CHECK(HRT_HANDLE_NONE != timer_handle);
+	CHECK(2300 == OCR1A);
+	//
+	TCNT1 = 2200;
+	CHECK(True == HRT_Cancel_timer(timer_handle));
+	CHECK(0 == (TIMSK1 & OUTPUT_COMPARE_A_INTERRUPT_ENABLE));
+	CHECK(False == HRT_Is_timer_active(timer_handle));
+	CHECK(False == HRT_Cancel_timer(timer_handle));
+	//
+	// a stray compare match after the due time finds nothing to run
+	TCNT1 = 2400;
+	TIMER1_COMPA_vect();
+	CHECK(0 == hires_callbacks);
+	//
+	// the freed timer is used again under a new handle which the old one doesn't match
+	next_timer_handle = HRT_Start_timer(record_hires_callback, 300, HRT_PERIOD_NONE);
+	CHECK((HRT_HANDLE_NONE != next_timer_handle) && (timer_handle != next_timer_handle));
+	CHECK(False == HRT_Cancel_timer(timer_handle));
+	//
+	TCNT1 = 2700;
+	TIMER1_COMPA_vect();
+	CHECK(1 == hires_callbacks);
+	CHECK(False == HRT_Is_timer_active(next_timer_handle));
+	CHECK(0 == (TIMSK1 & OUTPUT_COMPARE_A_INTERRUPT_ENABLE));
+}
+
+// name:	counting_command
+// Desc:	registered command handler which counts how often it is run.
+static unsigned char counting_command(const unsigned char *request_data_ptr, unsigned char request_data_length, unsigned char *response_data_ptr)
+{
+	counting_command_runs++;
+
+	return 0;
+}
+
+// name:	scenario_batch_overflowing_sub_response
+// Desc:	a sub-response which doesn't fit in what is left of the batch 
+//			response, less room for the entries after it, gets a no room 
+//			status. Every sub-command after it does too without being run.
+static void scenario_batch_overflowing_sub_response(void)
+{
+	unsigned char request_data[CMS_MAX_DATA_BYTES];
+	unsigned char response[MAX_PACKET_BYTES];
+	unsigned char *entry_ptr;
+	unsigned short length;
+
+	scenario_name = "batch overflowing sub-response";
+	init_firmware();
+	CHECK(True == CMS_Register_command(SCENARIO_REGISTERED_COMMAND, counting_command));
+	counting_command_runs = 0;
+	//
+	// a time sync answering with 128 bytes leaves 63, less 4 for the two 
+	// entries after it, too few for the second's 68
+	memset((void*)&request_data[0], 0x5A, sizeof(request_data));
+	request_data[0] = CMS_COMMAND_TIME_SYNC;
+	request_data[1] = 120;
+	request_data[122] = CMS_COMMAND_TIME_SYNC;
+	request_data[123] = 60;
+	request_data[184] = SCENARIO_REGISTERED_COMMAND;
+	request_data[185] = 0;
+	//
+	send_request(SRL_PORT_0, CMS_COMMAND_BATCH, request_data, 186);
+	length = exchange(SRL_PORT_0, response, sizeof(response));
+	CHECK(True == is_packet(response, length, CMS_COMMAND_BATCH));
+	CHECK((2 + 128 + 2 + 2) == response[BYTE_COUNT_BYTE]);
+	//
+	entry_ptr = &response[START_OF_ADDITIONAL_DATA];
+	CHECK((CMS_COMMAND_TIME_SYNC == entry_ptr[0]) && (128 == entry_ptr[1]));
+	CHECK(0 == memcmp(&entry_ptr[2 + 8], &request_data[2], 120));
+	//
+	entry_ptr += 2 + 128;
+	CHECK((CMS_COMMAND_TIME_SYNC == entry_ptr[0]) && (BATCH_NO_ROOM == entry_ptr[1]));
+	CHECK((SCENARIO_REGISTERED_COMMAND == entry_ptr[2]) && (BATCH_NO_ROOM == entry_ptr[3]));
+	CHECK(0 == counting_command_runs);
+	//
+	// the host resends from the first no room entry
+	send_request(SRL_PORT_0, CMS_COMMAND_BATCH, &request_data[122], 64);
+	length = exchange(SRL_PORT_0, response, sizeof(response));
+	CHECK(True == is_packet(response, length, CMS_COMMAND_BATCH));
+	CHECK((2 + 68 + 2) == response[BYTE_COUNT_BYTE]);
+	CHECK(1 == counting_command_runs);
+}
+
+// name:	scenario_batch_refused_sub_commands
+// Desc:	commands which change something when the host resends them after 
+//			a no room status aren't carried out in a batch.
+static void scenario_batch_refused_sub_commands(void)
+{
+	const unsigned char request_data[] =
+	{
+		CMS_COMMAND_SET_BAUD_RATE,			1, SRL_BAUD_RATE_500000,
+		CMS_COMMAND_GET_AND_RESET_STATS,	0,
+		CMS_COMMAND_GET_STATUS,				0
+	};
+	const unsigned char expected_entries[] =
+	{
+		CMS_COMMAND_SET_BAUD_RATE,			BATCH_NOT_HANDLED,
+		CMS_COMMAND_GET_AND_RESET_STATS,	BATCH_NOT_HANDLED,
+		CMS_COMMAND_GET_STATUS,				0
+	};
+	unsigned char response[MAX_PACKET_BYTES];
+	unsigned short length;
+
+	scenario_name = "batch refused sub-commands";
+	init_firmware();
+	//
+	send_request(SRL_PORT_0, CMS_COMMAND_BATCH, request_data, sizeof(request_data));
+	length = exchange(SRL_PORT_0, response, sizeof(response));
+	CHECK(True == is_packet(response, length, CMS_COMMAND_BATCH));
+	CHECK(sizeof(expected_entries) == response[BYTE_COUNT_BYTE]);
+	CHECK(0 == memcmp(&response[START_OF_ADDITIONAL_DATA], expected_entries, sizeof(expected_entries)));
+	CHECK(SRL_DEFAULT_BAUD_RATE == SRL_Get_baud_rate(SRL_PORT_0));
+	CHECK(8 == UBRR0L);
+}
+
+// name:	scenario_batch_malformed_sub_command
+// Desc:	every sub-command reached gets an entry, one which isn't handled or 
+//			is a nested batch gets a not handled status and carries on, one 
+//			whose data runs past the end of the request gets a malformed 
+//			status and the batch stops there.
+static void scenario_batch_malformed_sub_command(void)
+{
+	const unsigned char request_data[] =
+	{
+		CMS_COMMAND_GET_STATUS,		0,
+		UNHANDLED_COMMAND,			1, 0x11,
+		CMS_COMMAND_BATCH,			2, CMS_COMMAND_GET_STATUS, 0,
+		CMS_COMMAND_TIME_SYNC,		5, 0x22, 0x33
+	};
+	const unsigned char expected_entries[] =
+	{
+		CMS_COMMAND_GET_STATUS,		0,
+		UNHANDLED_COMMAND,			BATCH_NOT_HANDLED,
+		CMS_COMMAND_BATCH,			BATCH_NOT_HANDLED,
+		CMS_COMMAND_TIME_SYNC,		BATCH_MALFORMED
+	};
+	unsigned char response[MAX_PACKET_BYTES];
+	unsigned short length;
+
+	scenario_name = "batch malformed sub-command";
+	init_firmware();
+	//
+	send_request(SRL_PORT_0, CMS_COMMAND_BATCH, request_data, sizeof(request_data));
+	length = exchange(SRL_PORT_0, response, sizeof(response));
+	CHECK(True == is_packet(response, length, CMS_COMMAND_BATCH));
+	CHECK(sizeof(expected_entries) == response[BYTE_COUNT_BYTE]);
+	CHECK(0 == memcmp(&response[START_OF_ADDITIONAL_DATA], expected_entries, sizeof(expected_entries)));
+}
+
+// name:	get_statistics_page
+// Desc:	sends the statistics command for the page from the first timing 
+//			and returns the response data, or NULL if it isn't a good response.
+static const unsigned char *get_statistics_page(unsigned char command, unsigned char first_timing, unsigned char *response_ptr)
+{
+	unsigned short length;
+
+	send_request(SRL_PORT_0, command, &first_timing, 1);
+	length = exchange(SRL_PORT_0, response_ptr, MAX_PACKET_BYTES);
+
+	return (True == is_packet(response_ptr, length, command)) ? &response_ptr[START_OF_ADDITIONAL_DATA] : NULL;
+}
+
+// name:	timer_1_overflow_runs
+// Desc:	returns the run count of the timer 1 overflow interrupt from the 
+//			first page of the statistics, or 0xFFFF if it can't be read.
+static unsigned long timer_1_overflow_runs(void)
+{
+	unsigned char response[MAX_PACKET_BYTES];
+	const unsigned char *data_ptr;
+
+	data_ptr = get_statistics_page(CMS_COMMAND_GET_STATS, 0, response);
+
+	return (NULL == data_ptr) ? 0xFFFF : get_32_bit_value(&data_ptr[STATS_TIMINGS_BYTE + (STS_ISR_TIMER1_OVF * STATS_TIMING_BYTES)]);
+}
+
+// name:	scenario_statistics_pages
+// Desc:	the timings come a page at a time so every one of them can be 
+//			read, the interrupts added later are among them, and get and 
+//			reset only clears them once the last page has gone.
+static void scenario_statistics_pages(void)
+{
+	unsigned char response[MAX_PACKET_BYTES];
+	const unsigned char *data_ptr;
+	unsigned char first_timing = 0;
+	unsigned char pages = 0;
+
+	scenario_name = "statistics pages";
+	init_firmware();
+	TIMER1_OVF_vect();
+	//
+	data_ptr = get_statistics_page(CMS_COMMAND_GET_STATS, 0, response);
+	CHECK(NULL != data_ptr);
+	CHECK(STATS_FORMAT_VERSION == data_ptr[0]);
+	CHECK((NUMBER_OF_STS_ISRS == data_ptr[STATS_NUMBER_OF_ISRS_BYTE]) && (NUMBER_OF_TASKS == data_ptr[STATS_NUMBER_OF_TASKS_BYTE]));
+	CHECK(response[BYTE_COUNT_BYTE] > (CMS_MAX_DATA_BYTES - STATS_TIMING_BYTES));
+	CHECK(0 != get_32_bit_value(&data_ptr[STATS_TIMINGS_BYTE + (STS_ISR_USART0_RX * STATS_TIMING_BYTES)]));
+	CHECK(1 == timer_1_overflow_runs());
+	//
+	// every timing is on exactly one page
+	while((first_timing < STATS_TIMINGS) && (pages < STATS_TIMINGS))
+	{
+		data_ptr = get_statistics_page(CMS_COMMAND_GET_STATS, first_timing, response);
+		CHECK(NULL != data_ptr);
+		//
+		if(NULL == data_ptr)
+		{
+			break;
+		}
+		//
+		CHECK(first_timing == data_ptr[STATS_FIRST_TIMING_BYTE]);
+		CHECK(0 != data_ptr[STATS_NUMBER_OF_TIMINGS_BYTE]);
+		CHECK((STATS_TIMINGS_BYTE + (data_ptr[STATS_NUMBER_OF_TIMINGS_BYTE] * STATS_TIMING_BYTES)) == response[BYTE_COUNT_BYTE]);
+		first_timing += data_ptr[STATS_NUMBER_OF_TIMINGS_BYTE];
+		pages++;
+	}
+	//
+	CHECK((STATS_TIMINGS == first_timing) && (pages > 1));
+	data_ptr = get_statistics_page(CMS_COMMAND_GET_STATS, STATS_TIMINGS + 1, response);
+	CHECK((NULL != data_ptr) && (0 == response[BYTE_COUNT_BYTE]));
+	//
+	// get and reset leaves the statistics until the page with the last timing
+	first_timing = 0;
+	//
+	while((first_timing < STATS_TIMINGS) && (0 != pages))
+	{
+		CHECK(1 == timer_1_overflow_runs());
+		data_ptr = get_statistics_page(CMS_COMMAND_GET_AND_RESET_STATS, first_timing, response);
+		CHECK(NULL != data_ptr);
+		//
+		if(NULL == data_ptr)
+		{
+			break;
+		}
+		//
+		first_timing += data_ptr[STATS_NUMBER_OF_TIMINGS_BYTE];
+		pages--;
+	}
+	//
+	CHECK(0 == timer_1_overflow_runs());
+}
+
+// name:	scenario_request_timeout_and_retry
+// Desc:	a request which isn't answered is sent again unchanged after each 
+//			timeout and the handler is told once the retries have run out. A 
+//			request which is answered is matched by its sequence number and 
+//			isn't sent again.
+static void scenario_request_timeout_and_retry(void)
+{
+	unsigned char request_data[2] = { 0xAA, 0xBB };
+	unsigned char request[MAX_PACKET_BYTES];
+	unsigned char sent[MAX_PACKET_BYTES];
+	unsigned char response[MAX_PACKET_BYTES];
+	unsigned char response_data[2];
+	unsigned short request_length;
+	unsigned short length;
+	unsigned char retry;
+
+	scenario_name = "request timeout and retry";
+	init_firmware();
+	requests_finished = 0;
+	//
+	CHECK(True == CMS_Send_request(SRL_PORT_0, SCENARIO_REQUEST_COMMAND, request_data, sizeof(request_data), record_request_result));
+	request_length = exchange(SRL_PORT_0, request, sizeof(request));
+	CHECK(True == is_packet(request, request_length, SCENARIO_REQUEST_COMMAND | COMMAND_IS_REQUEST));
+	CHECK(0 == memcmp(&request[REQUEST_SEQUENCE_NUMBER_BYTE + 1], request_data, sizeof(request_data)));
+	//
+	for(retry = 0; retry < REQUEST_RETRIES; retry++)
+	{
+		length = advance_ms(REQUEST_TIMEOUT_MS + 10, SRL_PORT_0, sent, sizeof(sent));
+		CHECK((length == request_length) && (0 == memcmp(sent, request, request_length)));
+		CHECK(0 == requests_finished);
+	}
+	//
+	length = advance_ms(REQUEST_TIMEOUT_MS + 10, SRL_PORT_0, sent, sizeof(sent));
+	CHECK(0 == length);
+	CHECK(1 == requests_finished);
+	CHECK(CMS_REQUEST_TIMED_OUT == request_result);
+	CHECK(0 == request_response_length);
+	//
+	// the next request has the next sequence number and is answered
+	CHECK(True == CMS_Send_request(SRL_PORT_0, SCENARIO_REQUEST_COMMAND, request_data, sizeof(request_data), record_request_result));
+	length = exchange(SRL_PORT_0, sent, sizeof(sent));
+	CHECK(True == is_packet(sent, length, SCENARIO_REQUEST_COMMAND | COMMAND_IS_REQUEST));
+	CHECK((unsigned char)(request[REQUEST_SEQUENCE_NUMBER_BYTE] + 1) == sent[REQUEST_SEQUENCE_NUMBER_BYTE]);
+	//
+	response_data[0] = sent[REQUEST_SEQUENCE_NUMBER_BYTE];
+	response_data[1] = 0x44;
+	receive_bytes(SRL_PORT_0, response, build_packet(response, NO_ADDRESS, SCENARIO_REQUEST_COMMAND, response_data, sizeof(response_data)));
+	CHECK(0 == exchange(SRL_PORT_0, sent, sizeof(sent)));
+	CHECK(2 == requests_finished);
+	CHECK(CMS_REQUEST_ANSWERED == request_result);
+	CHECK((1 == request_response_length) && (0x44 == request_response[0]));
+	//
+	CHECK(0 == advance_ms(2 * REQUEST_TIMEOUT_MS, SRL_PORT_0, sent, sizeof(sent)));
+	CHECK(2 == requests_finished);
+}
+
+// name:	scenario_request_timeout_while_backed_up
+// Desc:	a request which times out before its packet has left the port 
+//			keeps its slot until it has, so the next request can't overwrite 
+//			the packet being sent. Retries aren't queued on top of it.
+static void scenario_request_timeout_while_backed_up(void)
+{
+	static const unsigned char filler[20] = { 0 };
+	const SRL_TX_FRAGMENT filler_fragment = { filler, sizeof(filler) };
+	unsigned char first_data[2] = { 0xAA, 0xBB };
+	unsigned char second_data[2] = { 0x11, 0x22 };
+	unsigned char sent[3 * MAX_PACKET_BYTES];
+	unsigned char *packet_ptr;
+	unsigned short packet_length = DEFAULT_PACKET_SIZE + 1 + sizeof(first_data);
+	unsigned short length;
+	unsigned char request;
+
+	scenario_name = "request timeout while backed up";
+	init_firmware();
+	requests_finished = 0;
+	//
+	CHECK(True == SRL_Queue_data_to_transmit(SRL_PORT_0, &filler_fragment, 1, NO_TASK));
+	CHECK(True == CMS_Send_request(SRL_PORT_0, SCENARIO_REQUEST_COMMAND, first_data, sizeof(first_data), record_request_result));
+	advance_ms_without_sending((REQUEST_RETRIES + 1) * (REQUEST_TIMEOUT_MS + 10));
+	CHECK(1 == requests_finished);
+	CHECK(CMS_REQUEST_TIMED_OUT == request_result);
+	//
+	CHECK(True == CMS_Send_request(SRL_PORT_0, SCENARIO_REQUEST_COMMAND, second_data, sizeof(second_data), record_request_result));
+	//
+	// the first request went once and unchanged, then the second
+	length = drain_port(SRL_PORT_0, sent, sizeof(sent));
+	CHECK((sizeof(filler) + (2 * packet_length)) == length);
+	packet_ptr = &sent[sizeof(filler)];
+	CHECK(True == is_packet(packet_ptr, packet_length, SCENARIO_REQUEST_COMMAND | COMMAND_IS_REQUEST));
+	CHECK(0 == memcmp(&packet_ptr[REQUEST_SEQUENCE_NUMBER_BYTE + 1], first_data, sizeof(first_data)));
+	packet_ptr += packet_length;
+	CHECK(True == is_packet(packet_ptr, packet_length, SCENARIO_REQUEST_COMMAND | COMMAND_IS_REQUEST));
+	CHECK(0 == memcmp(&packet_ptr[REQUEST_SEQUENCE_NUMBER_BYTE + 1], second_data, sizeof(second_data)));
+	//
+	// once sent the first request's slot is free again
+	run_tasks();
+	//
+	for(request = 1; request < CMS_MAX_OUTSTANDING_REQUESTS; request++)
+	{
+		CHECK(True == CMS_Send_request(SRL_PORT_0, SCENARIO_REQUEST_COMMAND, NULL, 0, record_request_result));
+	}
+	//
+	CHECK(False == CMS_Send_request(SRL_PORT_0, SCENARIO_REQUEST_COMMAND, NULL, 0, record_request_result));
+	CHECK(1 == requests_finished);
+}
+
+// name:	scenario_request_without_timer
+// Desc:	with every timer in use a request is refused and not sent, and its 
+//			slot is still free once timers are.
+static void scenario_request_without_timer(void)
+{
+	TIMER_HANDLE timer_handles[MAX_TIMERS];
+	unsigned char sent[MAX_PACKET_BYTES];
+	unsigned char timers_taken;
+	unsigned char request;
+
+	scenario_name = "request without timer";
+	init_firmware();
+	requests_finished = 0;
+	//
+	// the firmware already holds some timers, take the rest
+	timers_taken = 0;
+	//
+	while(timers_taken < MAX_TIMERS)
+	{
+		timer_handles[timers_taken] = TMR_Set_timer_to_signal_task(TASK_BENCH_0, TIMER_COUNT_1_S, TIMER_COUNT_NONE);
+		//
+		if(TIMER_HANDLE_NONE == timer_handles[timers_taken])
+		{
+			break;
+		}
+		//
+		timers_taken++;
+	}
+	//
+	CHECK((0 != timers_taken) && (timers_taken < MAX_TIMERS));
+	CHECK(False == CMS_Send_request(SRL_PORT_0, SCENARIO_REQUEST_COMMAND, NULL, 0, record_request_result));
+	CHECK(0 == exchange(SRL_PORT_0, sent, sizeof(sent)));
+	//
+	while(0 != timers_taken)
+	{
+		timers_taken--;
+		TMR_Cancel_timer(timer_handles[timers_taken]);
+	}
+	//
+	// every slot can still be used
+	for(request = 0; request < CMS_MAX_OUTSTANDING_REQUESTS; request++)
+	{
+		CHECK(True == CMS_Send_request(SRL_PORT_0, SCENARIO_REQUEST_COMMAND, NULL, 0, record_request_result));
+	}
+	//
+	CHECK(False == CMS_Send_request(SRL_PORT_0, SCENARIO_REQUEST_COMMAND, NULL, 0, record_request_result));
+	CHECK(0 == requests_finished);
+}
+
+// name:	get_statistics_counter
+// Desc:	returns a counter from the first page of the statistics, or 0xFFFF 
+//			if it can't be read.
+static unsigned short get_statistics_counter(STS_COUNTER counter)
+{
+	unsigned char response[MAX_PACKET_BYTES];
+	const unsigned char *data_ptr;
+
+	data_ptr = get_statistics_page(CMS_COMMAND_GET_STATS, 0, response);
+
+	return (NULL == data_ptr) ? 0xFFFF : (data_ptr[STATS_COUNTERS_BYTE + (2 * counter)] | (data_ptr[STATS_COUNTERS_BYTE + (2 * counter) + 1] << 8));
+}
+
+// name:	scenario_partial_packet_without_timer
+// Desc:	with every timer in use a partial packet still times out, the 
+//			missing timer is counted and the next packet is answered.
+static void scenario_partial_packet_without_timer(void)
+{
+	static const unsigned char partial_packet[] = {START_OF_PACKET, 5, CMS_COMMAND_GET_STATUS | COMMAND_IS_REQUEST};
+	TIMER_HANDLE timer_handles[MAX_TIMERS];
+	unsigned char response[MAX_PACKET_BYTES];
+	unsigned short length;
+	unsigned char timers_taken;
+
+	scenario_name = "partial packet without timer";
+	init_firmware();
+	//
+	// the firmware already holds some timers, take the rest
+	timers_taken = 0;
+	//
+	while(timers_taken < MAX_TIMERS)
+	{
+		timer_handles[timers_taken] = TMR_Set_timer_to_signal_task(TASK_BENCH_0, TIMER_COUNT_1_S, TIMER_COUNT_NONE);
+		//
+		if(TIMER_HANDLE_NONE == timer_handles[timers_taken])
+		{
+			break;
+		}
+		//
+		timers_taken++;
+	}
+	//
+	CHECK((0 != timers_taken) && (timers_taken < MAX_TIMERS));
+	receive_bytes(SRL_PORT_0, partial_packet, sizeof(partial_packet));
+	run_tasks();
+	//
+	while(0 != timers_taken)
+	{
+		timers_taken--;
+		TMR_Cancel_timer(timer_handles[timers_taken]);
+	}
+	//
+	// nothing wakes the task, the timeout is seen when the next bytes arrive
+	TIMER1_OVF_vect();
+	send_request(SRL_PORT_0, CMS_COMMAND_GET_STATUS, NULL, 0);
+	length = exchange(SRL_PORT_0, response, sizeof(response));
+	CHECK(True == is_packet(response, length, CMS_COMMAND_GET_STATUS));
+	CHECK(1 == get_statistics_counter(STS_COUNTER_RX_PACKET_NO_TIMER));
+	CHECK(1 == get_statistics_counter(STS_COUNTER_RX_PACKET_TIMEOUTS));
+}
+
+// name:	main
+// Desc:	runs every scenario and prints a summary.
+int main(void)
+{
+	scenario_baud_rate_fallback();
+	scenario_baud_rate_queue_full();
+	scenario_registered_command();
+	scenario_unaddressed_port();
+	scenario_resumable_task();
+	scenario_transmit_backpressure();
+	scenario_time_sync_timestamps();
+	scenario_request_timeout_and_retry();
+	scenario_request_timeout_while_backed_up();
+	scenario_request_without_timer();
+	scenario_partial_packet_without_timer();
+	scenario_hires_periodic_drift();
+	scenario_hires_one_shot_cancel();
+	scenario_batch_overflowing_sub_response();
+	scenario_batch_malformed_sub_command();
+	scenario_batch_refused_sub_commands();
+	scenario_statistics_pages();
+#if (SRL_RS485 == SRL_RS485_PORT_1)
+	scenario_bus_address_accept();
+	scenario_bus_address_reject();
+	scenario_bus_broadcast_baud_rate();
+	scenario_bus_bridge();
+#else
+	scenario_forwarding_between_ports();
+#endif
+	//
+	printf("%u checks, %u failed\n", scenario_checks, scenario_failures);
+
+	return (0 == scenario_failures) ? 0 : 1;
+}
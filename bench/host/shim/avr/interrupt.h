@@ -0,0 +1,22 @@
+/*
+ * interrupt.h
+ *
+ * Description:	host stand in for avr/interrupt.h, interrupt service routines
+ *				become ordinary functions which the benchmark calls directly.
+ */ 
+
+
+#ifndef HOST_AVR_INTERRUPT_H_
+#define HOST_AVR_INTERRUPT_H_
+
+#include <avr/io.h>
+
+#define GLOBAL_INTERRUPT_ENABLE		0x80
+
+// an ISR is a plain function named after its vector e.g. USART0_RX_vect()
+#define ISR(vector)					void vector(void); void vector(void)
+
+#define cli()						(SREG &= (uint8_t)~GLOBAL_INTERRUPT_ENABLE)
+#define sei()						(SREG |= GLOBAL_INTERRUPT_ENABLE)
+
+#endif /* HOST_AVR_INTERRUPT_H_ */
@@ -0,0 +1,78 @@
+/*
+ * io.h
+ *
+ * Description:	host stand in for avr/io.h, maps the ATmega644P registers
+ *				used by the firmware onto plain variables so the modules
+ *				can be compiled and driven on a PC.
+ */ 
+
+
+#ifndef HOST_AVR_IO_H_
+#define HOST_AVR_IO_H_
+
+#include <stdint.h>
+
+#define HOST_REGISTER(name)		extern volatile uint8_t name;
+#define HOST_REGISTER16(name)	extern volatile uint16_t name;
+
+// status register
+HOST_REGISTER(SREG)
+
+// general purpose io
+HOST_REGISTER(PORTA)
+HOST_REGISTER(DDRA)
+HOST_REGISTER(PINA)
+HOST_REGISTER(PORTB)
+HOST_REGISTER(DDRB)
+HOST_REGISTER(PINB)
+HOST_REGISTER(PORTC)
+HOST_REGISTER(DDRC)
+HOST_REGISTER(PINC)
+HOST_REGISTER(PORTD)
+HOST_REGISTER(DDRD)
+HOST_REGISTER(PIND)
+
+// pin change interrupts
+HOST_REGISTER(PCICR)
+HOST_REGISTER(PCMSK3)
+
+// timer 0
+HOST_REGISTER(TCCR0A)
+HOST_REGISTER(TCCR0B)
+HOST_REGISTER(TCNT0)
+HOST_REGISTER(OCR0A)
+HOST_REGISTER(OCR0B)
+HOST_REGISTER(TIMSK0)
+HOST_REGISTER(TIFR0)
+
+// timer 1
+HOST_REGISTER(TCCR1A)
+HOST_REGISTER(TCCR1B)
+HOST_REGISTER(TCCR1C)
+HOST_REGISTER16(TCNT1)
+HOST_REGISTER16(OCR1A)
+HOST_REGISTER16(OCR1B)
+HOST_REGISTER16(ICR1)
+HOST_REGISTER(TIMSK1)
+HOST_REGISTER(TIFR1)
+
+// usart 0
+HOST_REGISTER(UCSR0A)
+HOST_REGISTER(UCSR0B)
+HOST_REGISTER(UCSR0C)
+HOST_REGISTER(UBRR0H)
+HOST_REGISTER(UBRR0L)
+HOST_REGISTER(UDR0)
+
+// usart 1
+HOST_REGISTER(UCSR1A)
+HOST_REGISTER(UCSR1B)
+HOST_REGISTER(UCSR1C)
+HOST_REGISTER(UBRR1H)
+HOST_REGISTER(UBRR1L)
+HOST_REGISTER(UDR1)
+
+// adc
+HOST_REGISTER(ADMUX)
+
+#endif /* HOST_AVR_IO_H_ */
@@ -0,0 +1,20 @@
+/*
+ * pgmspace.h
+ *
+ * Description:	host stand in for avr/pgmspace.h, flash data is ordinary 
+ *				const data so reads are plain dereferences.
+ */ 
+
+
+#ifndef HOST_AVR_PGMSPACE_H_
+#define HOST_AVR_PGMSPACE_H_
+
+#include <string.h>
+
+#define PROGMEM
+
+#define pgm_read_byte(address)		(*(address))
+#define pgm_read_word(address)		(*(address))
+#define memcpy_P(destination, source, length)	memcpy((destination), (source), (length))
+
+#endif /* HOST_AVR_PGMSPACE_H_ */
@@ -0,0 +1,19 @@
+/*
+ * sleep.h
+ *
+ * Description:	host stand in for avr/sleep.h, the host never sleeps.
+ */ 
+
+
+#ifndef HOST_AVR_SLEEP_H_
+#define HOST_AVR_SLEEP_H_
+
+#define SLEEP_MODE_IDLE			0x00
+#define SLEEP_MODE_PWR_SAVE		0x06
+
+#define set_sleep_mode(mode)	((void)(mode))
+#define sleep_enable()
+#define sleep_disable()
+#define sleep_cpu()
+
+#endif /* HOST_AVR_SLEEP_H_ */
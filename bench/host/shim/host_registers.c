@@ -0,0 +1,62 @@
+/*
+ * host_registers.c
+ *
+ * Description:	storage for the registers declared by the host avr/io.h
+ */ 
+
+#include <avr/io.h>
+
+#define HOST_REGISTER_STORAGE(name)		volatile uint8_t name;
+#define HOST_REGISTER16_STORAGE(name)	volatile uint16_t name;
+
+HOST_REGISTER_STORAGE(SREG)
+
+HOST_REGISTER_STORAGE(PORTA)
+HOST_REGISTER_STORAGE(DDRA)
+HOST_REGISTER_STORAGE(PINA)
+HOST_REGISTER_STORAGE(PORTB)
+HOST_REGISTER_STORAGE(DDRB)
+HOST_REGISTER_STORAGE(PINB)
+HOST_REGISTER_STORAGE(PORTC)
+HOST_REGISTER_STORAGE(DDRC)
+HOST_REGISTER_STORAGE(PINC)
+HOST_REGISTER_STORAGE(PORTD)
+HOST_REGISTER_STORAGE(DDRD)
+HOST_REGISTER_STORAGE(PIND)
+
+HOST_REGISTER_STORAGE(PCICR)
+HOST_REGISTER_STORAGE(PCMSK3)
+
+HOST_REGISTER_STORAGE(TCCR0A)
+HOST_REGISTER_STORAGE(TCCR0B)
+HOST_REGISTER_STORAGE(TCNT0)
+HOST_REGISTER_STORAGE(OCR0A)
+HOST_REGISTER_STORAGE(OCR0B)
+HOST_REGISTER_STORAGE(TIMSK0)
+HOST_REGISTER_STORAGE(TIFR0)
+
+HOST_REGISTER_STORAGE(TCCR1A)
+HOST_REGISTER_STORAGE(TCCR1B)
+HOST_REGISTER_STORAGE(TCCR1C)
+HOST_REGISTER16_STORAGE(TCNT1)
+HOST_REGISTER16_STORAGE(OCR1A)
+HOST_REGISTER16_STORAGE(OCR1B)
+HOST_REGISTER16_STORAGE(ICR1)
+HOST_REGISTER_STORAGE(TIMSK1)
+HOST_REGISTER_STORAGE(TIFR1)
+
+HOST_REGISTER_STORAGE(UCSR0A)
+HOST_REGISTER_STORAGE(UCSR0B)
+HOST_REGISTER_STORAGE(UCSR0C)
+HOST_REGISTER_STORAGE(UBRR0H)
+HOST_REGISTER_STORAGE(UBRR0L)
+HOST_REGISTER_STORAGE(UDR0)
+
+HOST_REGISTER_STORAGE(UCSR1A)
+HOST_REGISTER_STORAGE(UCSR1B)
+HOST_REGISTER_STORAGE(UCSR1C)
+HOST_REGISTER_STORAGE(UBRR1H)
+HOST_REGISTER_STORAGE(UBRR1L)
+HOST_REGISTER_STORAGE(UDR1)
+
+HOST_REGISTER_STORAGE(ADMUX)
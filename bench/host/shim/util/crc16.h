@@ -0,0 +1,35 @@
+/*
+ * crc16.h
+ *
+ * Description:	host stand in for util/crc16.h, the C equivalent of the 
+ *				avr-libc assembler given in its documentation.
+ */ 
+
+
+#ifndef HOST_UTIL_CRC16_H_
+#define HOST_UTIL_CRC16_H_
+
+#include <stdint.h>
+
+static inline uint16_t _crc_xmodem_update(uint16_t crc, uint8_t data)
+{
+	uint8_t i;
+
+	crc = crc ^ ((uint16_t)data << 8);
+	//
+	for(i = 0; i < 8; i++)
+	{
+		if(crc & 0x8000)
+		{
+			crc = (crc << 1) ^ 0x1021;
+		}
+		else
+		{
+			crc <<= 1;
+		}
+	}
+
+	return crc;
+}
+
+#endif /* HOST_UTIL_CRC16_H_ */
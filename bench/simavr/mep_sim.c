@@ -0,0 +1,493 @@
+/*
+ * mep_sim.c
+ *
+ * Description:	runs the firmware ELF under simavr and drives USART0 with
+ *				GET_STATUS requests to measure cycle accurate throughput
+ *				and request to response latency on the real part.
+ */
+
+#include "sim_avr.h"
+#include "sim_elf.h"
+#include "sim_irq.h"
+#include "avr_uart.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MCU_NAME							"atmega644p"
+#define MCU_FREQUENCY						8000000UL
+
+#define DEFAULT_ROUND_TRIPS					2000
+#define BOOT_CYCLES							20000
+#define RESPONSE_TIMEOUT_CYCLES				(MCU_FREQUENCY / 10)
+#define DRAIN_CYCLES						(MCU_FREQUENCY / 20)
+
+// firmware runs UBRR 8 with U2X, 10 bits per byte on the line
+#define LINE_BAUD_RATE						(MCU_FREQUENCY / (8 * (8 + 1)))
+#define LINE_CYCLES_PER_BYTE				((10 * MCU_FREQUENCY) / LINE_BAUD_RATE)
+
+// protocol constants, mirrored from communications.c
+#define START_OF_PACKET						0x73
+#define END_OF_PACKET						0xD9
+#define BYTE_COUNT_BYTE						1
+#define COMMAND_BYTE						2
+#define COMMAND_GET_STATUS					0x10
+#define COMMAND_IS_REQUEST_NOT_RESPONSE		0x80
+#define DEFAULT_BYTES_INCLUDED_IN_CRC		4
+#define DEFAULT_PACKET_SIZE					7
+#define MAX_PACKET_BYTES					200
+
+#define CRC_16_INITIAL_VALUE				0xFFFF
+#define CRC_16_POLYNOMIAL					0x1021
+
+typedef struct
+{
+	avr_t *avr;
+	avr_irq_t *uart_input_irq;
+	int uart_ready;
+	//
+	// response framing
+	unsigned char response[MAX_PACKET_BYTES];
+	unsigned short response_length;
+	unsigned long responses;
+	unsigned long bad_responses;
+	avr_cycle_count_t last_response_cycle;
+	//
+	// times the simulated usart input fifo filled because the firmware fell behind
+	unsigned long rx_overruns;
+	//
+	// cycles the core spent asleep
+	avr_cycle_count_t sleeping_cycles;
+}SIM_STATE;
+
+static SIM_STATE sim;
+
+// name:	crc16
+// Desc:	bitwise crc-16/ccitt used to build and check packets independently
+//			of the firmware's table.
+static unsigned short crc16(const unsigned char *data_ptr, unsigned short length)
+{
+	unsigned short crc = CRC_16_INITIAL_VALUE;
+	unsigned char bit;
+
+	while(length--)
+	{
+		crc ^= (unsigned short)(*data_ptr++) << 8;
+		//
+		for(bit = 0; bit < 8; bit++)
+		{
+			crc = (crc & 0x8000) ? (unsigned short)((crc << 1) ^ CRC_16_POLYNOMIAL) : (unsigned short)(crc << 1);
+		}
+	}
+
+	return crc;
+}
+
+// name:	build_get_status_request
+// Desc:	builds a GET_STATUS request and returns its length.
+static unsigned short build_get_status_request(unsigned char *packet_ptr)
+{
+	unsigned short crc;
+
+	packet_ptr[0] = START_OF_PACKET;
+	packet_ptr[1] = 0;
+	packet_ptr[2] = COMMAND_GET_STATUS | COMMAND_IS_REQUEST_NOT_RESPONSE;
+	packet_ptr[3] = 0;
+	//
+	crc = crc16(packet_ptr, DEFAULT_BYTES_INCLUDED_IN_CRC);
+	//
+	packet_ptr[4] = (unsigned char)(crc & 0xFF);
+	packet_ptr[5] = (unsigned char)(crc >> 8);
+	packet_ptr[6] = END_OF_PACKET;
+
+	return DEFAULT_PACKET_SIZE;
+}
+
+// name:	uart_output_hook
+// Desc:	called by simavr for every byte the firmware transmits, frames
+//			responses and validates their crc.
+static void uart_output_hook(struct avr_irq_t *irq, uint32_t value, void *param)
+{
+	SIM_STATE *state_ptr = (SIM_STATE *)param;
+	unsigned char byte = (unsigned char)value;
+	unsigned short expected_length;
+	unsigned short crc;
+
+	(void)irq;
+	//
+	if((0 == state_ptr->response_length) && (START_OF_PACKET != byte))
+	{
+		return;
+	}
+	//
+	state_ptr->response[state_ptr->response_length++] = byte;
+	//
+	if(state_ptr->response_length > BYTE_COUNT_BYTE)
+	{
+		expected_length = DEFAULT_PACKET_SIZE + state_ptr->response[BYTE_COUNT_BYTE];
+		//
+		if((state_ptr->response_length == expected_length) || (state_ptr->response_length == MAX_PACKET_BYTES))
+		{
+			crc = crc16(state_ptr->response, (unsigned short)(expected_length - 3));
+			//
+			if((END_OF_PACKET == byte) &&
+				(state_ptr->response[expected_length - 3] == (crc & 0xFF)) &&
+				(state_ptr->response[expected_length - 2] == (crc >> 8)))
+			{
+				state_ptr->responses++;
+				state_ptr->last_response_cycle = state_ptr->avr->cycle;
+			}
+			else
+			{
+				state_ptr->bad_responses++;
+			}
+			//
+			state_ptr->response_length = 0;
+		}
+	}
+}
+
+// name:	uart_xoff_hook
+// Desc:	the simulated usart input fifo is full, hold off injecting.
+static void uart_xoff_hook(struct avr_irq_t *irq, uint32_t value, void *param)
+{
+	SIM_STATE *state_ptr = (SIM_STATE *)param;
+
+	(void)irq;
+	(void)value;
+	//
+	if(state_ptr->uart_ready)
+	{
+		state_ptr->rx_overruns++;
+	}
+	//
+	state_ptr->uart_ready = 0;
+}
+
+// name:	uart_xon_hook
+// Desc:	the simulated usart input fifo has space again.
+static void uart_xon_hook(struct avr_irq_t *irq, uint32_t value, void *param)
+{
+	SIM_STATE *state_ptr = (SIM_STATE *)param;
+
+	(void)irq;
+	(void)value;
+	//
+	state_ptr->uart_ready = 1;
+}
+
+// name:	step
+// Desc:	executes one simavr step and accounts for sleep time, returns
+//			zero once the core has stopped.
+static int step(void)
+{
+	avr_cycle_count_t start_cycle = sim.avr->cycle;
+	int was_sleeping = (cpu_Sleeping == sim.avr->state);
+	int run_state;
+
+	run_state = avr_run(sim.avr);
+	//
+	if(was_sleeping)
+	{
+		sim.sleeping_cycles += sim.avr->cycle - start_cycle;
+	}
+
+	return ((cpu_Done != run_state) && (cpu_Crashed != run_state));
+}
+
+// name:	run_until_cycle
+// Desc:	runs the core until the passed cycle count has been reached.
+static int run_until_cycle(avr_cycle_count_t target_cycle)
+{
+	while(sim.avr->cycle < target_cycle)
+	{
+		if(!step())
+		{
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+// name:	inject_bytes
+// Desc:	pushes bytes into the usart input. Unpaced bytes wait for fifo
+//			space, paced bytes are sent one line time apart like a real host
+//			that does not honour flow control.
+static int inject_bytes(const unsigned char *data_ptr, unsigned short length, int paced)
+{
+	static avr_cycle_count_t next_byte_cycle;
+	unsigned short i;
+
+	for(i = 0; i < length; i++)
+	{
+		if(paced)
+		{
+			if(next_byte_cycle < sim.avr->cycle)
+			{
+				next_byte_cycle = sim.avr->cycle;
+			}
+			//
+			if(!run_until_cycle(next_byte_cycle))
+			{
+				return 0;
+			}
+			//
+			next_byte_cycle += LINE_CYCLES_PER_BYTE;
+		}
+		else
+		{
+			while(!sim.uart_ready)
+			{
+				if(!step())
+				{
+					return 0;
+				}
+			}
+		}
+		//
+		avr_raise_irq(sim.uart_input_irq, data_ptr[i]);
+	}
+
+	return 1;
+}
+
+// name:	compare_cycles
+// Desc:	qsort comparison for latency samples.
+static int compare_cycles(const void *a_ptr, const void *b_ptr)
+{
+	avr_cycle_count_t a = *(const avr_cycle_count_t *)a_ptr;
+	avr_cycle_count_t b = *(const avr_cycle_count_t *)b_ptr;
+
+	return (a > b) - (a < b);
+}
+
+// name:	cycles_to_us
+// Desc:	converts a cycle count to microseconds at the simulated clock.
+static double cycles_to_us(avr_cycle_count_t cycles)
+{
+	return ((double)cycles * 1e6) / (double)MCU_FREQUENCY;
+}
+
+// name:	usage
+// Desc:	prints command line help.
+static void usage(const char *program_name)
+{
+	fprintf(stderr,
+		"usage: %s [-n round_trips] [-p max_p99_us] [-r min_round_trips_per_s] firmware.elf\n"
+		"  -n  number of GET_STATUS round trips and pipelined requests (default %d)\n"
+		"  -p  fail if the closed loop p99 latency exceeds this many microseconds\n"
+		"  -r  fail if fewer closed loop round trips per second are sustained\n",
+		program_name, DEFAULT_ROUND_TRIPS);
+}
+
+// name:	main
+// Desc:	loads the firmware, runs the closed loop and pipelined phases
+//			and prints the results.
+int main(int argc, char *argv[])
+{
+	elf_firmware_t firmware;
+	unsigned char request[MAX_PACKET_BYTES];
+	unsigned short request_length;
+	unsigned long round_trips = DEFAULT_ROUND_TRIPS;
+	double max_p99_us = 0.0;
+	double min_round_trips_per_s = 0.0;
+	avr_cycle_count_t *latencies;
+	avr_cycle_count_t phase_start;
+	avr_cycle_count_t request_start;
+	avr_cycle_count_t sleeping_start;
+	avr_cycle_count_t closed_loop_cycles;
+	avr_cycle_count_t pipelined_cycles;
+	unsigned long answered;
+	unsigned long lost_closed_loop;
+	unsigned long lost_pipelined;
+	unsigned long responses_before;
+	unsigned long i;
+	double round_trips_per_s;
+	double p50_us;
+	double p99_us;
+	double idle_percentage;
+	int failed = 0;
+	int option;
+
+	while(-1 != (option = getopt(argc, argv, "n:p:r:h")))
+	{
+		switch(option)
+		{
+			case 'n':
+				round_trips = strtoul(optarg, NULL, 0);
+				break;
+			case 'p':
+				max_p99_us = strtod(optarg, NULL);
+				break;
+			case 'r':
+				min_round_trips_per_s = strtod(optarg, NULL);
+				break;
+			default:
+				usage(argv[0]);
+				return 2;
+		}
+	}
+	//
+	if((optind >= argc) || (0 == round_trips))
+	{
+		usage(argv[0]);
+		return 2;
+	}
+	//
+	memset(&firmware, 0, sizeof(firmware));
+	memset(&sim, 0, sizeof(sim));
+	//
+	if(0 != elf_read_firmware(argv[optind], &firmware))
+	{
+		fprintf(stderr, "unable to read %s\n", argv[optind]);
+		return 2;
+	}
+	//
+	sim.avr = avr_make_mcu_by_name(MCU_NAME);
+	//
+	if(NULL == sim.avr)
+	{
+		fprintf(stderr, "simavr has no %s core\n", MCU_NAME);
+		return 2;
+	}
+	//
+	avr_init(sim.avr);
+	firmware.frequency = MCU_FREQUENCY;
+	avr_load_firmware(sim.avr, &firmware);
+	sim.avr->frequency = MCU_FREQUENCY;
+	sim.avr->log = LOG_ERROR;
+	//
+	// hook usart 0 and stop simavr echoing its output to stdout
+	{
+		uint32_t uart_flags = 0;
+
+		avr_ioctl(sim.avr, AVR_IOCTL_UART_GET_FLAGS('0'), &uart_flags);
+		uart_flags &= ~AVR_UART_FLAG_STDIO;
+		avr_ioctl(sim.avr, AVR_IOCTL_UART_SET_FLAGS('0'), &uart_flags);
+	}
+	//
+	sim.uart_input_irq = avr_io_getirq(sim.avr, AVR_IOCTL_UART_GETIRQ('0'), UART_IRQ_INPUT);
+	avr_irq_register_notify(avr_io_getirq(sim.avr, AVR_IOCTL_UART_GETIRQ('0'), UART_IRQ_OUTPUT), uart_output_hook, &sim);
+	avr_irq_register_notify(avr_io_getirq(sim.avr, AVR_IOCTL_UART_GETIRQ('0'), UART_IRQ_OUT_XOFF), uart_xoff_hook, &sim);
+	avr_irq_register_notify(avr_io_getirq(sim.avr, AVR_IOCTL_UART_GETIRQ('0'), UART_IRQ_OUT_XON), uart_xon_hook, &sim);
+	sim.uart_ready = 1;
+	//
+	latencies = calloc(round_trips, sizeof(*latencies));
+	//
+	if(NULL == latencies)
+	{
+		return 2;
+	}
+	//
+	request_length = build_get_status_request(request);
+	//
+	// let the firmware run its initialisation
+	if(!run_until_cycle(BOOT_CYCLES))
+	{
+		fprintf(stderr, "firmware stopped during boot\n");
+		return 1;
+	}
+	//
+	// phase 1, closed loop: each request is sent once the previous response is complete
+	answered = 0;
+	lost_closed_loop = 0;
+	phase_start = sim.avr->cycle;
+	sleeping_start = sim.sleeping_cycles;
+	//
+	for(i = 0; i < round_trips; i++)
+	{
+		responses_before = sim.responses;
+		request_start = sim.avr->cycle;
+		//
+		if(!inject_bytes(request, request_length, 0))
+		{
+			break;
+		}
+		//
+		while((sim.responses == responses_before) && ((sim.avr->cycle - request_start) < RESPONSE_TIMEOUT_CYCLES))
+		{
+			if(!step())
+			{
+				break;
+			}
+		}
+		//
+		if(sim.responses != responses_before)
+		{
+			latencies[answered++] = sim.last_response_cycle - request_start;
+		}
+		else
+		{
+			lost_closed_loop++;
+		}
+	}
+	//
+	closed_loop_cycles = sim.avr->cycle - phase_start;
+	idle_percentage = (0 != closed_loop_cycles) ? ((100.0 * (double)(sim.sleeping_cycles - sleeping_start)) / (double)closed_loop_cycles) : 0.0;
+	//
+	// phase 2, pipelined: requests are sent back to back at line rate
+	responses_before = sim.responses;
+	phase_start = sim.avr->cycle;
+	sim.rx_overruns = 0;
+	//
+	for(i = 0; i < round_trips; i++)
+	{
+		if(!inject_bytes(request, request_length, 1))
+		{
+			break;
+		}
+	}
+	//
+	run_until_cycle(sim.avr->cycle + DRAIN_CYCLES);
+	pipelined_cycles = sim.last_response_cycle - phase_start;
+	lost_pipelined = round_trips - (sim.responses - responses_before);
+	//
+	// report
+	qsort(latencies, answered, sizeof(*latencies), compare_cycles);
+	//
+	round_trips_per_s = (0 != closed_loop_cycles) ? (((double)answered * (double)MCU_FREQUENCY) / (double)closed_loop_cycles) : 0.0;
+	p50_us = (0 != answered) ? cycles_to_us(latencies[(answered * 50) / 100]) : 0.0;
+	p99_us = (0 != answered) ? cycles_to_us(latencies[((answered * 99) / 100) < answered ? ((answered * 99) / 100) : (answered - 1)]) : 0.0;
+	//
+	printf("mcu:                         %s @ %lu Hz\n", MCU_NAME, MCU_FREQUENCY);
+	printf("closed_loop_round_trips:     %lu\n", answered);
+	printf("closed_loop_round_trips_s:   %.1f\n", round_trips_per_s);
+	printf("closed_loop_cycles_packet:   %.1f\n", (0 != answered) ? ((double)closed_loop_cycles / (double)answered) : 0.0);
+	printf("closed_loop_latency_p50_us:  %.1f\n", p50_us);
+	printf("closed_loop_latency_p99_us:  %.1f\n", p99_us);
+	printf("closed_loop_latency_max_us:  %.1f\n", (0 != answered) ? cycles_to_us(latencies[answered - 1]) : 0.0);
+	printf("closed_loop_idle_percent:    %.1f\n", idle_percentage);
+	printf("closed_loop_lost:            %lu\n", lost_closed_loop);
+	printf("pipelined_requests:          %lu\n", round_trips);
+	printf("pipelined_responses_s:       %.1f\n", (0 != pipelined_cycles) ? (((double)(round_trips - lost_pipelined) * (double)MCU_FREQUENCY) / (double)pipelined_cycles) : 0.0);
+	printf("pipelined_cycles_packet:     %.1f\n", (round_trips != lost_pipelined) ? ((double)pipelined_cycles / (double)(round_trips - lost_pipelined)) : 0.0);
+	printf("pipelined_lost:              %lu\n", lost_pipelined);
+	printf("pipelined_rx_overruns:       %lu\n", sim.rx_overruns);
+	printf("bad_responses:               %lu\n", sim.bad_responses);
+	//
+	// release gates
+	if((0 != lost_closed_loop) || (0 != sim.bad_responses))
+	{
+		fprintf(stderr, "FAIL: %lu requests unanswered, %lu corrupt responses\n", lost_closed_loop, sim.bad_responses);
+		failed = 1;
+	}
+	//
+	if((max_p99_us > 0.0) && (p99_us > max_p99_us))
+	{
+		fprintf(stderr, "FAIL: p99 latency %.1f us exceeds %.1f us\n", p99_us, max_p99_us);
+		failed = 1;
+	}
+	//
+	if((min_round_trips_per_s > 0.0) && (round_trips_per_s < min_round_trips_per_s))
+	{
+		fprintf(stderr, "FAIL: %.1f round trips/s is below %.1f\n", round_trips_per_s, min_round_trips_per_s);
+		failed = 1;
+	}
+	//
+	free(latencies);
+
+	return failed;
+}